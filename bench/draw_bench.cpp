@@ -0,0 +1,318 @@
+/*
+  microbenchmark of per-model uniform updates: the setters by name the
+  passes used to make per draw against one ObjectBlock range bind per
+  draw, over a grid of small quads in a hidden window:
+    draw_bench [models]
+*/
+#include <glad/glad.h>
+#include <GLFW/glfw3.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <ext/matrix_transform.hpp>
+#include <vector>
+
+#include "profile.hpp"
+#include "shader.hpp"
+#include "uniforms.hpp"
+
+#define BENCH_FRAMES 20
+/* the bench's own ObjectBlock, next to FRAME_BLOCK_BINDING */
+#define BENCH_OBJECT_BINDING 1
+#define BENCH_SIZE 256
+
+static const char *LOOSE_VERTEX = R"(#version 330 core
+layout(location = 0) in vec3 aPos;
+uniform mat4 uModelMatrix;
+uniform mat4 uViewMatrix;
+uniform mat4 uProjectionMatrix;
+uniform bool uQuantized;
+uniform vec3 uPositionOffset;
+uniform vec3 uPositionScale;
+void main() {
+  vec3 position = uPositionOffset + aPos * uPositionScale;
+  if (uQuantized)
+    position *= 0.5;
+  gl_Position = uProjectionMatrix * uViewMatrix * uModelMatrix * vec4(position, 1.0);
+}
+)";
+
+static const char *LOOSE_FRAGMENT = R"(#version 330 core
+uniform int uEnableBump;
+uniform int uEnableOcclusion;
+uniform int uEnableEmission;
+uniform vec4 uBasecolor;
+uniform float uMetalness;
+uniform float uRoughness;
+out vec4 FragColor;
+void main() {
+  /* the material branches, whose flags are always off here */
+  vec3 flags = vec3(uEnableBump, uEnableOcclusion, uEnableEmission);
+  FragColor = vec4(uBasecolor.rgb * uRoughness + uMetalness + flags, 1.0);
+}
+)";
+
+static const char *FRAME_BLOCK = R"(
+layout(std140) uniform FrameBlock {
+  mat4 uViewMatrix;
+  mat4 uProjectionMatrix;
+  mat4 uPreViewMatrix;
+  mat4 uPreProjectionMatrix;
+  mat4 uWorldToScreen;
+  mat4 uLightView;
+  mat4 uLightProjection;
+  mat4 uLightWorldToScreen;
+  vec3 uCameraPos;
+  int uOffsetIdx;
+  vec3 uLightPos;
+  int uFrameCount;
+  bool uQuantized;
+};
+)";
+
+static const char *OBJECT_BLOCK = R"(
+layout(std140) uniform ObjectBlock {
+  mat4 uModelMatrix;
+  vec4 uBasecolor;
+  vec3 uPositionOffset;
+  bool uQuantized;
+  vec3 uPositionScale;
+  float uMetalness;
+  float uRoughness;
+};
+)";
+
+/* the block programs are the version line, the blocks, then these */
+static const char *BLOCK_VERTEX = R"(
+layout(location = 0) in vec3 aPos;
+void main() {
+  vec3 position = uPositionOffset + aPos * uPositionScale;
+  if (uQuantized)
+    position *= 0.5;
+  gl_Position = uProjectionMatrix * uViewMatrix * uModelMatrix * vec4(position, 1.0);
+}
+)";
+
+static const char *BLOCK_FRAGMENT = R"(
+out vec4 FragColor;
+void main() {
+  FragColor = vec4(uBasecolor.rgb * uRoughness + uMetalness, 1.0);
+}
+)";
+
+static unsigned int compileStage(GLenum type, const char *source) {
+  unsigned int stage = glCreateShader(type);
+  glShaderSource(stage, 1, &source, NULL);
+  glCompileShader(stage);
+  GLint success;
+  glGetShaderiv(stage, GL_COMPILE_STATUS, &success);
+  if (!success) {
+    char info_log[1024];
+    glGetShaderInfoLog(stage, 1024, NULL, info_log);
+    printf("compile failed:\n%s\n", info_log);
+    exit(1);
+  }
+  return stage;
+}
+
+static shader_t compileProgram(const char *vertex_code,
+                               const char *fragment_code) {
+  unsigned int vertex = compileStage(GL_VERTEX_SHADER, vertex_code);
+  unsigned int fragment = compileStage(GL_FRAGMENT_SHADER, fragment_code);
+  shader_t shader;
+  shader.ID = glCreateProgram();
+  glAttachShader(shader.ID, vertex);
+  glAttachShader(shader.ID, fragment);
+  glLinkProgram(shader.ID);
+  glDeleteShader(vertex);
+  glDeleteShader(fragment);
+  return shader;
+}
+
+/* OBJECT_BLOCK in std140, the ObjectBlock the model shaders had before
+   their per-object data moved to instance attributes */
+class bench_object_t {
+public:
+  glm::mat4 model;
+  glm::vec4 basecolor;
+  glm::vec3 position_offset;
+  int quantized;
+  glm::vec3 position_scale;
+  float metalness;
+  float roughness;
+  float padding[3];
+};
+
+/* cpu time to issue a frame and time until the GPU has finished it */
+class frame_time_t {
+public:
+  double submit_ms = 1e30;
+  double total_ms = 1e30;
+};
+
+/* what drawSceneDeferred did per model before the blocks and the
+   material permutations */
+static void drawLoose(shader_t &shader, const frame_uniforms_t &frame,
+                      const std::vector<bench_object_t> &objects,
+                      int index_count, frame_time_t *time) {
+  stopwatch_t watch;
+  shader.use();
+  shader.setMat4("uViewMatrix", frame.view);
+  shader.setMat4("uProjectionMatrix", frame.projection);
+  for (const bench_object_t &object : objects) {
+    shader.setMat4("uModelMatrix", object.model);
+    shader.setBool("uQuantized", object.quantized);
+    shader.setVec3("uPositionOffset", object.position_offset);
+    shader.setVec3("uPositionScale", object.position_scale);
+    shader.setVec4("uBasecolor", object.basecolor);
+    shader.setFloat("uMetalness", object.metalness);
+    shader.setFloat("uRoughness", object.roughness);
+    shader.setInt("uEnableBump", 0);
+    shader.setInt("uEnableOcclusion", 0);
+    shader.setInt("uEnableEmission", 0);
+    glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, 0);
+  }
+  time->submit_ms = std::min(time->submit_ms, watch.ms());
+  glFinish();
+  time->total_ms = std::min(time->total_ms, watch.ms());
+}
+
+/* what it does now: the frame's blocks written once, a range bind per draw */
+static void drawBlocks(shader_t &shader, const frame_uniforms_t &frame,
+                       const std::vector<bench_object_t> &objects,
+                       int index_count, uniform_ring_t *frame_ring,
+                       uniform_ring_t *object_ring, frame_time_t *time) {
+  stopwatch_t watch;
+  frame_ring->map(1);
+  frame_ring->write(0, &frame);
+  frame_ring->unmap();
+  frame_ring->bind(FRAME_BLOCK_BINDING, 0);
+  object_ring->map((int)objects.size());
+  for (size_t i = 0; i < objects.size(); i++)
+    object_ring->write((int)i, &objects[i]);
+  object_ring->unmap();
+
+  shader.use();
+  for (size_t i = 0; i < objects.size(); i++) {
+    object_ring->bind(BENCH_OBJECT_BINDING, (int)i);
+    glDrawElements(GL_TRIANGLES, index_count, GL_UNSIGNED_INT, 0);
+  }
+  time->submit_ms = std::min(time->submit_ms, watch.ms());
+  glFinish();
+  time->total_ms = std::min(time->total_ms, watch.ms());
+}
+
+static unsigned long long checksum() {
+  std::vector<unsigned char> pixels(BENCH_SIZE * BENCH_SIZE * 4);
+  glReadPixels(0, 0, BENCH_SIZE, BENCH_SIZE, GL_RGBA, GL_UNSIGNED_BYTE,
+               pixels.data());
+  unsigned long long sum = 0;
+  for (unsigned char value : pixels)
+    sum = sum * 31 + value;
+  return sum;
+}
+
+int main(int argc, char **argv) {
+  int num_models = argc > 1 ? atoi(argv[1]) : 4096;
+
+  glfwInit();
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
+  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
+  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+  glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+  GLFWwindow *window =
+      glfwCreateWindow(BENCH_SIZE, BENCH_SIZE, "draw_bench", NULL, NULL);
+  if (window == NULL) {
+    glfwTerminate();
+    return 1;
+  }
+  glfwMakeContextCurrent(window);
+  if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
+    glfwTerminate();
+    return 1;
+  }
+
+  /* one quad every model draws, so the draw calls dominate */
+  float vertices[] = {-1, -1, 0, 1, -1, 0, 1, 1, 0, -1, 1, 0};
+  unsigned int indices[] = {0, 1, 2, 0, 2, 3};
+  unsigned int vao, vbo, ebo;
+  glGenVertexArrays(1, &vao);
+  glBindVertexArray(vao);
+  glGenBuffers(1, &vbo);
+  glBindBuffer(GL_ARRAY_BUFFER, vbo);
+  glBufferData(GL_ARRAY_BUFFER, sizeof(vertices), vertices, GL_STATIC_DRAW);
+  glGenBuffers(1, &ebo);
+  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ebo);
+  glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(indices), indices,
+               GL_STATIC_DRAW);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
+
+  shader_t loose = compileProgram(LOOSE_VERTEX, LOOSE_FRAGMENT);
+  std::string version = "#version 330 core\n";
+  shader_t blocks =
+      compileProgram((version + FRAME_BLOCK + OBJECT_BLOCK + BLOCK_VERTEX).c_str(),
+                     (version + OBJECT_BLOCK + BLOCK_FRAGMENT).c_str());
+  blocks.bindBlock("FrameBlock", FRAME_BLOCK_BINDING);
+  blocks.bindBlock("ObjectBlock", BENCH_OBJECT_BINDING);
+
+  frame_uniforms_t frame = {};
+  frame.view = glm::mat4(1.0f);
+  frame.projection = glm::mat4(1.0f);
+  int grid = 1;
+  while (grid * grid < num_models)
+    grid++;
+  std::vector<bench_object_t> objects(num_models);
+  for (int i = 0; i < num_models; i++) {
+    bench_object_t &object = objects[i];
+    glm::vec3 center((i % grid + 0.5f) * 2.0f / grid - 1.0f,
+                     (i / grid + 0.5f) * 2.0f / grid - 1.0f, 0.0f);
+    object.model = glm::scale(glm::translate(glm::mat4(1.0f), center),
+                              glm::vec3(0.8f / grid));
+    object.basecolor = glm::vec4((i % 7) / 7.0f, (i % 5) / 5.0f, 0.5f, 1.0f);
+    object.position_offset = glm::vec3(0.0f);
+    object.quantized = i % 2;
+    object.position_scale = glm::vec3(1.0f);
+    object.metalness = (i % 3) / 3.0f;
+    object.roughness = 0.5f;
+  }
+
+  /* its own target, hidden windows need not keep their pixels */
+  unsigned int fbo, color;
+  glGenFramebuffers(1, &fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  glGenRenderbuffers(1, &color);
+  glBindRenderbuffer(GL_RENDERBUFFER, color);
+  glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, BENCH_SIZE, BENCH_SIZE);
+  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                            GL_RENDERBUFFER, color);
+
+  uniform_ring_t frame_ring(sizeof(frame_uniforms_t));
+  uniform_ring_t object_ring(sizeof(bench_object_t));
+  glViewport(0, 0, BENCH_SIZE, BENCH_SIZE);
+
+  frame_time_t loose_time, block_time;
+  unsigned long long loose_sum = 0, block_sum = 0;
+  for (int run = 0; run < BENCH_FRAMES; run++) {
+    glClear(GL_COLOR_BUFFER_BIT);
+    drawLoose(loose, frame, objects, 6, &loose_time);
+    loose_sum = checksum();
+    glClear(GL_COLOR_BUFFER_BIT);
+    drawBlocks(blocks, frame, objects, 6, &frame_ring, &object_ring,
+               &block_time);
+    block_sum = checksum();
+  }
+
+  printf("%d models, best of %d frames\n", num_models, BENCH_FRAMES);
+  printf("  by name %8.3f ms submit (%6.3f us/draw), %8.3f ms with gpu\n",
+         loose_time.submit_ms, 1000.0 * loose_time.submit_ms / num_models,
+         loose_time.total_ms);
+  printf("  blocks  %8.3f ms submit (%6.3f us/draw), %8.3f ms with gpu\n",
+         block_time.submit_ms, 1000.0 * block_time.submit_ms / num_models,
+         block_time.total_ms);
+  printf("  images %s\n", loose_sum == block_sum ? "match" : "DIFFER");
+
+  glfwTerminate();
+  return 0;
+}
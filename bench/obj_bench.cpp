@@ -0,0 +1,126 @@
+/*
+  OBJ parse time of the mapped, threaded from_chars parser against the
+  fgets and sscanf loop it replaced, on the same file:
+    obj_bench [file.obj]
+*/
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "mesh.hpp"
+#include "pool.hpp"
+
+#define BENCH_RUNS 5
+
+static double nowMs() {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/* the previous loader, one vertex per corner; faces must be v/t/n */
+static mesh_t *loadObjScanf(const std::string &filename) {
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec2> texcoords;
+  std::vector<glm::vec3> normals;
+  std::vector<int> position_indices;
+  std::vector<int> texcoord_indices;
+  std::vector<int> normal_indices;
+  char line[256];
+
+  FILE *file = fopen(filename.c_str(), "rb");
+  if (file == nullptr)
+    return nullptr;
+  while (fgets(line, 256, file) != NULL) {
+    if (strncmp(line, "v ", 2) == 0) {
+      glm::vec3 position;
+      sscanf(line, "v %f %f %f", &position.x, &position.y, &position.z);
+      positions.push_back(position);
+    } else if (strncmp(line, "vt ", 3) == 0) {
+      glm::vec2 texcoord;
+      sscanf(line, "vt %f %f", &texcoord.x, &texcoord.y);
+      texcoords.push_back(texcoord);
+    } else if (strncmp(line, "vn ", 3) == 0) {
+      glm::vec3 normal;
+      sscanf(line, "vn %f %f %f", &normal.x, &normal.y, &normal.z);
+      normals.push_back(normal);
+    } else if (strncmp(line, "f ", 2) == 0) {
+      int p[3], t[3], n[3];
+      int items = sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d", &p[0], &t[0],
+                         &n[0], &p[1], &t[1], &n[1], &p[2], &t[2], &n[2]);
+      if (items != 9)
+        continue;
+      for (int i = 0; i < 3; i++) {
+        position_indices.push_back(p[i] - 1);
+        texcoord_indices.push_back(t[i] - 1);
+        normal_indices.push_back(n[i] - 1);
+      }
+    }
+  }
+  fclose(file);
+
+  mesh_t *mesh = new mesh_t();
+  mesh->vertices.resize(position_indices.size());
+  for (size_t i = 0; i < position_indices.size(); i++) {
+    mesh->vertices[i].position = positions[position_indices[i]];
+    mesh->vertices[i].texcoord = texcoords[texcoord_indices[i]];
+    mesh->vertices[i].normal = normals[normal_indices[i]];
+  }
+  mesh->num_faces = (int)position_indices.size() / 3;
+  return mesh;
+}
+
+/* best of BENCH_RUNS, keeping the last mesh */
+template <typename F>
+static double timeParser(F parse, const std::string &filename,
+                         mesh_t **result) {
+  double best = 1e30;
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    delete *result;
+    double start = nowMs();
+    *result = parse(filename);
+    best = std::min(best, nowMs() - start);
+  }
+  return best;
+}
+
+/* largest difference in position, texcoord or normal between corners */
+static float maxDifference(const mesh_t *a, const mesh_t *b) {
+  if (a->vertices.size() != b->vertices.size())
+    return INFINITY;
+  float diff = 0.0f;
+  for (size_t i = 0; i < a->vertices.size(); i++) {
+    const vertex_t &u = a->vertices[i], &v = b->vertices[i];
+    for (int c = 0; c < 3; c++) {
+      diff = std::max(diff, std::fabs(u.position[c] - v.position[c]));
+      diff = std::max(diff, std::fabs(u.normal[c] - v.normal[c]));
+    }
+    for (int c = 0; c < 2; c++)
+      diff = std::max(diff, std::fabs(u.texcoord[c] - v.texcoord[c]));
+  }
+  return diff;
+}
+
+int main(int argc, char **argv) {
+  std::string filename = argc > 1 ? argv[1] : "../assets/helmet/helmet.obj";
+  mesh_t *scanf_mesh = nullptr, *mapped_mesh = nullptr;
+  double scanf_ms = timeParser(loadObjScanf, filename, &scanf_mesh);
+  if (scanf_mesh == nullptr) {
+    printf("cannot open %s\n", filename.c_str());
+    return 1;
+  }
+  double mapped_ms = timeParser(loadObj, filename, &mapped_mesh);
+
+  printf("%s: %d faces, best of %d, %d threads\n", filename.c_str(),
+         mapped_mesh->num_faces, BENCH_RUNS, parallelism());
+  printf("  sscanf     %8.3f ms\n", scanf_ms);
+  printf("  from_chars %8.3f ms  %5.2fx  max diff %.2e\n", mapped_ms,
+         scanf_ms / mapped_ms, maxDifference(scanf_mesh, mapped_mesh));
+  delete scanf_mesh;
+  delete mapped_mesh;
+  return 0;
+}
@@ -0,0 +1,90 @@
+/*
+  microbenchmark of the SH9 projection kernels over a synthetic cube map
+  with the same pattern on every face:
+    sh_bench [face size]
+*/
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "sh.hpp"
+
+#define BENCH_RUNS 20
+
+typedef void (*kernel_t)(const float *, int, int, int, int, int, sh9_sums_t *);
+
+static double nowMs() {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now().time_since_epoch())
+      .count();
+}
+
+/* best of BENCH_RUNS over all six faces */
+static double timeKernel(kernel_t kernel, const std::vector<float> &face,
+                         int size, sh9_sums_t *result) {
+  double best = 1e30;
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    sh9_sums_t sums;
+    double start = nowMs();
+    for (int i = 0; i < 6; i++)
+      kernel(face.data(), size, 3, i, 0, size, &sums);
+    best = std::min(best, nowMs() - start);
+    *result = sums;
+  }
+  return best;
+}
+
+static double timeThreaded(const std::vector<float> &face, int size,
+                           sh9_sums_t *result) {
+  double best = 1e30;
+  for (int run = 0; run < BENCH_RUNS; run++) {
+    sh9_sums_t sums;
+    double start = nowMs();
+    for (int i = 0; i < 6; i++)
+      sums.add(projectFace(face.data(), size, 3, i));
+    best = std::min(best, nowMs() - start);
+    *result = sums;
+  }
+  return best;
+}
+
+static double maxDifference(const sh9_t &a, const sh9_t &b) {
+  double diff = 0.0;
+  for (int k = 0; k < SH9_COEFFICIENTS; k++)
+    for (int c = 0; c < 3; c++)
+      diff = std::max(diff, (double)std::fabs(a.coefficients[k][c] -
+                                              b.coefficients[k][c]));
+  return diff;
+}
+
+int main(int argc, char **argv) {
+  int size = argc > 1 ? atoi(argv[1]) : 512;
+  /* the same smooth pattern on every face */
+  std::vector<float> face((size_t)size * size * 3);
+  for (int y = 0; y < size; y++)
+    for (int x = 0; x < size; x++)
+      for (int c = 0; c < 3; c++)
+        face[((size_t)y * size + x) * 3 + c] =
+            1.0f + 0.5f * std::sin(0.05f * x + c) * std::cos(0.03f * y);
+
+  sh9_sums_t scalar, simd, threaded;
+  double scalar_ms = timeKernel(projectRowsScalar, face, size, &scalar);
+  double simd_ms = timeKernel(projectRows, face, size, &simd);
+  double threaded_ms = timeThreaded(face, size, &threaded);
+  double texels = 6.0 * size * size;
+
+  sh9_t reference = irradianceSH9(scalar);
+  printf("6 x %dx%d faces, best of %d\n", size, size, BENCH_RUNS);
+  printf("  scalar   %8.3f ms  %6.1f Mtexel/s\n", scalar_ms,
+         texels / scalar_ms / 1000.0);
+  printf("  simd     %8.3f ms  %6.1f Mtexel/s  max diff %.2e\n", simd_ms,
+         texels / simd_ms / 1000.0,
+         maxDifference(reference, irradianceSH9(simd)));
+  printf("  threaded %8.3f ms  %6.1f Mtexel/s  max diff %.2e\n", threaded_ms,
+         texels / threaded_ms / 1000.0,
+         maxDifference(reference, irradianceSH9(threaded)));
+  return 0;
+}
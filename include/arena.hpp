@@ -0,0 +1,63 @@
+#pragma once
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <cstddef>
+#include <glad/glad.h>
+#include <map>
+
+/* first fit over the free spans of a buffer that only grows at its end */
+class span_allocator_t {
+public:
+  size_t capacity = 0;
+  size_t used = 0;
+
+  /* offset of size bytes aligned to alignment, or SIZE_MAX when capacity
+     has to grow first */
+  size_t allocate(size_t size, size_t alignment);
+  void release(size_t offset, size_t size);
+  /* the bytes from the old capacity on become free */
+  void grow(size_t capacity);
+
+private:
+  /* offset to size, neighbours always merged */
+  std::map<size_t, size_t> free_spans;
+};
+
+/*
+  the vertices and indices of every mesh in one vertex and one index
+  buffer behind one VAO; meshes draw with a base vertex and first index
+  into them, so going from one mesh to the next changes no GL state and a
+  pass can go out as multi-draw indirect; full buffers are copied into
+  ones twice the size; GL thread only
+*/
+class geometry_arena_t {
+public:
+  unsigned int VAO;
+  unsigned int VBO;
+  unsigned int EBO;
+  size_t vertex_stride;
+  span_allocator_t vertices;
+  span_allocator_t indices;
+
+  /* format points the attributes of the bound VAO at offset 0 of the
+     bound GL_ARRAY_BUFFER, once for every new vertex buffer */
+  geometry_arena_t(size_t vertex_stride, void (*format)());
+  geometry_arena_t(const geometry_arena_t &) = delete;
+  geometry_arena_t &operator=(const geometry_arena_t &) = delete;
+
+  /* copies the vertices in, returns their base vertex */
+  unsigned int addVertices(const void *data, size_t count);
+  /* copies the indices in, returns the first in units of index_size */
+  unsigned int addIndices(const void *data, size_t count, size_t index_size);
+  void releaseVertices(unsigned int base_vertex, size_t count);
+  void releaseIndices(unsigned int first_index, size_t count,
+                      size_t index_size);
+
+private:
+  void (*format)();
+  void growBuffer(GLenum target, unsigned int *buffer,
+                  span_allocator_t *spans, size_t needed);
+};
+
+#endif
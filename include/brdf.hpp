@@ -0,0 +1,19 @@
+#pragma once
+#ifndef BRDF_H
+#define BRDF_H
+
+#include "texture.hpp"
+
+/* texels per side of the BRDF LUT */
+#define BRDF_LUT_SIZE 128
+
+/*
+  the GGX terms both shading passes look up, x is NdotV and y roughness:
+  r, g the split-sum scale and bias of F0, b the directional albedo E of
+  the single-scatter lobe (r + g without Fresnel), a its cosine-weighted
+  average E_avg for Kulla-Conty; RGBA16F, read from ../assets/brdf_lut.cache
+  or integrated on all hardware threads and cached
+*/
+texture_data_t *loadBRDFLut();
+
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+#ifndef BVH_H
+#define BVH_H
+
+#include <glm.hpp>
+#include <vector>
+
+#include "cull.hpp"
+
+/* most entries a leaf holds, tested four at a time */
+#define BVH_LEAF_SIZE 16
+
+/* boxes as one array per bound, so four of them load as one register */
+class bounds_soa_t {
+public:
+  std::vector<float> min_x, min_y, min_z;
+  std::vector<float> max_x, max_y, max_z;
+
+  void resize(int count);
+  void set(int index, const glm::vec3 &bounds_min, const glm::vec3 &bounds_max);
+  glm::vec3 min(int index) const;
+  glm::vec3 max(int index) const;
+};
+
+/* a node covers the entries [first, first + count); an inner node's
+   children are left and left + 1, a leaf has left -1 */
+class bvh_node_t {
+public:
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
+  int first;
+  int count;
+  int left;
+  int parent;
+};
+
+/* median split BVH over the world boxes of a scene's parts; update() and
+   refit() move boxes without changing the tree's shape */
+class scene_bvh_t {
+public:
+  std::vector<bvh_node_t> nodes;
+  /* the part of each entry */
+  std::vector<int> entries;
+  /* per entry, in entry order */
+  bounds_soa_t bounds;
+
+  /* one box per part, indexed by part */
+  void build(const std::vector<glm::vec3> &bounds_min,
+             const std::vector<glm::vec3> &bounds_max);
+  int size() const { return (int)this->entries.size(); }
+  void update(int part, const glm::vec3 &bounds_min,
+              const glm::vec3 &bounds_max);
+  /* the nodes above every update() since the last refit */
+  void refit();
+  /* appends the parts whose boxes meet the frustum */
+  void cull(const frustum_t &frustum, std::vector<int> *visible,
+            cull_stats_t *stats) const;
+
+private:
+  /* the entry of each part and the leaf of each entry */
+  std::vector<int> slots;
+  std::vector<int> leaves;
+  std::vector<int> dirty;
+
+  /* fills nodes[index] and below with the entries [first, first + count) */
+  void split(int index, int first, int count, int parent,
+             const std::vector<glm::vec3> &bounds_min,
+             const std::vector<glm::vec3> &bounds_max);
+  void fitLeaf(bvh_node_t &node) const;
+};
+
+#endif
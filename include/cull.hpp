@@ -0,0 +1,85 @@
+#pragma once
+#ifndef CULL_H
+#define CULL_H
+
+#include <glm.hpp>
+
+#include "profile.hpp"
+#include "queue.hpp"
+#include "shader.hpp"
+#include "uniforms.hpp"
+
+/* where the camera passes drop models outside the view */
+enum Cull_Mode { CULL_NONE, CULL_CPU, CULL_GPU };
+
+/* the six planes of a world to clip matrix, normals pointing inside */
+class frustum_t {
+public:
+  glm::vec4 planes[6];
+
+  frustum_t(const glm::mat4 &world_to_clip);
+  /* false only when the box is wholly outside one plane */
+  bool intersects(const glm::vec3 &bounds_min,
+                  const glm::vec3 &bounds_max) const;
+  /* true when the box is wholly inside every plane */
+  bool contains(const glm::vec3 &bounds_min,
+                const glm::vec3 &bounds_max) const;
+};
+
+/* the world space box around an object space box under transform */
+void transformBounds(const glm::mat4 &transform, const glm::vec3 &bounds_min,
+                     const glm::vec3 &bounds_max, glm::vec3 *world_min,
+                     glm::vec3 *world_max);
+
+/* models tested and dropped by one pass of a frame */
+class cull_stats_t {
+public:
+  int tested = 0;
+  /* only known to the CPU when it culls */
+  int culled = 0;
+  /* BVH nodes and single boxes the CPU tested */
+  int nodes = 0;
+  int boxes = 0;
+  /* to cull the pass on the CPU */
+  double cpu_ms = 0.0;
+};
+
+/* tests each camera pass instance against the frustum and last frame's
+   depth pyramid in a compute pass, into the draw commands; GL 4.3 */
+class gpu_culler_t {
+public:
+  /* the surviving instances, where the ring had them */
+  unsigned int culled_instances;
+  /* mip 0 is half the depth buffer, each texel the farthest below it */
+  unsigned int depth_pyramid;
+  int pyramid_width;
+  int pyramid_height;
+  int pyramid_levels;
+  /* the pyramid holds a frame to test against; what it hid shows up a
+     frame late */
+  bool occlusion;
+  gpu_timer_t timer;
+
+  gpu_culler_t();
+  ~gpu_culler_t();
+  gpu_culler_t(const gpu_culler_t &) = delete;
+  gpu_culler_t &operator=(const gpu_culler_t &) = delete;
+
+  /* compiles the programs and sizes the pyramid for a depth buffer */
+  void config(int width, int height);
+  /* the pass's commands must have been uploaded with no instances */
+  void cull(const render_queue_t &queue, Render_Pass pass,
+            const uniform_ring_t &instances, const uniform_ring_t &objects,
+            const uniform_ring_t &commands);
+  /* from the R32F depth of the geometry pass, for the next frame */
+  void buildPyramid(unsigned int depth);
+
+private:
+  shader_t cull_shader;
+  shader_t pyramid_shader;
+  size_t culled_bytes;
+  int depth_width;
+  int depth_height;
+};
+
+#endif
@@ -0,0 +1,41 @@
+#pragma once
+#ifndef FILE_H
+#define FILE_H
+
+#include <cstddef>
+#include <string>
+
+/* read-only memory mapping of a whole file */
+class mapped_file_t {
+public:
+  const char *data;
+  size_t size;
+
+  mapped_file_t();
+  ~mapped_file_t();
+  mapped_file_t(const mapped_file_t &) = delete;
+  mapped_file_t &operator=(const mapped_file_t &) = delete;
+
+  bool open(const std::string &filename);
+  void close();
+
+private:
+#ifdef _WIN32
+  void *file_handle;
+  void *mapping_handle;
+#endif
+};
+
+/* modification time and size of a file, false if it does not exist */
+bool fileStamp(const std::string &filename, long long *mtime,
+               unsigned long long *size);
+
+/* 64-bit FNV-1a, chainable through seed */
+unsigned long long hashBytes(const void *data, size_t size,
+                             unsigned long long seed = 14695981039346656037ull);
+
+/* writes through a temporary file so readers never see a partial cache */
+bool writeFileAtomic(const std::string &filename, const void *const *chunks,
+                     const size_t *sizes, int num_chunks);
+
+#endif
@@ -0,0 +1,55 @@
+#pragma once
+#ifndef IBL_H
+#define IBL_H
+
+#include <string>
+#include <vector>
+
+#include "sh.hpp"
+#include "texture.hpp"
+
+/* number of prefiltered levels configIBL renders, roughness 0 to 1 */
+#define IBL_PREFILTER_LEVELS 5
+
+/*
+  what configIBL bakes for one environment; skybox and prefiltered faces
+  are shared-exponent RGB9_E5
+*/
+class ibl_data_t {
+public:
+  texture_data_t *skybox[6];
+  texture_data_t *prefilter[6];
+  /* diffuse irradiance projected from the skybox faces */
+  sh9_t irradiance;
+
+  ibl_data_t();
+  ~ibl_data_t();
+  ibl_data_t(const ibl_data_t &) = delete;
+  ibl_data_t &operator=(const ibl_data_t &) = delete;
+};
+
+/* HDR faces of an environment in cube map order, +x -x +y -y +z -z */
+std::vector<std::string> environmentFaces(const std::string &environment);
+
+/* the scene settings a bake depends on, besides its faces and shaders */
+class ibl_settings_t {
+public:
+  /* tells bake variants apart */
+  unsigned int flags;
+  int samples;
+  int first_samples;
+};
+
+/* the cached bake of an environment, null when missing or stale; any
+   thread */
+ibl_data_t *loadIBLCache(const std::string &environment,
+                         const ibl_settings_t &settings);
+
+/* reads the baked textures back and packs them, GL thread only */
+ibl_data_t *readIBL(unsigned int skybox, unsigned int prefilter);
+
+/* writes <environment>/ibl.cache, any thread */
+void saveIBLCache(const std::string &environment,
+                  const ibl_settings_t &settings, const ibl_data_t *ibl);
+
+#endif
@@ -0,0 +1,26 @@
+#pragma once
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <string>
+
+/* decoded pixels, safe to produce on any thread */
+class image_t {
+public:
+  int width;
+  int height;
+  int channels;
+  bool hdr;
+  void *data;
+
+  image_t();
+  ~image_t();
+  image_t(const image_t &) = delete;
+  image_t &operator=(const image_t &) = delete;
+
+  /* 8 bits per channel, or float when hdr, in the file's own channel count */
+  bool load(const std::string &filename, bool flip, bool hdr = false);
+  size_t bytes() const;
+};
+
+#endif
@@ -2,6 +2,7 @@
 #ifndef MESH_H
 #define MESH_H
 
+#include <ext/matrix_float4x4.hpp>
 #include <string>
 #include <vec2.hpp>
 #include <vec3.hpp>
@@ -21,9 +22,31 @@ public:
 class mesh_t {
 public:
   std::vector<vertex_t> vertices;
+  std::vector<unsigned int> indices;
   int num_faces;
+  /* object space box of the vertices, set when the mesh is built */
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
+};
+
+/* index range of one source mesh within a merged mesh */
+class submesh_t {
+public:
+  unsigned int first_index;
+  unsigned int index_count;
+  /* bounds in the space of the merged vertices */
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
 };
 
 mesh_t *loadMesh(std::string filename);
+/* the OBJ parser alone, without the cache or the index optimization; one
+   vertex per triangle corner */
+mesh_t *loadObj(std::string filename);
+/* one mesh of the parts with each part's vertices moved by its transform,
+   in order; ranges gets a submesh per part */
+mesh_t *mergeMeshes(const std::vector<const mesh_t *> &parts,
+                    const std::vector<glm::mat4> &transforms,
+                    std::vector<submesh_t> *ranges);
 
 #endif
\ No newline at end of file
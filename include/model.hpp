@@ -4,10 +4,27 @@
 
 #include <ext/matrix_float4x4.hpp>
 
+#include "arena.hpp"
 #include "mesh.hpp"
 
+/* material maps a model has, each selects a shader permutation that
+   samples it; bits of model_t::features() */
+enum Material_Feature {
+  FEATURE_BASECOLOR_MAP = 1 << 0,
+  FEATURE_ROUGHNESS_MAP = 1 << 1,
+  FEATURE_METALNESS_MAP = 1 << 2,
+  FEATURE_OCCLUSION_MAP = 1 << 3,
+  FEATURE_NORMAL_MAP = 1 << 4,
+  FEATURE_EMISSION_MAP = 1 << 5
+};
+#define MATERIAL_FEATURES 6
+/* the GLSL #define of each feature, in bit order */
+extern const char *const MATERIAL_FEATURE_DEFINES[MATERIAL_FEATURES];
+
 class material_t {
 public:
+  /* position in the scene's material list, part of draw sort keys */
+  unsigned int index;
   glm::vec4 basecolor_factor;
   float metalness_factor;
   float roughness_factor;
@@ -22,25 +39,74 @@ public:
   float alpha_cutoff;
 };
 
-class model_t {
+/* one mesh in geometryArena(), shared by every model that draws it */
+class mesh_buffer_t {
 public:
   mesh_t *mesh;
+
+  /* small and reused like a GL name, sort keys tell meshes apart by it */
+  unsigned int id;
+  unsigned int base_vertex;
+  unsigned int first_index;
+  unsigned int index_count;
+  unsigned int index_type;
+  size_t buffer_bytes;
+
+  /* object position = position_offset + attribute * position_scale; the
+     arena has one vertex format, so quantized is QUANTIZE_VERTICES */
+  bool quantized;
+  glm::vec3 position_offset;
+  glm::vec3 position_scale;
+  /* object space bounds of the vertices */
+  glm::vec3 bounds_min;
+  glm::vec3 bounds_max;
+  /* the source meshes of a static batch, each its own box in the scene's
+     BVH; empty for a single mesh */
+  std::vector<submesh_t> submeshes;
+
+  /* uploads mesh and takes ownership of it */
+  mesh_buffer_t(mesh_t *mesh);
+  ~mesh_buffer_t();
+  mesh_buffer_t(const mesh_buffer_t &) = delete;
+  mesh_buffer_t &operator=(const mesh_buffer_t &) = delete;
+
+  /* the draw call alone, of the index_count indices from first_index on
+     within this buffer, with the arena's VAO bound and the instance
+     attributes pointed at the first instance */
+  void draw(int instances, unsigned int first_index,
+            unsigned int index_count) const;
+  /* bytes per index, index_type as a size */
+  size_t indexSize() const;
+
+  void configBuffer();
+  void configFloatBuffer();
+  void configQuantizedBuffer();
+};
+
+class model_t {
+public:
+  mesh_buffer_t *buffer;
   material_t *material;
   glm::mat4 transform;
 
-  unsigned int VAO;
-  unsigned int VBO;
-
   unsigned int basecolor_map;
-  unsigned int metalness_map;
-  unsigned int roughness_map;
+  /* roughness, metalness, occlusion in r, g, b, packed at import from
+     whichever of the material's three maps exist */
+  unsigned int rmo_map;
   unsigned int normal_map;
-  unsigned int occlusion_map;
   unsigned int emission_map;
 
-  model_t(mesh_t *mesh, material_t *material, glm::mat4 transform);
-  void configBuffer();
-  void configTexture();
-  void draw();
+  model_t(mesh_buffer_t *buffer, material_t *material, glm::mat4 transform);
+
+  /* Material_Feature bits of the maps bound so far */
+  unsigned int features() const;
 };
+
+/* Material_Feature bits of a model once all of its maps are bound */
+unsigned int materialFeatures(const material_t *material);
+
+/* 20-byte vertices instead of 48, see configQuantizedBuffer */
+extern const bool QUANTIZE_VERTICES;
+/* every mesh_buffer_t, in the vertex format QUANTIZE_VERTICES picks */
+geometry_arena_t &geometryArena();
 #endif
\ No newline at end of file
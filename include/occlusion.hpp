@@ -0,0 +1,84 @@
+#pragma once
+#ifndef OCCLUSION_H
+#define OCCLUSION_H
+
+#include <glm.hpp>
+#include <vector>
+
+#include "mesh.hpp"
+
+/* the index_count indices of a mesh from first_index on, drawn into the
+   occlusion buffer and placed by transform */
+class occluder_t {
+public:
+  const mesh_t *mesh;
+  unsigned int first_index;
+  unsigned int index_count;
+  glm::mat4 transform;
+};
+
+/* a front facing occluder triangle set up for the edge walk, in pixels */
+class occluder_triangle_t {
+public:
+  /* edge i is a * x + b * y + c, positive inside */
+  float edge_a[3];
+  float edge_b[3];
+  float edge_c[3];
+  /* 1 / w across the triangle, the same way */
+  float depth_a;
+  float depth_b;
+  float depth_c;
+  /* the pixels it may cover, min_x a multiple of four */
+  int min_x, max_x;
+  int min_y, max_y;
+};
+
+/* what the occlusion pass of a frame drew and dropped */
+class occlusion_stats_t {
+public:
+  int occluders = 0;
+  int triangles = 0;
+  int tested = 0;
+  int culled = 0;
+  double raster_ms = 0.0;
+  double test_ms = 0.0;
+};
+
+/* low resolution 1 / w of a few large occluders, rasterized on the CPU
+   to drop models behind them before they reach GL */
+class occlusion_buffer_t {
+public:
+  int width;
+  int height;
+  std::vector<float> depth;
+  occlusion_stats_t stats;
+  /* R32F copy of depth for the debug view */
+  unsigned int debug_texture;
+
+  occlusion_buffer_t();
+  ~occlusion_buffer_t();
+  occlusion_buffer_t(const occlusion_buffer_t &) = delete;
+  occlusion_buffer_t &operator=(const occlusion_buffer_t &) = delete;
+
+  /* width a multiple of four */
+  void config(int width, int height);
+  /* clears the buffer and draws the front faces of the occluders; faces
+     that cross the near plane are left out */
+  void render(const std::vector<occluder_t> &occluders,
+              const glm::mat4 &world_to_clip);
+  /* false when occluders cover the whole box, under render()'s matrix; a
+     gap narrower than a pixel does not show it */
+  bool visible(const glm::vec3 &world_min, const glm::vec3 &world_max) const;
+  /* copies depth into debug_texture */
+  void uploadDebug();
+
+private:
+  glm::mat4 world_to_clip;
+  /* per occluder, set up in parallel */
+  std::vector<std::vector<occluder_triangle_t>> triangles;
+
+  void setup(const occluder_t &occluder, std::vector<occluder_triangle_t> *out);
+  void rasterRows(int row_begin, int row_end);
+};
+
+#endif
@@ -0,0 +1,57 @@
+#pragma once
+#ifndef POOL_H
+#define POOL_H
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* fixed set of worker threads draining one FIFO of jobs */
+class pool_t {
+public:
+  pool_t(int num_threads);
+  ~pool_t();
+  pool_t(const pool_t &) = delete;
+  pool_t &operator=(const pool_t &) = delete;
+
+  template <typename F> auto submit(F job) -> std::future<decltype(job())> {
+    typedef decltype(job()) result_t;
+    auto task = std::make_shared<std::packaged_task<result_t()>>(std::move(job));
+    std::future<result_t> result = task->get_future();
+    push([task]() { (*task)(); });
+    return result;
+  }
+  int size() const;
+
+private:
+  std::vector<std::thread> workers;
+  std::deque<std::function<void()>> jobs;
+  std::mutex mutex;
+  std::condition_variable wake;
+  bool stopping;
+
+  void push(std::function<void()> job);
+  void run();
+};
+
+/* process-wide pool with one worker per hardware thread */
+pool_t &workerPool();
+
+/* true on pool workers, where spawning more threads would oversubscribe */
+bool onWorkerThread();
+
+/* threads a parallelFor() started here can run on: the caller and every
+   worker, or the caller alone on a worker that already runs a job */
+int parallelism();
+
+/* runs job(i) for every i in [0, count) on the calling thread and on
+   whichever workers are idle; the caller only waits for indices a worker
+   has already taken, so a pool busy with loads never holds it up */
+void parallelFor(int count, const std::function<void(int)> &job);
+
+#endif
@@ -0,0 +1,50 @@
+#pragma once
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <chrono>
+#include <glad/glad.h>
+
+/* a line per mesh, map, program and buffer on top of reportImport's
+   totals */
+#define VERBOSE_ASSETS 0
+
+/* wall-clock interval since construction or the last reset */
+class stopwatch_t {
+public:
+  stopwatch_t();
+  void reset();
+  double ms() const;
+
+private:
+  std::chrono::steady_clock::time_point start;
+};
+
+/*
+  GPU time of a span of commands from GL_TIME_ELAPSED queries, read a few
+  frames late so the CPU never waits on them; GL thread only
+*/
+#define GPU_TIMER_QUERIES 4
+class gpu_timer_t {
+public:
+  double last_ms;
+  double total_ms;
+  int samples;
+
+  gpu_timer_t();
+  ~gpu_timer_t();
+  gpu_timer_t(const gpu_timer_t &) = delete;
+  gpu_timer_t &operator=(const gpu_timer_t &) = delete;
+
+  void begin();
+  void end();
+  double averageMs() const;
+
+private:
+  unsigned int queries[GPU_TIMER_QUERIES];
+  bool pending[GPU_TIMER_QUERIES];
+  int next;
+  bool created;
+};
+
+#endif
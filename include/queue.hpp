@@ -0,0 +1,137 @@
+#pragma once
+#ifndef QUEUE_H
+#define QUEUE_H
+
+#include <vector>
+
+#include "model.hpp"
+#include "shader.hpp"
+#include "uniforms.hpp"
+
+/* passes in the order a frame draws them, the top bits of a sort key */
+enum Render_Pass { PASS_SHADOW, PASS_GEOMETRY, PASS_FORWARD };
+
+/* width of each sort key field, most significant first */
+#define SORT_PASS_BITS 4
+#define SORT_PROGRAM_BITS 8
+#define SORT_MATERIAL_BITS 16
+#define SORT_MESH_BITS 16
+#define SORT_DEPTH_BITS 20
+
+/* one model in one pass, or a range of its indices */
+class render_item_t {
+public:
+  unsigned long long key;
+  int model;
+  /* what a batch's items must share, not left to the key alone */
+  const mesh_buffer_t *buffer;
+  unsigned int first_index;
+  unsigned int index_count;
+};
+
+/* items that share pass, program, material, mesh and index range, drawn
+   as one instanced draw; its instances start at first */
+class render_batch_t {
+public:
+  unsigned long long key;
+  int first;
+  int count;
+};
+
+/* per instance attributes of the model shaders, locations 4 to 10 */
+class instance_data_t {
+public:
+  glm::mat4 model;
+  glm::vec4 basecolor;
+  /* position_offset in xyz, metalness in w */
+  glm::vec4 offset_metalness;
+  /* position_scale in xyz, roughness in w */
+  glm::vec4 scale_roughness;
+};
+
+/* what glMultiDrawElementsIndirect reads per draw */
+class draw_command_t {
+public:
+  unsigned int count;
+  unsigned int instance_count;
+  unsigned int first_index;
+  int base_vertex;
+  unsigned int base_instance;
+};
+
+/* what the cull shader reads per item of a camera pass, std430 */
+class cull_object_t {
+public:
+  /* object space */
+  glm::vec3 bounds_min;
+  /* the command of the item's batch */
+  unsigned int batch;
+  glm::vec3 bounds_max;
+  unsigned int padding;
+};
+
+/* draw calls, program, texture and vertex array binds of a frame */
+class queue_stats_t {
+public:
+  /* GL calls, a multi-draw counts once */
+  int draws = 0;
+  int batches = 0;
+  int instances = 0;
+  int programs = 0;
+  int textures = 0;
+  int meshes = 0;
+  /* cpu time in submit() */
+  double submit_ms = 0.0;
+};
+
+/* a frame's draws, radix sorted by pass, program, material, mesh and
+   depth into instanced batches that submit() binds only changes for */
+class render_queue_t {
+public:
+  /* batches nearest first below the program, for early-Z */
+  bool front_to_back;
+  /* one glMultiDrawElementsIndirect between binds, needs GL 4.3 */
+  bool multi_draw;
+  /* camera passes take their instance counts from gpu_culler_t, needs
+     multi_draw */
+  bool gpu_culling;
+  unsigned int culled_instances;
+  /* binds as submitted, and as a walk in model order binding everything
+     per model would have made them */
+  queue_stats_t sorted;
+  queue_stats_t unsorted;
+
+  render_queue_t();
+
+  void clear();
+  /* draws the index_count indices from first_index on within the model's
+     buffer; program is the features of the permutation, depth the
+     distance in [0, 1] from the pass's eye */
+  void push(Render_Pass pass, int index, const model_t *model,
+            unsigned int first_index, unsigned int index_count,
+            unsigned int program, float depth);
+  /* sorts the items and splits them into batches */
+  void sort();
+  /* writes an instance_data_t per item and a draw_command_t per batch,
+     and with gpu_culling a cull_object_t per item of a camera pass */
+  void upload(uniform_ring_t *instances, uniform_ring_t *commands,
+              uniform_ring_t *objects, const std::vector<model_t *> &models);
+  /* the pass's items and its batches, after sort() */
+  void passItems(Render_Pass pass, int *first, int *count) const;
+  void passBatches(Render_Pass pass, int *first, int *count) const;
+  /* draws the pass's batches; without programs the caller has bound the
+     one program of the pass and it reads no material maps */
+  void submit(Render_Pass pass, program_cache_t *programs,
+              const uniform_ring_t &instances, const uniform_ring_t &commands,
+              const std::vector<model_t *> &models);
+
+private:
+  std::vector<render_item_t> items;
+  std::vector<render_item_t> item_scratch;
+  std::vector<render_batch_t> batches;
+  std::vector<render_batch_t> batch_scratch;
+  /* unsorted bookkeeping, per pass */
+  unsigned int last_program[PASS_FORWARD + 1];
+};
+
+#endif
@@ -0,0 +1,72 @@
+#pragma once
+#ifndef REGISTRY_H
+#define REGISTRY_H
+
+#include <atomic>
+#include <functional>
+#include <future>
+#include <glad/glad.h>
+#include <string>
+#include <unordered_map>
+
+#include "model.hpp"
+#include "texture.hpp"
+
+/* one mesh file, decoded once and drawn by every model naming it */
+class mesh_asset_t {
+public:
+  std::string key;
+  int refs;
+  std::future<mesh_t *> mesh;
+  /* null until decoded, then owned here until uploaded */
+  mesh_t *data;
+  /* null until uploaded, owns data from then on; parts of a static batch
+     are never uploaded on their own */
+  mesh_buffer_t *buffer;
+};
+
+/* one map file baked for one kind of use */
+class texture_asset_t {
+public:
+  std::string key;
+  Texture_Kind kind;
+  int refs;
+  std::future<texture_data_t *> data;
+  bool queued;
+  /* 0xfff until the last row is uploaded */
+  unsigned int texture;
+  size_t bytes;
+  size_t raw_bytes;
+};
+
+/*
+  shared meshes and textures keyed by canonical path; the first acquire
+  starts the decode on the worker pool, the last release frees GL objects
+*/
+class registry_t {
+public:
+  std::unordered_map<std::string, mesh_asset_t *> meshes;
+  std::unordered_map<std::string, texture_asset_t *> textures;
+
+  /* cpu time spent decoding, summed over workers */
+  std::atomic<long long> mesh_us;
+  std::atomic<long long> image_us;
+
+  registry_t();
+  mesh_asset_t *acquireMesh(const std::string &path);
+  texture_asset_t *acquireTexture(const std::string &path, Texture_Kind kind);
+  /* one texture for all three maps, keyed by the combination */
+  texture_asset_t *acquirePackedTexture(const std::string &roughness,
+                                        const std::string &metalness,
+                                        const std::string &occlusion);
+  void release(mesh_asset_t *asset);
+  void release(texture_asset_t *asset);
+
+private:
+  texture_asset_t *acquireTextureKey(const std::string &key, Texture_Kind kind,
+                                     std::function<texture_data_t *()> load);
+};
+
+registry_t &assetRegistry();
+
+#endif
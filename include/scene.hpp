@@ -2,13 +2,108 @@
 #ifndef SCENE_H
 #define SCENE_H
 
+#include <deque>
+#include <future>
 #include <glm.hpp>
 #include <string>
 #include <vector>
 
 #include "model.hpp"
 #include "shader.hpp"
+#include "bvh.hpp"
 #include "camera.hpp"
+#include "cull.hpp"
+#include "ibl.hpp"
+#include "occlusion.hpp"
+#include "profile.hpp"
+#include "queue.hpp"
+#include "registry.hpp"
+#include "sh.hpp"
+#include "uniforms.hpp"
+#include "upload.hpp"
+
+/* a model entry and the shared assets it draws with */
+class model_import_t {
+public:
+  model_t *model;
+  material_t *material;
+  glm::mat4 transform;
+  mesh_asset_t *mesh;
+  /* null where the material has no such map */
+  texture_asset_t *basecolor_map;
+  /* roughness, metalness and occlusion packed into one texture */
+  texture_asset_t *rmo_map;
+  texture_asset_t *normal_map;
+  texture_asset_t *emission_map;
+  /* the static batch this model is merged into, -1 when drawn alone */
+  int batch;
+};
+
+/*
+  the models of one material whose meshes nothing else in the scene
+  draws, merged at load into one buffer of pre-transformed vertices and
+  drawn as one model with an identity transform
+*/
+class static_batch_t {
+public:
+  material_t *material;
+  /* into scene_t::imports, in submesh order */
+  std::vector<int> imports;
+  /* null until every part is decoded */
+  model_t *model;
+  mesh_buffer_t *buffer;
+};
+
+/* one box of the scene's BVH: a model, or a submesh of a static batch so
+   the batch can be culled in part */
+class scene_part_t {
+public:
+  int model;
+  /* within the model's buffer, bounds in object space */
+  submesh_t range;
+};
+
+/* timings of one scene load, printed when the last upload lands */
+class import_stats_t {
+public:
+  stopwatch_t total;
+  double parse_ms = 0.0;
+  double setup_ms = 0.0;
+  double wait_ms = 0.0;
+  double upload_ms = 0.0;
+  double max_frame_ms = 0.0;
+  double ibl_ms = 0.0;
+  size_t upload_bytes = 0;
+  int frames = 0;
+  /* progressive prefilter refinement after the first pass */
+  double ibl_refine_ms = 0.0;
+  int ibl_refine_frames = 0;
+  /* programStats() when the scene started */
+  program_stats_t programs_base;
+  long long mesh_us_base = 0;
+  long long image_us_base = 0;
+};
+
+/*
+  a prefilter bake spread over frames: each level starts from a few
+  samples and later batches blend into its running weighted mean
+*/
+class ibl_bake_t {
+public:
+  shader_t shader;
+  /* sample table and progress of each level */
+  std::vector<std::vector<glm::vec4>> samples;
+  std::vector<int> next_sample;
+  std::vector<float> done_weight;
+  unsigned int mip;
+  /* sample-texels behind each timed span still in flight, and behind
+     the spans the timer has read back */
+  gpu_timer_t timer;
+  std::deque<double> pending_work;
+  double timed_work;
+  stopwatch_t elapsed;
+  int frames;
+};
 
 class scene_t {
 public:
@@ -16,9 +111,27 @@ public:
   std::vector<material_t *> materials;
   std::vector<glm::mat4> transforms;
   std::string environment;
+  std::string name;
 
-  shader_t shader;
-  shader_t geometry_shader;
+  /* loading state, drained by update() */
+  bool loaded;
+  std::vector<model_import_t> imports;
+  std::vector<static_batch_t> static_batches;
+  /* a cached bake stands in for the face decode and configIBL */
+  std::future<ibl_data_t *> ibl_cache;
+  bool ibl_cached;
+  std::vector<std::future<image_t *>> skybox_faces;
+  /* irradiance sums of the skybox faces decoded so far */
+  sh9_sums_t skybox_sums;
+  int skybox_projected;
+  std::deque<texture_upload_t> uploads;
+  unsigned int upload_pbo;
+  import_stats_t stats;
+  gpu_timer_t geometry_timer;
+
+  /* material permutations of the forward and geometry passes */
+  program_cache_t forward_programs;
+  program_cache_t geometry_programs;
   shader_t skybox_shader;
   shader_t shadow_shader;
   shader_t SAT_shader;
@@ -26,16 +139,51 @@ public:
   shader_t post_shader;
   shader_t taa_shader;
   shader_t final_shader;
-  
-  unsigned int e_avg;
-  unsigned int e_lut;
+  shader_t occlusion_shader;
+  /* FrameBlock of every program that draws models */
+  uniform_ring_t frame_uniforms{sizeof(frame_uniforms_t)};
+  /* the frame's instances, per pass in batch order, and a draw command
+     per batch for multi-draw */
+  uniform_ring_t instances{sizeof(instance_data_t), GL_ARRAY_BUFFER};
+  uniform_ring_t draw_commands{sizeof(draw_command_t),
+                               GL_DRAW_INDIRECT_BUFFER};
+  /* the bounds the cull shader tests, per item */
+  uniform_ring_t cull_objects{sizeof(cull_object_t),
+                              GL_SHADER_STORAGE_BUFFER};
+  /* this frame's draws of every pass */
+  render_queue_t queue;
+  Cull_Mode culling;
+  /* per pass, the shadow pass against the light's frustum and the camera
+     pass against the view */
+  cull_stats_t cull_stats[PASS_FORWARD + 1];
+  /* to cull, queue and upload the frame's draws */
+  double queue_ms;
+  gpu_culler_t culler;
+  /* the parts of model i are [model_parts[i], model_parts[i + 1]) */
+  std::vector<scene_part_t> parts;
+  std::vector<int> model_parts;
+  /* world boxes of the parts, built again when models are added */
+  scene_bvh_t bvh;
+  /* the parts each pass draws this frame */
+  std::vector<int> shadow_visible;
+  std::vector<int> camera_visible;
+  /* software depth of the largest occluders, for CULL_CPU */
+  occlusion_buffer_t occlusion;
+  /* the final pass shows the occlusion buffer instead of the frame */
+  bool show_occlusion;
+
+  /* split-sum and Kulla-Conty terms in one RGBA16F texture */
+  unsigned int brdf_lut;
 
   unsigned int skybox_texture;
+  /* diffuse ambient of the environment, zero until its faces are in */
+  sh9_t irradiance;
   unsigned int skybox_vao;
   unsigned int skybox_vbo;
 
   unsigned int prefilter_map;
-  unsigned int brdf_lut;
+  /* non-null while the prefilter map is still being refined */
+  ibl_bake_t *ibl_bake;
   unsigned int ibl_fbo;
   unsigned int ibl_rbo;
 
@@ -69,20 +217,61 @@ public:
 
 
 
-  scene_t(std::string filename);
+  /* streaming returns right away, update() then loads the scene piecewise */
+  scene_t(std::string filename, bool streaming = false);
+  /* drops this scene's references, needs the GL context still current */
+  ~scene_t();
+  scene_t(const scene_t &) = delete;
+  scene_t &operator=(const scene_t &) = delete;
+  /* uploads what has finished decoding, about budget bytes of it; block
+     waits for pending work instead of skipping it; true once fully loaded */
+  bool update(size_t budget, bool block = false);
+  void queueMap(texture_asset_t *map, texture_data_t *data);
+  void reportImport();
   void readLight(FILE *file);
   material_t *readMaterial(FILE *file);
   glm::mat4 readTransform(FILE *file);
-  model_t* readModel(FILE *file);
+  model_import_t readModel(FILE *file);
+  /* groups the imports that can be merged into static batches */
+  void groupStaticBatches();
+  /* merges and uploads a batch once all of its parts are decoded */
+  bool buildStaticBatch(static_batch_t &batch);
+  std::vector<std::future<image_t *>> loadSkyboxFaces();
+  void queueIBL(ibl_data_t *ibl);
+  void saveIBL();
 
   void configSkybox();
-  void configKullaConty();
+  void configBRDFLut();
   void configIBL();
+  void prefilterBatch(unsigned int mip, int count);
+  bool refineIBL(double slice_ms);
   void configShadowMap();
   void configDeferred();
+  void configUniforms();
 
+  /* fills and binds this frame's FrameBlock */
+  void writeUniforms(const frame_uniforms_t &frame);
   void drawSkybox(camera_t camera);
-  void drawShadowMap(glm::mat4 light_view, glm::mat4 light_projection);
+  /* from the light matrices in the frame block */
+  void drawShadowMap();
+  /* moves a model, its boxes in the BVH refit on the next frame */
+  void setTransform(int index, const glm::mat4 &transform);
+  /* builds the parts and the BVH when the model count changed, refits it
+     otherwise */
+  void refreshBVH();
+  /* fills visible with the parts of pass inside world_to_clip, or with
+     every part when cull is false */
+  void cullPass(Render_Pass pass, const glm::mat4 &world_to_clip, bool cull,
+                std::vector<int> *visible);
+  /* drops the parts of visible that the largest parts in it hide */
+  void cullOccluded(const frame_uniforms_t &frame, std::vector<int> *visible);
+  /* pushes the parts of visible, sorting it, with adjacent ranges of a
+     model as one draw */
+  void queueParts(const frame_uniforms_t &frame, Render_Pass pass,
+                  std::vector<int> *visible);
+  /* this frame's shadow pass and main pass, each model with the
+     permutation of its material features */
+  void queueModels(const frame_uniforms_t &frame, Render_Pass pass);
   void drawSceneForward(camera_t camera);
   void drawSceneDeferred(camera_t camera);
 };
@@ -0,0 +1,53 @@
+#pragma once
+#ifndef SH_H
+#define SH_H
+
+#include <glm.hpp>
+
+/* order 2 spherical harmonics, 9 basis functions */
+#define SH9_COEFFICIENTS 9
+
+/*
+  weighted sums of a cube map's radiance against the unnormalized SH9
+  basis 1, y, z, x, xy, yz, 3z^2 - 1, xz, x^2 - y^2, plus the solid angle
+  they cover; partial sums of faces or row bands add up
+*/
+class sh9_sums_t {
+public:
+  double rgb[SH9_COEFFICIENTS][3];
+  double weight;
+
+  sh9_sums_t();
+  void add(const sh9_sums_t &other);
+};
+
+/*
+  diffuse irradiance of an environment as SH9, convolved with the cosine
+  lobe and divided by PI, so evaluating it at a normal gives the Lambert
+  term for unit albedo
+*/
+class sh9_t {
+public:
+  glm::vec3 coefficients[SH9_COEFFICIENTS];
+
+  sh9_t();
+  glm::vec3 evaluate(const glm::vec3 &n) const;
+};
+
+/*
+  projection kernels over rows [row_begin, row_end) of one square float
+  face in cube map order, pixels channels floats apart; the vectorized
+  one falls back to the scalar one without SSE2
+*/
+void projectRowsScalar(const float *pixels, int size, int channels, int face,
+                       int row_begin, int row_end, sh9_sums_t *sums);
+void projectRows(const float *pixels, int size, int channels, int face,
+                 int row_begin, int row_end, sh9_sums_t *sums);
+
+/* a whole face in row bands, one per hardware thread; serial on pool
+   workers */
+sh9_sums_t projectFace(const float *pixels, int size, int channels, int face);
+
+sh9_t irradianceSH9(const sh9_sums_t &sums);
+
+#endif
@@ -9,17 +9,51 @@
 #include <iostream>
 #include <sstream>
 #include <string>
+#include <unordered_map>
+#include <vector>
 
+/* program creation so far: how many linked binaries were reused, how
+   many were compiled, the time spent issuing them and the time first
+   uses then spent waiting on the driver */
+class program_stats_t {
+public:
+  int cached = 0;
+  int compiled = 0;
+  double issue_ms = 0.0;
+  double wait_ms = 0.0;
+};
+
+program_stats_t &programStats();
 
+/*
+  a program loaded from its cached binary in ../assets/programs, keyed by
+  the sources and the driver, or else compiled and linked without waiting;
+  compile status is only queried on first use, so programs created back
+  to back build in parallel where the driver compiles on its own threads
+*/
 class shader_t {
 public:
   unsigned int ID;
 
+  /* each of defines is #defined in every stage, right after #version */
   shader_t(const char *vertexPath, const char *fragmentPath,
-           const char *geometryPath = nullptr);
+           const char *geometryPath = nullptr,
+           const std::vector<std::string> &defines = {});
   shader_t();
+  /* a compute program, needs GL 4.3 */
+  static shader_t compute(const char *computePath,
+                          const std::vector<std::string> &defines = {});
   void use();
 
+  /* state that never changes after linking, set once instead of per
+     frame: the unit a sampler reads and the binding point of a block */
+  void bindSampler(const std::string &name, int unit);
+  void bindBlock(const std::string &name, unsigned int binding);
+
+  /* waits for the link, reports errors and caches the binary; use() and
+     the bind calls do this, so keep using only the copy that finishes */
+  void finish();
+
   void setBool(const std::string &name, bool value) const;
   void setInt(const std::string &name, int value) const;
   void setFloat(const std::string &name, float value) const;
@@ -27,13 +61,53 @@ public:
   void setVec2(const std::string &name, float x, float y) const;
   void setVec3(const std::string &name, const glm::vec3 &value) const;
   void setVec3(const std::string &name, float x, float y, float z) const;
+  void setVec3Array(const std::string &name, const glm::vec3 *values,
+                    int count) const;
   void setVec4(const std::string &name, const glm::vec4 &value) const;
   void setVec4(const std::string &name, float x, float y, float z, float w) const;
+  void setVec4Array(const std::string &name, const glm::vec4 *values,
+                    int count) const;
   void setMat2(const std::string &name, const glm::mat2 &mat) const;
   void setMat3(const std::string &name, const glm::mat3 &mat) const;
   void setMat4(const std::string &name, const glm::mat4 &mat) const;
 
 private:
-  void checkCompileErrors(GLuint shader, std::string type);
+  unsigned long long key;
+  unsigned int stages[3];
+  GLenum stage_types[3];
+  int num_stages;
+  bool pending;
+
+  /* loads the cached binary of the stages or starts compiling them */
+  void create(const std::string *codes, const GLenum *types, int num_codes);
+  bool checkCompileErrors(GLuint shader, std::string type);
+};
+
+/*
+  permutations of one vertex and fragment shader pair, keyed by a set of
+  feature bits where bit i turns on defines[i]; each program compiles on
+  prepare() or first use and link() sets its samplers and blocks on first use
+*/
+class program_cache_t {
+public:
+  program_cache_t();
+  program_cache_t(const char *vertexPath, const char *fragmentPath,
+                  const char *const *defines, int num_defines,
+                  void (*link)(shader_t &shader));
+
+  /* starts compiling a permutation likely to be needed soon */
+  void prepare(unsigned int features);
+  /* stays valid for the cache's lifetime */
+  shader_t *get(unsigned int features);
+  int size() const;
+
+private:
+  std::string vertex_path;
+  std::string fragment_path;
+  std::vector<std::string> defines;
+  void (*link)(shader_t &shader);
+  std::unordered_map<unsigned int, shader_t> programs;
+  /* prepared permutations link() has not seen yet */
+  std::unordered_map<unsigned int, bool> linked;
 };
 #endif
\ No newline at end of file
@@ -0,0 +1,80 @@
+#pragma once
+#ifndef STATE_H
+#define STATE_H
+
+#include <glad/glad.h>
+#include <unordered_map>
+
+/* texture units whose bindings are tracked, higher ones always bind */
+#define STATE_TEXTURE_UNITS 16
+
+/* state calls passed on to GL and those dropped as redundant */
+class state_stats_t {
+public:
+  long long issued = 0;
+  long long filtered = 0;
+};
+
+/*
+  shadow copy of the GL state rendering code changes, so setting a value
+  that is already current costs no driver call; every bind of a program,
+  vertex array, framebuffer or texture has to go through here or the
+  copy goes stale; GL thread only
+*/
+class gl_state_t {
+public:
+  state_stats_t stats;
+
+  gl_state_t();
+  gl_state_t(const gl_state_t &) = delete;
+  gl_state_t &operator=(const gl_state_t &) = delete;
+
+  void useProgram(unsigned int program);
+  void bindVertexArray(unsigned int vao);
+  /* GL_FRAMEBUFFER, GL_READ_FRAMEBUFFER or GL_DRAW_FRAMEBUFFER */
+  void bindFramebuffer(GLenum target, unsigned int fbo);
+  /* leaves unit active, so texture calls after it act on texture */
+  void bindTexture(unsigned int unit, GLenum target, unsigned int texture);
+  void viewport(int x, int y, int width, int height);
+
+  void enable(GLenum capability);
+  void disable(GLenum capability);
+  void depthFunc(GLenum func);
+  void depthMask(bool write);
+  void stencilFunc(GLenum func, int ref, unsigned int mask);
+  void stencilOp(GLenum stencil_fail, GLenum depth_fail, GLenum pass);
+  void stencilMask(unsigned int mask);
+  void blendFunc(GLenum source, GLenum destination);
+
+  /* deleting a bound object makes GL bind 0 in its place */
+  void forgetTexture(unsigned int texture);
+  void forgetVertexArray(unsigned int vao);
+  /* forgets everything, after GL calls made around this layer */
+  void invalidate();
+
+private:
+  unsigned int program;
+  unsigned int vao;
+  unsigned int read_fbo;
+  unsigned int draw_fbo;
+  unsigned int active_unit;
+  /* GL_TEXTURE_2D and GL_TEXTURE_CUBE_MAP of each unit */
+  unsigned int textures[STATE_TEXTURE_UNITS][2];
+  int viewport_rect[4];
+  std::unordered_map<GLenum, bool> capabilities;
+  unsigned int depth_func;
+  unsigned int depth_mask;
+  unsigned int stencil_func[3];
+  unsigned int stencil_op[3];
+  unsigned int stencil_mask;
+  unsigned int blend_func[2];
+
+  /* true when value changes, counting the call either way */
+  bool change(unsigned int *current, unsigned int value);
+  void setCapability(GLenum capability, bool enabled);
+};
+
+/* the state of the one context */
+gl_state_t &glState();
+
+#endif
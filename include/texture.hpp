@@ -0,0 +1,62 @@
+#pragma once
+#ifndef TEXTURE_H
+#define TEXTURE_H
+
+#include <glad/glad.h>
+#include <string>
+#include <vector>
+
+#include "image.hpp"
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+/* how a map is sampled, decides the format it is baked to; a packed map
+   holds roughness, metalness and occlusion in r, g and b */
+enum Texture_Kind { COLOR_MAP, DATA_MAP, NORMAL_MAP, PACKED_MAP };
+
+class texture_level_t {
+public:
+  int width;
+  int height;
+  size_t offset;
+  size_t size;
+};
+
+/* every mip level of a texture, laid out as GL reads it */
+class texture_data_t {
+public:
+  GLenum internal_format;
+  /* pixel transfer format and type, unused when compressed */
+  GLenum format;
+  GLenum type;
+  bool compressed;
+  std::vector<texture_level_t> levels;
+  std::vector<unsigned char> bytes;
+  /* what the map would take as a single uncompressed level */
+  size_t raw_bytes;
+
+  /* bytes per row of pixels, or per row of 4x4 blocks when compressed */
+  size_t rowBytes(int level) const;
+  /* pixel rows covered by one of those rows */
+  int rowHeight() const;
+};
+
+/* checks which block formats the context supports, GL thread only */
+void initTextureFormats();
+
+/* mip chain of a map, read from <path>.<kind>.cache or baked into it */
+texture_data_t *loadTexture(const std::string &path, Texture_Kind kind);
+
+/* roughness, metalness and occlusion maps packed into one texture, any of
+   them may be "null"; cached as <first map>.rmo.cache */
+texture_data_t *loadPackedTexture(const std::string &roughness,
+                                  const std::string &metalness,
+                                  const std::string &occlusion);
+
+/* a single level holding decoded pixels as they are */
+texture_data_t *textureFromImage(const image_t *image, GLenum internal_format,
+                                 GLenum format, GLenum type);
+
+#endif
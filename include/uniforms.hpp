@@ -0,0 +1,72 @@
+#pragma once
+#ifndef UNIFORMS_H
+#define UNIFORMS_H
+
+#include <cstddef>
+#include <glad/glad.h>
+#include <glm.hpp>
+
+/* binding point of the block, the same in every program */
+#define FRAME_BLOCK_BINDING 0
+
+/* ring segments, one per frame the GPU may still be reading */
+#define UNIFORM_RING_SEGMENTS 3
+
+/* FrameBlock in std140, written once per frame */
+class frame_uniforms_t {
+public:
+  glm::mat4 view;
+  glm::mat4 projection;
+  glm::mat4 pre_view;
+  glm::mat4 pre_projection;
+  glm::mat4 world_to_screen;
+  glm::mat4 light_view;
+  glm::mat4 light_projection;
+  glm::mat4 light_world_to_screen;
+  glm::vec3 camera_pos;
+  int offset_idx;
+  glm::vec3 light_pos;
+  int frame_count;
+  /* vertex format of the geometry arena, QUANTIZE_VERTICES */
+  int quantized;
+  /* std140 rounds the block up to a whole vec4 */
+  int padding[3];
+};
+
+/*
+  a uniform buffer of fixed-size blocks in UNIFORM_RING_SEGMENTS
+  segments; each map() moves to the next segment once the GPU is done
+  with it, so writes never stall on draws still in flight; with another
+  target it streams vertex data the same way; GL thread only
+*/
+class uniform_ring_t {
+public:
+  /* block_size, rounded up to the offset alignment for uniforms */
+  size_t stride;
+  unsigned int buffer;
+
+  uniform_ring_t(size_t block_size, GLenum target = GL_UNIFORM_BUFFER);
+  ~uniform_ring_t();
+  uniform_ring_t(const uniform_ring_t &) = delete;
+  uniform_ring_t &operator=(const uniform_ring_t &) = delete;
+
+  /* maps count blocks of the next segment, growing the ring if needed */
+  void map(int count);
+  void write(int index, const void *block);
+  void unmap();
+  /* binds block index of the segment last mapped */
+  void bind(unsigned int binding, int index) const;
+  /* byte offset in buffer of block index of the segment last mapped */
+  size_t offset(int index) const;
+
+private:
+  GLenum target;
+  size_t block_size;
+  size_t segment_bytes;
+  int segment;
+  unsigned char *mapped;
+  GLsync fences[UNIFORM_RING_SEGMENTS];
+  bool created;
+};
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+#ifndef UPLOAD_H
+#define UPLOAD_H
+
+#include <glad/glad.h>
+
+#include "texture.hpp"
+
+/* texture levels streamed in bands of rows, or rows of blocks */
+class texture_upload_t {
+public:
+  texture_data_t *data;
+  unsigned int texture;
+  GLenum target;
+  int level;
+  int next_row;
+  /* receives texture once the last row is in, may be null */
+  unsigned int *slot;
+
+  /* allocates every level; takes ownership of data */
+  texture_upload_t(texture_data_t *data, unsigned int texture, GLenum target,
+                   unsigned int *slot);
+
+  /* copies at least one row and about budget bytes through pbo, returns the
+     bytes sent; frees the data and fills slot when finished */
+  size_t stream(unsigned int pbo, size_t budget);
+  bool done() const;
+};
+
+#endif
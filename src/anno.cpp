@@ -12,9 +12,14 @@
 #include "model.hpp"
 #include "scene.hpp"
 #include "shader.hpp"
+#include "state.hpp"
 
 const unsigned int SCR_WIDTH = 1080;
 const unsigned int SCR_HEIGHT = 1080;
+/* upload bytes per frame while the scene streams in */
+const size_t STREAM_BUDGET = 4 << 20;
+/* frames between geometry pass timings */
+const int TIMING_INTERVAL = 600;
 
 camera_t camera(glm::vec3(0.0f, 0.0f, 3.0f));
 float last_x = SCR_WIDTH / 2.0f;
@@ -23,6 +28,10 @@ bool first_mouse = true;
 
 float delta_time = 0.0f;
 float last_frame = 0.0f;
+/* C steps through the Cull_Mode values */
+bool cycle_culling = false;
+/* O shows the occlusion buffer in place of the frame */
+bool toggle_occlusion = false;
 
 void processInput(GLFWwindow *window) {
   if (glfwGetKey(window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
@@ -40,6 +49,13 @@ void processInput(GLFWwindow *window) {
   if (glfwGetKey(window, GLFW_KEY_E) == GLFW_PRESS)
     camera.processKeyboard(BACKWARD, delta_time);
 }
+void keyCallback(GLFWwindow *window, int key, int scancode, int action,
+                 int mods) {
+  if (key == GLFW_KEY_C && action == GLFW_PRESS)
+    cycle_culling = true;
+  if (key == GLFW_KEY_O && action == GLFW_PRESS)
+    toggle_occlusion = true;
+}
 void mouseCallback(GLFWwindow *window, double x_pos_in, double y_pos_in) {
   float x_pos = static_cast<float>(x_pos_in);
   float y_pos = static_cast<float>(y_pos_in);
@@ -63,7 +79,7 @@ void scrollCallback(GLFWwindow *window, double x_offset, double y_offset) {
   camera.processMouseScroll(static_cast<float>(y_offset));
 }
 void framebufferSizeCallback(GLFWwindow *window, int width, int height) {
-  glViewport(0, 0, width, height);
+  glState().viewport(0, 0, width, height);
 }
 std::string errorName(int err) {
 	switch (err) {
@@ -79,46 +95,111 @@ std::string errorName(int err) {
 	return "unknown error: " + std::to_string(err);
 }
 
-int main() {
+int main(int argc, char **argv) {
   /*  init  */
   glfwInit();
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, 3);
-  glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, 3);
-  glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
-
-  GLFWwindow *window =
-      glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Anno", NULL, NULL);
+  /* 4.3 for multi-draw indirect and GPU culling, else 3.3 */
+  int versions[][2] = {{4, 3}, {3, 3}};
+  GLFWwindow *window = NULL;
+  for (int *version : versions) {
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, version[0]);
+    glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, version[1]);
+    glfwWindowHint(GLFW_OPENGL_PROFILE, GLFW_OPENGL_CORE_PROFILE);
+    window = glfwCreateWindow(SCR_WIDTH, SCR_HEIGHT, "Anno", NULL, NULL);
+    if (window != NULL)
+      break;
+  }
   if (window == NULL) {
     glfwTerminate();
     return -1;
   }
   glfwMakeContextCurrent(window);
   glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
+  glfwSetKeyCallback(window, keyCallback);
   glfwSetCursorPosCallback(window, mouseCallback);
   glfwSetScrollCallback(window, scrollCallback);
 
   if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
     glfwTerminate();
   }
-  glEnable(GL_DEPTH_TEST);
+  glState().enable(GL_DEPTH_TEST);
 
-  /* prepare data  */
-  scene_t scene("../assets/common/cube.scn");
+  /* prepare data, the scene streams in while the loop below renders */
+  std::string scene_path = argc > 1 ? argv[1] : "../assets/common/cube.scn";
+  scene_t *scene = new scene_t(scene_path, true);
 
   /*  render  */
-  glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+  glState().viewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+  state_stats_t reported = glState().stats;
   while (!glfwWindowShouldClose(window)) {
     float currentFrame = static_cast<float>(glfwGetTime());
     delta_time = currentFrame - last_frame;
     last_frame = currentFrame;
     processInput(window);
-
-    scene.drawSceneDeferred(camera);
+    if (cycle_culling) {
+      const char *names[] = {"off", "cpu", "gpu"};
+      scene->culling = (Cull_Mode)((scene->culling + 1) % (CULL_GPU + 1));
+      printf("culling %s\n", names[scene->culling]);
+      cycle_culling = false;
+    }
+    if (toggle_occlusion) {
+      scene->show_occlusion = !scene->show_occlusion;
+      toggle_occlusion = false;
+    }
+
+    scene->update(STREAM_BUDGET);
+    scene->drawSceneDeferred(camera);
+    if (scene->geometry_timer.samples > 0 &&
+        scene->geometry_timer.samples % TIMING_INTERVAL == 0) {
+      printf("geometry pass %.3f ms gpu (average %.3f ms)\n",
+             scene->geometry_timer.last_ms, scene->geometry_timer.averageMs());
+      const queue_stats_t &sorted = scene->queue.sorted;
+      const queue_stats_t &unsorted = scene->queue.unsorted;
+      printf("  %d instances in %d batches, %d %s calls, %.3f ms cpu to "
+             "submit\n",
+             sorted.instances, sorted.batches, sorted.draws,
+             scene->queue.multi_draw ? "multi-draw" : "draw",
+             sorted.submit_ms);
+      printf("  binds in model order -> sorted: programs %d -> %d, "
+             "textures %d -> %d, vertex arrays %d -> %d\n",
+             unsorted.programs, sorted.programs, unsorted.textures,
+             sorted.textures, unsorted.meshes, sorted.meshes);
+      const cull_stats_t &shadow = scene->cull_stats[PASS_SHADOW];
+      const cull_stats_t &camera = scene->cull_stats[PASS_GEOMETRY];
+      printf("  shadow culling %s: %d of %d parts visible, %d culled, "
+             "%.3f ms cpu\n",
+             scene->culling == CULL_NONE ? "off" : "cpu",
+             shadow.tested - shadow.culled, shadow.tested, shadow.culled,
+             shadow.cpu_ms);
+      if (scene->queue.gpu_culling)
+        printf("  camera culling gpu: %d parts tested, %.3f ms gpu\n",
+               camera.tested, scene->culler.timer.last_ms);
+      else
+        printf("  camera culling %s: %d of %d parts visible, %d culled, "
+               "%.3f ms cpu\n",
+               scene->culling == CULL_NONE ? "off" : "cpu",
+               camera.tested - camera.culled, camera.tested, camera.culled,
+               camera.cpu_ms);
+      const occlusion_stats_t &occlusion = scene->occlusion.stats;
+      if (occlusion.tested > 0)
+        printf("  occlusion: %d occluders, %d triangles, %d of %d parts "
+               "hidden, %.3f ms raster, %.3f ms test\n",
+               occlusion.occluders, occlusion.triangles, occlusion.culled,
+               occlusion.tested, occlusion.raster_ms, occlusion.test_ms);
+      printf("  %.3f ms cpu to cull, queue and upload\n", scene->queue_ms);
+      const state_stats_t &state = glState().stats;
+      printf("  gl state calls per frame: %.1f issued, %.1f filtered\n",
+             (state.issued - reported.issued) / (double)TIMING_INTERVAL,
+             (state.filtered - reported.filtered) / (double)TIMING_INTERVAL);
+      reported = state;
+    }
     
     glfwSwapBuffers(window);
     glfwPollEvents();
   }
 
+  /* releases shared GL objects, so before the context goes away */
+  delete scene;
   glfwTerminate();
   return 0;
 }
\ No newline at end of file
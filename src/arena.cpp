@@ -0,0 +1,134 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iterator>
+
+#include "arena.hpp"
+#include "profile.hpp"
+#include "state.hpp"
+
+/* first size of each buffer, doubled whenever a mesh does not fit */
+#define ARENA_MIN_BYTES (4 << 20)
+
+size_t span_allocator_t::allocate(size_t size, size_t alignment) {
+  if (size == 0)
+    return 0;
+  for (auto span = this->free_spans.begin(); span != this->free_spans.end();
+       ++span) {
+    size_t offset = (span->first + alignment - 1) / alignment * alignment;
+    size_t end = span->first + span->second;
+    if (offset + size > end)
+      continue;
+    size_t start = span->first;
+    this->free_spans.erase(span);
+    if (offset > start)
+      this->free_spans[start] = offset - start;
+    if (offset + size < end)
+      this->free_spans[offset + size] = end - offset - size;
+    this->used += size;
+    return offset;
+  }
+  return SIZE_MAX;
+}
+
+void span_allocator_t::release(size_t offset, size_t size) {
+  if (size == 0)
+    return;
+  this->used -= size;
+  auto next = this->free_spans.lower_bound(offset);
+  if (next != this->free_spans.end() && offset + size == next->first) {
+    size += next->second;
+    next = this->free_spans.erase(next);
+  }
+  if (next != this->free_spans.begin()) {
+    auto previous = std::prev(next);
+    if (previous->first + previous->second == offset) {
+      previous->second += size;
+      return;
+    }
+  }
+  this->free_spans[offset] = size;
+}
+
+void span_allocator_t::grow(size_t capacity) {
+  size_t added = capacity - this->capacity;
+  this->capacity = capacity;
+  /* freed like a span that was in use, so it joins a free tail */
+  this->used += added;
+  release(capacity - added, added);
+}
+
+geometry_arena_t::geometry_arena_t(size_t vertex_stride, void (*format)()) {
+  this->vertex_stride = vertex_stride;
+  this->format = format;
+  this->VBO = 0;
+  this->EBO = 0;
+  glGenVertexArrays(1, &this->VAO);
+}
+
+/* the copy targets leave the VAO's bindings alone */
+void geometry_arena_t::growBuffer(GLenum target, unsigned int *buffer,
+                                  span_allocator_t *spans, size_t needed) {
+  size_t capacity = std::max<size_t>(spans->capacity, ARENA_MIN_BYTES);
+  while (capacity < spans->capacity + needed)
+    capacity *= 2;
+  unsigned int grown;
+  glGenBuffers(1, &grown);
+  glBindBuffer(GL_COPY_WRITE_BUFFER, grown);
+  glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STATIC_DRAW);
+  if (*buffer != 0) {
+    glBindBuffer(GL_COPY_READ_BUFFER, *buffer);
+    glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, 0, 0,
+                        spans->capacity);
+    glDeleteBuffers(1, buffer);
+    if (VERBOSE_ASSETS)
+      printf("geometry arena: %s buffer %.1f -> %.1f MB\n",
+             target == GL_ARRAY_BUFFER ? "vertex" : "index",
+             spans->capacity / 1048576.0, capacity / 1048576.0);
+  }
+  *buffer = grown;
+  spans->grow(capacity);
+
+  glState().bindVertexArray(this->VAO);
+  glBindBuffer(target, grown);
+  if (target == GL_ARRAY_BUFFER)
+    this->format();
+}
+
+unsigned int geometry_arena_t::addVertices(const void *data, size_t count) {
+  size_t bytes = count * this->vertex_stride;
+  size_t offset = this->vertices.allocate(bytes, this->vertex_stride);
+  if (offset == SIZE_MAX) {
+    /* room to align the offset as well */
+    growBuffer(GL_ARRAY_BUFFER, &this->VBO, &this->vertices,
+               bytes + this->vertex_stride);
+    offset = this->vertices.allocate(bytes, this->vertex_stride);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, this->VBO);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, data);
+  return offset / this->vertex_stride;
+}
+
+unsigned int geometry_arena_t::addIndices(const void *data, size_t count,
+                                          size_t index_size) {
+  size_t bytes = count * index_size;
+  size_t offset = this->indices.allocate(bytes, index_size);
+  if (offset == SIZE_MAX) {
+    growBuffer(GL_ELEMENT_ARRAY_BUFFER, &this->EBO, &this->indices,
+               bytes + index_size);
+    offset = this->indices.allocate(bytes, index_size);
+  }
+  glBindBuffer(GL_COPY_WRITE_BUFFER, this->EBO);
+  glBufferSubData(GL_COPY_WRITE_BUFFER, offset, bytes, data);
+  return offset / index_size;
+}
+
+void geometry_arena_t::releaseVertices(unsigned int base_vertex, size_t count) {
+  this->vertices.release(base_vertex * this->vertex_stride,
+                         count * this->vertex_stride);
+}
+
+void geometry_arena_t::releaseIndices(unsigned int first_index, size_t count,
+                                      size_t index_size) {
+  this->indices.release(first_index * index_size, count * index_size);
+}
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <glm.hpp>
+#include <gtc/packing.hpp>
+#include <iostream>
+#include <vector>
+
+#include "brdf.hpp"
+#include "file.hpp"
+#include "pool.hpp"
+#include "profile.hpp"
+
+#define BRDF_CACHE_MAGIC 0x54554c41 /* "ALUT" */
+#define BRDF_CACHE_VERSION 1
+
+/* importance samples per texel */
+#define BRDF_LUT_SAMPLES 4096
+
+/* fewest LUT rows a pool job integrates */
+#define BRDF_MIN_BAND_ROWS 8
+
+/* the LUT's half-float texels follow the header */
+struct brdf_cache_header_t {
+  unsigned int magic;
+  unsigned int version;
+  unsigned int size;
+  unsigned int samples;
+};
+
+static const char *BRDF_CACHE = "../assets/brdf_lut.cache";
+
+static float vanDerCorput(unsigned int bits) {
+  bits = (bits << 16u) | (bits >> 16u);
+  bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+  bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+  bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+  bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+  return bits * 2.3283064365386963e-10f;
+}
+
+/*
+  split-sum scale and bias at one NdotV and roughness, GGX importance
+  sampled with the IBL Smith term k = alpha / 2
+*/
+static glm::vec2 integrateBRDF(double n_dot_v, double roughness) {
+  const double PI = 3.14159265358979;
+  double a = roughness * roughness;
+  double k = a / 2.0;
+  double v_x = std::sqrt(1.0 - n_dot_v * n_dot_v);
+  double v_z = n_dot_v;
+  double g_v = n_dot_v / (n_dot_v * (1.0 - k) + k);
+
+  double scale = 0.0, bias = 0.0;
+  for (unsigned int i = 0; i < BRDF_LUT_SAMPLES; i++) {
+    double phi = 2.0 * PI * i / BRDF_LUT_SAMPLES;
+    double xi = vanDerCorput(i);
+    double cos_theta = std::sqrt((1.0 - xi) / (1.0 + (a * a - 1.0) * xi));
+    double sin_theta = std::sqrt(1.0 - cos_theta * cos_theta);
+    double h_x = std::cos(phi) * sin_theta;
+    double h_z = cos_theta;
+    double v_dot_h = v_x * h_x + v_z * h_z;
+    double n_dot_l = 2.0 * v_dot_h * h_z - v_z;
+    if (n_dot_l <= 0.0)
+      continue;
+
+    double g_l = n_dot_l / (n_dot_l * (1.0 - k) + k);
+    double g_vis = g_v * g_l * v_dot_h / (h_z * n_dot_v);
+    double fc = std::pow(1.0 - v_dot_h, 5.0);
+    scale += (1.0 - fc) * g_vis;
+    bias += fc * g_vis;
+  }
+  return glm::vec2(scale / BRDF_LUT_SAMPLES, bias / BRDF_LUT_SAMPLES);
+}
+
+/* whole rows, so E_avg sees every NdotV of its roughness */
+static void integrateRows(int row_begin, int row_end, glm::vec4 *texels) {
+  for (int y = row_begin; y < row_end; y++) {
+    double roughness = (y + 0.5) / BRDF_LUT_SIZE;
+    glm::vec4 *row = texels + (size_t)y * BRDF_LUT_SIZE;
+    double e_avg = 0.0;
+    for (int x = 0; x < BRDF_LUT_SIZE; x++) {
+      double n_dot_v = (x + 0.5) / BRDF_LUT_SIZE;
+      glm::vec2 split = integrateBRDF(n_dot_v, roughness);
+      float e = split.x + split.y;
+      row[x] = glm::vec4(split, e, 0.0f);
+      /* E_avg = 2 * integral of E(mu) mu over [0, 1] */
+      e_avg += 2.0 * e * n_dot_v / BRDF_LUT_SIZE;
+    }
+    for (int x = 0; x < BRDF_LUT_SIZE; x++)
+      row[x].a = (float)e_avg;
+  }
+}
+
+static texture_data_t *lutData() {
+  texture_data_t *data = new texture_data_t();
+  data->internal_format = GL_RGBA16F;
+  data->format = GL_RGBA;
+  data->type = GL_HALF_FLOAT;
+  data->compressed = false;
+  data->levels.push_back({BRDF_LUT_SIZE, BRDF_LUT_SIZE, 0, 0});
+  data->levels[0].size = data->rowBytes(0) * BRDF_LUT_SIZE;
+  data->raw_bytes = data->levels[0].size;
+  return data;
+}
+
+static texture_data_t *readCache() {
+  mapped_file_t file;
+  if (!file.open(BRDF_CACHE) || file.size < sizeof(brdf_cache_header_t))
+    return nullptr;
+  brdf_cache_header_t header;
+  memcpy(&header, file.data, sizeof(header));
+  texture_data_t *data = lutData();
+  if (header.magic != BRDF_CACHE_MAGIC ||
+      header.version != BRDF_CACHE_VERSION || header.size != BRDF_LUT_SIZE ||
+      header.samples != BRDF_LUT_SAMPLES ||
+      file.size != sizeof(header) + data->levels[0].size) {
+    delete data;
+    return nullptr;
+  }
+  const unsigned char *bytes = (const unsigned char *)file.data + sizeof(header);
+  data->bytes.assign(bytes, bytes + data->levels[0].size);
+  return data;
+}
+
+texture_data_t *loadBRDFLut() {
+  texture_data_t *data = readCache();
+  if (data != nullptr)
+    return data;
+
+  stopwatch_t watch;
+  std::vector<glm::vec4> texels((size_t)BRDF_LUT_SIZE * BRDF_LUT_SIZE);
+  int num_bands =
+      std::max(1, std::min(parallelism(), BRDF_LUT_SIZE / BRDF_MIN_BAND_ROWS));
+  parallelFor(num_bands, [&](int i) {
+    integrateRows(BRDF_LUT_SIZE * i / num_bands,
+                  BRDF_LUT_SIZE * (i + 1) / num_bands, texels.data());
+  });
+
+  data = lutData();
+  data->bytes.resize(data->levels[0].size);
+  unsigned short *halfs = (unsigned short *)data->bytes.data();
+  for (size_t i = 0; i < texels.size(); i++)
+    for (int c = 0; c < 4; c++)
+      halfs[i * 4 + c] = glm::packHalf1x16(texels[i][c]);
+  printf("integrated %dx%d BRDF LUT, %d samples, in %d bands in %.1f ms\n",
+         BRDF_LUT_SIZE, BRDF_LUT_SIZE, BRDF_LUT_SAMPLES, num_bands,
+         watch.ms());
+
+  brdf_cache_header_t header = {BRDF_CACHE_MAGIC, BRDF_CACHE_VERSION,
+                                BRDF_LUT_SIZE, BRDF_LUT_SAMPLES};
+  const void *chunks[] = {&header, data->bytes.data()};
+  size_t sizes[] = {sizeof(header), data->bytes.size()};
+  if (!writeFileAtomic(BRDF_CACHE, chunks, sizes, 2))
+    std::cout << "Failed to write BRDF LUT cache: " << BRDF_CACHE << std::endl;
+  return data;
+}
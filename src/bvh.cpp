@@ -0,0 +1,205 @@
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <numeric>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "bvh.hpp"
+
+/* deeper than a median split of any scene gets */
+#define BVH_STACK_SIZE 64
+
+void bounds_soa_t::resize(int count) {
+  for (std::vector<float> *axis :
+       {&this->min_x, &this->min_y, &this->min_z, &this->max_x, &this->max_y,
+        &this->max_z})
+    axis->resize(count);
+}
+
+void bounds_soa_t::set(int index, const glm::vec3 &bounds_min,
+                       const glm::vec3 &bounds_max) {
+  this->min_x[index] = bounds_min.x;
+  this->min_y[index] = bounds_min.y;
+  this->min_z[index] = bounds_min.z;
+  this->max_x[index] = bounds_max.x;
+  this->max_y[index] = bounds_max.y;
+  this->max_z[index] = bounds_max.z;
+}
+
+glm::vec3 bounds_soa_t::min(int index) const {
+  return glm::vec3(this->min_x[index], this->min_y[index], this->min_z[index]);
+}
+
+glm::vec3 bounds_soa_t::max(int index) const {
+  return glm::vec3(this->max_x[index], this->max_y[index], this->max_z[index]);
+}
+
+void scene_bvh_t::build(const std::vector<glm::vec3> &bounds_min,
+                        const std::vector<glm::vec3> &bounds_max) {
+  int count = (int)bounds_min.size();
+  this->nodes.clear();
+  this->dirty.clear();
+  this->entries.resize(count);
+  std::iota(this->entries.begin(), this->entries.end(), 0);
+  this->leaves.resize(count);
+  this->slots.resize(count);
+  this->bounds.resize(count);
+  if (count == 0)
+    return;
+
+  /* split orders the entries by part, the boxes follow in that order */
+  this->nodes.push_back(bvh_node_t());
+  split(0, 0, count, -1, bounds_min, bounds_max);
+  for (int i = 0; i < count; i++) {
+    int part = this->entries[i];
+    this->slots[part] = i;
+    this->bounds.set(i, bounds_min[part], bounds_max[part]);
+  }
+}
+
+void scene_bvh_t::split(int index, int first, int count, int parent,
+                        const std::vector<glm::vec3> &bounds_min,
+                        const std::vector<glm::vec3> &bounds_max) {
+  glm::vec3 node_min(INFINITY), node_max(-INFINITY);
+  glm::vec3 centroid_min(INFINITY), centroid_max(-INFINITY);
+  for (int i = first; i < first + count; i++) {
+    int part = this->entries[i];
+    node_min = glm::min(node_min, bounds_min[part]);
+    node_max = glm::max(node_max, bounds_max[part]);
+    glm::vec3 centroid = bounds_min[part] + bounds_max[part];
+    centroid_min = glm::min(centroid_min, centroid);
+    centroid_max = glm::max(centroid_max, centroid);
+  }
+
+  bvh_node_t &node = this->nodes[index];
+  node.bounds_min = node_min;
+  node.bounds_max = node_max;
+  node.first = first;
+  node.count = count;
+  node.parent = parent;
+  node.left = -1;
+  if (count <= BVH_LEAF_SIZE) {
+    for (int i = first; i < first + count; i++)
+      this->leaves[i] = index;
+    return;
+  }
+
+  glm::vec3 extent = centroid_max - centroid_min;
+  int axis = extent.x > extent.y ? 0 : 1;
+  if (extent.z > extent[axis])
+    axis = 2;
+  auto begin = this->entries.begin() + first;
+  std::nth_element(begin, begin + count / 2, begin + count,
+                   [&](int a, int b) {
+                     return bounds_min[a][axis] + bounds_max[a][axis] <
+                            bounds_min[b][axis] + bounds_max[b][axis];
+                   });
+
+  /* push_back may move the nodes, so node is not used past here */
+  int left = (int)this->nodes.size();
+  node.left = left;
+  this->nodes.push_back(bvh_node_t());
+  this->nodes.push_back(bvh_node_t());
+  split(left, first, count / 2, index, bounds_min, bounds_max);
+  split(left + 1, first + count / 2, count - count / 2, index, bounds_min,
+        bounds_max);
+}
+
+void scene_bvh_t::update(int part, const glm::vec3 &bounds_min,
+                         const glm::vec3 &bounds_max) {
+  int slot = this->slots[part];
+  this->bounds.set(slot, bounds_min, bounds_max);
+  int leaf = this->leaves[slot];
+  if (this->dirty.empty() || this->dirty.back() != leaf)
+    this->dirty.push_back(leaf);
+}
+
+void scene_bvh_t::fitLeaf(bvh_node_t &node) const {
+  node.bounds_min = glm::vec3(INFINITY);
+  node.bounds_max = glm::vec3(-INFINITY);
+  for (int i = node.first; i < node.first + node.count; i++) {
+    node.bounds_min = glm::min(node.bounds_min, this->bounds.min(i));
+    node.bounds_max = glm::max(node.bounds_max, this->bounds.max(i));
+  }
+}
+
+void scene_bvh_t::refit() {
+  for (int leaf : this->dirty) {
+    fitLeaf(this->nodes[leaf]);
+    for (int index = this->nodes[leaf].parent; index >= 0;
+         index = this->nodes[index].parent) {
+      bvh_node_t &node = this->nodes[index];
+      const bvh_node_t &left = this->nodes[node.left];
+      const bvh_node_t &right = this->nodes[node.left + 1];
+      node.bounds_min = glm::min(left.bounds_min, right.bounds_min);
+      node.bounds_max = glm::max(left.bounds_max, right.bounds_max);
+    }
+  }
+  this->dirty.clear();
+}
+
+/* appends the parts of the entries [first, first + count) whose boxes
+   meet the frustum */
+static void testBoxes(const frustum_t &frustum, const bounds_soa_t &bounds,
+                      const std::vector<int> &entries, int first, int count,
+                      std::vector<int> *visible) {
+  int end = first + count;
+  int i = first;
+#ifdef __SSE2__
+  const __m128 zero = _mm_setzero_ps();
+  for (; i + 4 <= end; i += 4) {
+    /* a box is out once its corner furthest along a normal is behind
+       that plane */
+    __m128 outside = zero;
+    for (const glm::vec4 &plane : frustum.planes) {
+      __m128 x = _mm_loadu_ps(plane.x > 0.0f ? &bounds.max_x[i] : &bounds.min_x[i]);
+      __m128 y = _mm_loadu_ps(plane.y > 0.0f ? &bounds.max_y[i] : &bounds.min_y[i]);
+      __m128 z = _mm_loadu_ps(plane.z > 0.0f ? &bounds.max_z[i] : &bounds.min_z[i]);
+      __m128 distance = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), x),
+                     _mm_mul_ps(_mm_set1_ps(plane.y), y)),
+          _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), z),
+                     _mm_set1_ps(plane.w)));
+      outside = _mm_or_ps(outside, _mm_cmplt_ps(distance, zero));
+    }
+    int mask = _mm_movemask_ps(outside);
+    for (int lane = 0; lane < 4; lane++) {
+      if (!(mask & (1 << lane)))
+        visible->push_back(entries[i + lane]);
+    }
+  }
+#endif
+  for (; i < end; i++) {
+    if (frustum.intersects(bounds.min(i), bounds.max(i)))
+      visible->push_back(entries[i]);
+  }
+}
+
+void scene_bvh_t::cull(const frustum_t &frustum, std::vector<int> *visible,
+                       cull_stats_t *stats) const {
+  if (this->nodes.empty())
+    return;
+  int stack[BVH_STACK_SIZE];
+  int top = 0;
+  stack[top++] = 0;
+  while (top > 0) {
+    const bvh_node_t &node = this->nodes[stack[--top]];
+    stats->nodes++;
+    if (!frustum.intersects(node.bounds_min, node.bounds_max))
+      continue;
+    if (frustum.contains(node.bounds_min, node.bounds_max)) {
+      visible->insert(visible->end(), this->entries.begin() + node.first,
+                      this->entries.begin() + node.first + node.count);
+    } else if (node.left < 0) {
+      testBoxes(frustum, this->bounds, this->entries, node.first, node.count,
+                visible);
+      stats->boxes += node.count;
+    } else {
+      assert(top + 2 <= BVH_STACK_SIZE);
+      stack[top++] = node.left;
+      stack[top++] = node.left + 1;
+    }
+  }
+}
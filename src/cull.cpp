@@ -0,0 +1,189 @@
+#include <algorithm>
+#include <cmath>
+
+#include "cull.hpp"
+#include "state.hpp"
+
+/* local sizes of the compute shaders */
+#define CULL_GROUP_SIZE 64
+#define PYRAMID_GROUP_SIZE 8
+
+/* bindings of the cull shader's buffers */
+#define CULL_INSTANCES_BINDING 0
+#define CULL_OBJECTS_BINDING 1
+#define CULL_COMMANDS_BINDING 2
+#define CULL_OUTPUT_BINDING 3
+
+static_assert(sizeof(cull_object_t) == 32, "CullObject layout");
+static_assert(sizeof(draw_command_t) == 20, "Command layout");
+
+frustum_t::frustum_t(const glm::mat4 &world_to_clip) {
+  /* each plane is the w row plus or minus the x, y or z row */
+  glm::mat4 rows = glm::transpose(world_to_clip);
+  for (int axis = 0; axis < 3; axis++) {
+    this->planes[axis * 2] = rows[3] + rows[axis];
+    this->planes[axis * 2 + 1] = rows[3] - rows[axis];
+  }
+}
+
+bool frustum_t::intersects(const glm::vec3 &bounds_min,
+                           const glm::vec3 &bounds_max) const {
+  for (const glm::vec4 &plane : this->planes) {
+    /* the corner furthest along the normal */
+    glm::vec3 corner(plane.x > 0.0f ? bounds_max.x : bounds_min.x,
+                     plane.y > 0.0f ? bounds_max.y : bounds_min.y,
+                     plane.z > 0.0f ? bounds_max.z : bounds_min.z);
+    if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+      return false;
+  }
+  return true;
+}
+
+bool frustum_t::contains(const glm::vec3 &bounds_min,
+                         const glm::vec3 &bounds_max) const {
+  for (const glm::vec4 &plane : this->planes) {
+    /* the corner furthest against the normal */
+    glm::vec3 corner(plane.x > 0.0f ? bounds_min.x : bounds_max.x,
+                     plane.y > 0.0f ? bounds_min.y : bounds_max.y,
+                     plane.z > 0.0f ? bounds_min.z : bounds_max.z);
+    if (glm::dot(glm::vec3(plane), corner) + plane.w < 0.0f)
+      return false;
+  }
+  return true;
+}
+
+void transformBounds(const glm::mat4 &transform, const glm::vec3 &bounds_min,
+                     const glm::vec3 &bounds_max, glm::vec3 *world_min,
+                     glm::vec3 *world_max) {
+  glm::vec3 center = 0.5f * (bounds_min + bounds_max);
+  glm::vec3 extent = 0.5f * (bounds_max - bounds_min);
+  glm::vec3 world_center = glm::vec3(transform * glm::vec4(center, 1.0f));
+  glm::vec3 world_extent(0.0f);
+  for (int column = 0; column < 3; column++)
+    world_extent += glm::abs(glm::vec3(transform[column])) * extent[column];
+  *world_min = world_center - world_extent;
+  *world_max = world_center + world_extent;
+}
+
+gpu_culler_t::gpu_culler_t() {
+  this->culled_instances = 0;
+  this->culled_bytes = 0;
+  this->depth_pyramid = 0;
+  this->depth_width = 0;
+  this->depth_height = 0;
+  this->pyramid_width = 0;
+  this->pyramid_height = 0;
+  this->pyramid_levels = 0;
+  this->occlusion = false;
+}
+
+gpu_culler_t::~gpu_culler_t() {
+  if (this->culled_instances != 0)
+    glDeleteBuffers(1, &this->culled_instances);
+  if (this->depth_pyramid != 0)
+    glDeleteTextures(1, &this->depth_pyramid);
+}
+
+void gpu_culler_t::config(int width, int height) {
+  this->cull_shader = shader_t::compute("../src/shader/cull_compute_shader.glsl");
+  this->cull_shader.bindBlock("FrameBlock", FRAME_BLOCK_BINDING);
+  this->cull_shader.bindSampler("uDepthPyramid", 0);
+  this->pyramid_shader =
+      shader_t::compute("../src/shader/pyramid_compute_shader.glsl");
+  this->pyramid_shader.bindSampler("uSource", 0);
+
+  this->depth_width = width;
+  this->depth_height = height;
+  this->pyramid_width = std::max(width / 2, 1);
+  this->pyramid_height = std::max(height / 2, 1);
+  this->pyramid_levels =
+      (int)std::log2(std::max(this->pyramid_width, this->pyramid_height)) + 1;
+  glGenTextures(1, &this->depth_pyramid);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->depth_pyramid);
+  glTexStorage2D(GL_TEXTURE_2D, this->pyramid_levels, GL_R32F,
+                 this->pyramid_width, this->pyramid_height);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_NEAREST_MIPMAP_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  this->occlusion = false;
+}
+
+void gpu_culler_t::cull(const render_queue_t &queue, Render_Pass pass,
+                        const uniform_ring_t &instances,
+                        const uniform_ring_t &objects,
+                        const uniform_ring_t &commands) {
+  int first_item, item_count, first_batch, batch_count;
+  queue.passItems(pass, &first_item, &item_count);
+  queue.passBatches(pass, &first_batch, &batch_count);
+  if (item_count == 0)
+    return;
+
+  /* survivors keep the index of their item, below base_instance +
+     instance_count of their batch */
+  size_t bytes = (size_t)(first_item + item_count) * sizeof(instance_data_t);
+  if (bytes > this->culled_bytes) {
+    if (this->culled_instances == 0)
+      glGenBuffers(1, &this->culled_instances);
+    this->culled_bytes = std::max(bytes, 2 * this->culled_bytes);
+    glBindBuffer(GL_SHADER_STORAGE_BUFFER, this->culled_instances);
+    glBufferData(GL_SHADER_STORAGE_BUFFER, this->culled_bytes, nullptr,
+                 GL_DYNAMIC_COPY);
+  }
+
+  this->timer.begin();
+  this->cull_shader.use();
+  this->cull_shader.setInt("uFirstInstance",
+                           (int)(instances.offset(0) / instances.stride));
+  this->cull_shader.setInt("uFirstObject",
+                           (int)(objects.offset(0) / objects.stride));
+  this->cull_shader.setInt("uFirstCommand",
+                           (int)(commands.offset(0) / commands.stride));
+  this->cull_shader.setInt("uFirstItem", first_item);
+  this->cull_shader.setInt("uItemCount", item_count);
+  this->cull_shader.setBool("uOcclusion", this->occlusion);
+  this->cull_shader.setInt("uPyramidWidth", this->pyramid_width);
+  this->cull_shader.setInt("uPyramidHeight", this->pyramid_height);
+  this->cull_shader.setInt("uPyramidLevels", this->pyramid_levels);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->depth_pyramid);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_INSTANCES_BINDING,
+                   instances.buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_OBJECTS_BINDING,
+                   objects.buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_COMMANDS_BINDING,
+                   commands.buffer);
+  glBindBufferBase(GL_SHADER_STORAGE_BUFFER, CULL_OUTPUT_BINDING,
+                   this->culled_instances);
+  glDispatchCompute((item_count + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE, 1,
+                    1);
+  /* the draws read the counts as commands and the survivors as attributes */
+  glMemoryBarrier(GL_COMMAND_BARRIER_BIT | GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT);
+  this->timer.end();
+}
+
+void gpu_culler_t::buildPyramid(unsigned int depth) {
+  this->pyramid_shader.use();
+  int source_width = this->depth_width, source_height = this->depth_height;
+  int width = this->pyramid_width, height = this->pyramid_height;
+  for (int level = 0; level < this->pyramid_levels; level++) {
+    /* each level reduces the one above it, mip 0 the depth buffer */
+    glState().bindTexture(0, GL_TEXTURE_2D,
+                          level == 0 ? depth : this->depth_pyramid);
+    this->pyramid_shader.setInt("uSourceLevel", level == 0 ? 0 : level - 1);
+    this->pyramid_shader.setInt("uSourceWidth", source_width);
+    this->pyramid_shader.setInt("uSourceHeight", source_height);
+    this->pyramid_shader.setBool("uFromDepth", level == 0);
+    glBindImageTexture(0, this->depth_pyramid, level, GL_FALSE, 0,
+                       GL_WRITE_ONLY, GL_R32F);
+    glDispatchCompute((width + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE,
+                      (height + PYRAMID_GROUP_SIZE - 1) / PYRAMID_GROUP_SIZE,
+                      1);
+    glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    source_width = width;
+    source_height = height;
+    width = std::max(width / 2, 1);
+    height = std::max(height / 2, 1);
+  }
+  this->occlusion = true;
+}
@@ -0,0 +1,148 @@
+#include <atomic>
+#include <cstdio>
+#include <filesystem>
+#include <system_error>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "file.hpp"
+
+mapped_file_t::mapped_file_t() {
+  this->data = nullptr;
+  this->size = 0;
+#ifdef _WIN32
+  this->file_handle = INVALID_HANDLE_VALUE;
+  this->mapping_handle = nullptr;
+#endif
+}
+
+mapped_file_t::~mapped_file_t() { close(); }
+
+bool mapped_file_t::open(const std::string &filename) {
+  close();
+#ifdef _WIN32
+  HANDLE file = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+                            NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (file == INVALID_HANDLE_VALUE)
+    return false;
+  LARGE_INTEGER file_size;
+  if (!GetFileSizeEx(file, &file_size) || file_size.QuadPart == 0) {
+    CloseHandle(file);
+    return false;
+  }
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (mapping == NULL) {
+    CloseHandle(file);
+    return false;
+  }
+  void *view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+  if (view == NULL) {
+    CloseHandle(mapping);
+    CloseHandle(file);
+    return false;
+  }
+  this->file_handle = file;
+  this->mapping_handle = mapping;
+  this->data = (const char *)view;
+  this->size = (size_t)file_size.QuadPart;
+#else
+  int fd = ::open(filename.c_str(), O_RDONLY);
+  if (fd < 0)
+    return false;
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    ::close(fd);
+    return false;
+  }
+  void *view = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  /* the mapping keeps its own reference to the file */
+  ::close(fd);
+  if (view == MAP_FAILED)
+    return false;
+  this->data = (const char *)view;
+  this->size = (size_t)st.st_size;
+#endif
+  return true;
+}
+
+void mapped_file_t::close() {
+  if (this->data == nullptr)
+    return;
+#ifdef _WIN32
+  UnmapViewOfFile(this->data);
+  CloseHandle(this->mapping_handle);
+  CloseHandle(this->file_handle);
+  this->file_handle = INVALID_HANDLE_VALUE;
+  this->mapping_handle = nullptr;
+#else
+  munmap((void *)this->data, this->size);
+#endif
+  this->data = nullptr;
+  this->size = 0;
+}
+
+bool fileStamp(const std::string &filename, long long *mtime,
+               unsigned long long *size) {
+  std::error_code ec;
+  auto time = std::filesystem::last_write_time(filename, ec);
+  if (ec)
+    return false;
+  auto bytes = std::filesystem::file_size(filename, ec);
+  if (ec)
+    return false;
+  *mtime = (long long)time.time_since_epoch().count();
+  *size = (unsigned long long)bytes;
+  return true;
+}
+
+unsigned long long hashBytes(const void *data, size_t size,
+                             unsigned long long seed) {
+  const unsigned char *bytes = (const unsigned char *)data;
+  unsigned long long hash = seed;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ull;
+  }
+  return hash;
+}
+
+bool writeFileAtomic(const std::string &filename, const void *const *chunks,
+                     const size_t *sizes, int num_chunks) {
+  /* writers of the same file, in this process or another, each get their
+     own temp file and the last rename wins */
+  static std::atomic<unsigned int> counter(0);
+#ifdef _WIN32
+  unsigned long process = GetCurrentProcessId();
+#else
+  unsigned long process = (unsigned long)getpid();
+#endif
+  std::string temp = filename + "." + std::to_string(process) + "." +
+                     std::to_string(counter++) + ".tmp";
+  FILE *file = fopen(temp.c_str(), "wb");
+  if (file == nullptr)
+    return false;
+  bool ok = true;
+  for (int i = 0; i < num_chunks && ok; i++) {
+    if (sizes[i] > 0)
+      ok = fwrite(chunks[i], 1, sizes[i], file) == sizes[i];
+  }
+  ok = (fclose(file) == 0) && ok;
+
+  std::error_code ec;
+  if (ok)
+    std::filesystem::rename(temp, filename, ec);
+  if (!ok || ec) {
+    std::filesystem::remove(temp, ec);
+    return false;
+  }
+  return true;
+}
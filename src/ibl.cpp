@@ -0,0 +1,278 @@
+#include <cstring>
+#include <glm.hpp>
+#include <gtc/packing.hpp>
+#include <iostream>
+
+#include "file.hpp"
+#include "ibl.hpp"
+#include "state.hpp"
+
+#define IBL_CACHE_MAGIC 0x4c424941 /* "AIBL" */
+#define IBL_CACHE_VERSION 3
+
+/* 6 skybox faces, 6 prefiltered faces */
+#define IBL_CACHE_TEXTURES 12
+
+/*
+  baked lighting of one environment: the SH9 irradiance as 27 floats,
+  then one texture record per texture in the order skybox, prefilter;
+  each record is followed by its level table and then its
+  level data
+*/
+struct ibl_cache_header_t {
+  unsigned int magic;
+  unsigned int version;
+  unsigned long long key;
+  unsigned int num_textures;
+  unsigned int reserved;
+};
+
+struct ibl_cache_texture_t {
+  unsigned int internal_format;
+  unsigned int format;
+  unsigned int type;
+  unsigned int num_levels;
+  unsigned long long data_bytes;
+};
+
+struct ibl_cache_level_t {
+  int width;
+  int height;
+  unsigned long long offset;
+  unsigned long long size;
+};
+
+/* the shaders that produce the bake, a change to them invalidates it */
+static const char *IBL_SHADERS[] = {
+    "../src/shader/prefilter_vertex_shader.glsl",
+    "../src/shader/prefilter_fragment_shader.glsl"};
+
+ibl_data_t::ibl_data_t() {
+  for (int i = 0; i < 6; i++) {
+    this->skybox[i] = nullptr;
+    this->prefilter[i] = nullptr;
+  }
+}
+
+ibl_data_t::~ibl_data_t() {
+  for (int i = 0; i < 6; i++) {
+    delete this->skybox[i];
+    delete this->prefilter[i];
+  }
+}
+
+std::vector<std::string> environmentFaces(const std::string &environment) {
+  std::string prefix = "../assets/" + environment + "/m0_";
+  return {prefix + "px.hdr", prefix + "nx.hdr", prefix + "py.hdr",
+          prefix + "ny.hdr", prefix + "pz.hdr", prefix + "nz.hdr"};
+}
+
+static std::string cacheName(const std::string &environment) {
+  return "../assets/" + environment + "/ibl.cache";
+}
+
+/* hash of the environment, its face files, the baking shaders and the
+   settings they ran with */
+static bool cacheKey(const std::string &environment,
+                     const ibl_settings_t &settings, unsigned long long *key) {
+  unsigned int version = IBL_CACHE_VERSION;
+  unsigned long long hash = hashBytes(&version, sizeof(version));
+  int levels = IBL_PREFILTER_LEVELS;
+  hash = hashBytes(&settings.flags, sizeof(settings.flags), hash);
+  hash = hashBytes(&settings.samples, sizeof(settings.samples), hash);
+  hash = hashBytes(&settings.first_samples, sizeof(settings.first_samples),
+                   hash);
+  hash = hashBytes(&levels, sizeof(levels), hash);
+  hash = hashBytes(environment.data(), environment.size(), hash);
+  for (const std::string &face : environmentFaces(environment)) {
+    long long mtime;
+    unsigned long long size;
+    if (!fileStamp(face, &mtime, &size))
+      return false;
+    hash = hashBytes(&mtime, sizeof(mtime), hash);
+    hash = hashBytes(&size, sizeof(size), hash);
+  }
+  for (const char *shader : IBL_SHADERS) {
+    mapped_file_t file;
+    if (!file.open(shader))
+      return false;
+    hash = hashBytes(file.data, file.size, hash);
+  }
+  *key = hash;
+  return true;
+}
+
+static texture_data_t *readTexture(const char **cursor, const char *end) {
+  ibl_cache_texture_t record;
+  if (end - *cursor < (long long)sizeof(record))
+    return nullptr;
+  memcpy(&record, *cursor, sizeof(record));
+  *cursor += sizeof(record);
+  size_t table_size = record.num_levels * sizeof(ibl_cache_level_t);
+  if ((unsigned long long)(end - *cursor) < table_size + record.data_bytes)
+    return nullptr;
+
+  texture_data_t *data = new texture_data_t();
+  data->internal_format = record.internal_format;
+  data->format = record.format;
+  data->type = record.type;
+  data->compressed = false;
+  data->raw_bytes = record.data_bytes;
+  for (unsigned int i = 0; i < record.num_levels; i++) {
+    ibl_cache_level_t level;
+    memcpy(&level, *cursor + i * sizeof(level), sizeof(level));
+    if (level.offset + level.size > record.data_bytes) {
+      delete data;
+      return nullptr;
+    }
+    data->levels.push_back({level.width, level.height, (size_t)level.offset,
+                            (size_t)level.size});
+  }
+  *cursor += table_size;
+  const unsigned char *bytes = (const unsigned char *)*cursor;
+  data->bytes.assign(bytes, bytes + record.data_bytes);
+  *cursor += record.data_bytes;
+  return data;
+}
+
+ibl_data_t *loadIBLCache(const std::string &environment,
+                         const ibl_settings_t &settings) {
+  unsigned long long key;
+  if (!cacheKey(environment, settings, &key))
+    return nullptr;
+
+  mapped_file_t file;
+  if (!file.open(cacheName(environment)))
+    return nullptr;
+  if (file.size < sizeof(ibl_cache_header_t))
+    return nullptr;
+
+  ibl_cache_header_t header;
+  memcpy(&header, file.data, sizeof(header));
+  if (header.magic != IBL_CACHE_MAGIC || header.version != IBL_CACHE_VERSION ||
+      header.key != key || header.num_textures != IBL_CACHE_TEXTURES)
+    return nullptr;
+
+  const char *cursor = file.data + sizeof(header);
+  const char *end = file.data + file.size;
+  if ((size_t)(end - cursor) < sizeof(ibl_data_t::irradiance))
+    return nullptr;
+
+  ibl_data_t *ibl = new ibl_data_t();
+  memcpy(&ibl->irradiance, cursor, sizeof(ibl->irradiance));
+  cursor += sizeof(ibl->irradiance);
+  texture_data_t **textures[IBL_CACHE_TEXTURES];
+  for (int i = 0; i < 6; i++) {
+    textures[i] = &ibl->skybox[i];
+    textures[6 + i] = &ibl->prefilter[i];
+  }
+
+  for (int i = 0; i < IBL_CACHE_TEXTURES; i++) {
+    *textures[i] = readTexture(&cursor, end);
+    if (*textures[i] == nullptr) {
+      delete ibl;
+      return nullptr;
+    }
+  }
+  if (cursor != end) {
+    delete ibl;
+    return nullptr;
+  }
+  return ibl;
+}
+
+/* one texture level read back as float and packed to shared exponent */
+static void readLevel(GLenum target, int level, texture_data_t *data) {
+  int width, height;
+  glGetTexLevelParameteriv(target, level, GL_TEXTURE_WIDTH, &width);
+  glGetTexLevelParameteriv(target, level, GL_TEXTURE_HEIGHT, &height);
+  std::vector<float> texels((size_t)width * height * 3);
+  glPixelStorei(GL_PACK_ALIGNMENT, 1);
+  glGetTexImage(target, level, GL_RGB, GL_FLOAT, texels.data());
+  glPixelStorei(GL_PACK_ALIGNMENT, 4);
+
+  texture_level_t entry = {width, height, data->bytes.size(), 0};
+  data->levels.push_back(entry);
+  int index = (int)data->levels.size() - 1;
+  entry.size = data->rowBytes(index) * height;
+  data->levels[index].size = entry.size;
+  data->bytes.resize(entry.offset + entry.size, 0);
+
+  unsigned char *dst = data->bytes.data() + entry.offset;
+  size_t pitch = data->rowBytes(index);
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      const float *texel = &texels[((size_t)y * width + x) * 3];
+      unsigned int shared =
+          glm::packF3x9_E1x5(glm::vec3(texel[0], texel[1], texel[2]));
+      memcpy(dst + y * pitch + x * sizeof(shared), &shared, sizeof(shared));
+    }
+  }
+  data->raw_bytes = data->bytes.size();
+}
+
+static texture_data_t *emptyData(GLenum internal_format, GLenum format,
+                                 GLenum type) {
+  texture_data_t *data = new texture_data_t();
+  data->internal_format = internal_format;
+  data->format = format;
+  data->type = type;
+  data->compressed = false;
+  data->raw_bytes = 0;
+  return data;
+}
+
+ibl_data_t *readIBL(unsigned int skybox, unsigned int prefilter) {
+  ibl_data_t *ibl = new ibl_data_t();
+  for (int i = 0; i < 6; i++) {
+    ibl->skybox[i] =
+        emptyData(GL_RGB9_E5, GL_RGB, GL_UNSIGNED_INT_5_9_9_9_REV);
+    glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, skybox);
+    readLevel(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, ibl->skybox[i]);
+
+    ibl->prefilter[i] =
+        emptyData(GL_RGB9_E5, GL_RGB, GL_UNSIGNED_INT_5_9_9_9_REV);
+    glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, prefilter);
+    for (int level = 0; level < IBL_PREFILTER_LEVELS; level++)
+      readLevel(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, level, ibl->prefilter[i]);
+  }
+  return ibl;
+}
+
+void saveIBLCache(const std::string &environment,
+                  const ibl_settings_t &settings, const ibl_data_t *ibl) {
+  ibl_cache_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = IBL_CACHE_MAGIC;
+  header.version = IBL_CACHE_VERSION;
+  header.num_textures = IBL_CACHE_TEXTURES;
+  if (!cacheKey(environment, settings, &header.key))
+    return;
+
+  const texture_data_t *textures[IBL_CACHE_TEXTURES];
+  for (int i = 0; i < 6; i++) {
+    textures[i] = ibl->skybox[i];
+    textures[6 + i] = ibl->prefilter[i];
+  }
+
+  std::vector<ibl_cache_texture_t> records(IBL_CACHE_TEXTURES);
+  std::vector<std::vector<ibl_cache_level_t>> tables(IBL_CACHE_TEXTURES);
+  std::vector<const void *> chunks = {&header, &ibl->irradiance};
+  std::vector<size_t> sizes = {sizeof(header), sizeof(ibl->irradiance)};
+  for (int i = 0; i < IBL_CACHE_TEXTURES; i++) {
+    const texture_data_t *data = textures[i];
+    records[i] = {data->internal_format, data->format, data->type,
+                  (unsigned int)data->levels.size(), data->bytes.size()};
+    for (const texture_level_t &level : data->levels)
+      tables[i].push_back({level.width, level.height, level.offset, level.size});
+    chunks.push_back(&records[i]);
+    sizes.push_back(sizeof(ibl_cache_texture_t));
+    chunks.push_back(tables[i].data());
+    sizes.push_back(tables[i].size() * sizeof(ibl_cache_level_t));
+    chunks.push_back(data->bytes.data());
+    sizes.push_back(data->bytes.size());
+  }
+  std::string filename = cacheName(environment);
+  if (!writeFileAtomic(filename, chunks.data(), sizes.data(), (int)chunks.size()))
+    std::cout << "Failed to write IBL cache: " << filename << std::endl;
+}
@@ -0,0 +1,34 @@
+#include <stb_image.h>
+
+#include "image.hpp"
+
+image_t::image_t() {
+  this->width = 0;
+  this->height = 0;
+  this->channels = 0;
+  this->hdr = false;
+  this->data = nullptr;
+}
+
+image_t::~image_t() {
+  if (this->data != nullptr)
+    stbi_image_free(this->data);
+}
+
+bool image_t::load(const std::string &filename, bool flip, bool hdr) {
+  /* the flip flag is per thread so concurrent decodes do not race on it */
+  stbi_set_flip_vertically_on_load_thread(flip);
+  this->hdr = hdr;
+  if (hdr)
+    this->data = stbi_loadf(filename.c_str(), &this->width, &this->height,
+                            &this->channels, 0);
+  else
+    this->data = stbi_load(filename.c_str(), &this->width, &this->height,
+                           &this->channels, 0);
+  return this->data != nullptr;
+}
+
+size_t image_t::bytes() const {
+  size_t texel = this->hdr ? sizeof(float) : 1;
+  return (size_t)this->width * this->height * this->channels * texel;
+}
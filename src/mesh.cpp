@@ -1,157 +1,704 @@
+#include <algorithm>
 #include <cassert>
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstddef>
 #include <cstring>
+#include <geometric.hpp>
 #include <iostream>
+#include <matrix.hpp>
 #include <string>
 #include <vector>
 
+#include "file.hpp"
 #include "mesh.hpp"
+#include "pool.hpp"
+#include "profile.hpp"
 
-static mesh_t *
-buildMesh(std::vector<glm::vec3> positions, std::vector<glm::vec2> texcoords,
-             std::vector<glm::vec3> normals, std::vector<glm::vec4> tangents,
-             std::vector<glm::vec4> joints, std::vector<glm::vec4> weights,
-             std::vector<int> position_indices,
-             std::vector<int> texcoord_indices,
-             std::vector<int> normal_indices) {
+#define MESH_CACHE_MAGIC 0x48534d41 /* "AMSH" */
+#define MESH_CACHE_VERSION 3
 
-  int num_indices = position_indices.size();
+/*
+  binary mesh cache written next to the source file, the vertex array
+  follows the header and is laid out exactly as std::vector<vertex_t>,
+  the 32-bit index array comes right after it
+*/
+struct mesh_cache_header_t {
+  unsigned int magic;
+  unsigned int version;
+  unsigned long long layout;
+  long long source_mtime;
+  unsigned long long source_size;
+  unsigned long long num_vertices;
+  unsigned long long num_indices;
+  int num_faces;
+  int reserved;
+  float bounds_min[3];
+  float bounds_max[3];
+};
+
+/* post-transform cache model used for ordering and for the ACMR report */
+#define VERTEX_CACHE_SIZE 32
+#define ACMR_FIFO_SIZE 16
+
+/* one corner of an OBJ face, indices are 0-based and -1 when absent */
+struct obj_corner_t {
+  int position;
+  int texcoord;
+  int normal;
+  int relative; /* OBJ_RELATIVE_* bits for indices counted from the end */
+};
+
+#define OBJ_RELATIVE_POSITION 1
+#define OBJ_RELATIVE_TEXCOORD 2
+#define OBJ_RELATIVE_NORMAL 4
+
+/* smallest slice handed to a parser job */
+#define OBJ_MIN_CHUNK (1 << 20)
+
+/* attributes and triangles parsed from a line-aligned slice of an OBJ file */
+class obj_chunk_t {
+public:
+  std::vector<glm::vec3> positions;
+  std::vector<glm::vec2> texcoords;
+  std::vector<glm::vec3> normals;
+  std::vector<glm::vec4> tangents;
+  std::vector<glm::vec4> joints;
+  std::vector<glm::vec4> weights;
+  std::vector<obj_corner_t> corners; /* three per triangle */
+};
+
+static mesh_t *buildMesh(const obj_chunk_t &obj) {
+  int num_indices = obj.corners.size();
   int num_faces = num_indices / 3;
   std::vector<vertex_t> vertices(num_indices);
   mesh_t *mesh = new mesh_t();
 
   assert(num_faces > 0 && num_faces * 3 == num_indices);
-  assert(position_indices.size() == num_indices);
-  assert(texcoord_indices.size() == num_indices);
-  assert(normal_indices.size() == num_indices);
 
+  mesh->bounds_min = glm::vec3(INFINITY);
+  mesh->bounds_max = glm::vec3(-INFINITY);
   for (int i = 0; i < num_indices; i++) {
-    int position_index = position_indices[i];
-    int texcoord_index = texcoord_indices[i];
-    int normal_index = normal_indices[i];
-    assert(position_index >= 0 && position_index < positions.size());
-    assert(texcoord_index >= 0 && texcoord_index < texcoords.size());
-    assert(normal_index >= 0 && normal_index < normals.size());
-    vertices[i].position = positions[position_index];
-    vertices[i].texcoord = texcoords[texcoord_index];
-    vertices[i].normal = normals[normal_index];
-
-    if (tangents.size() != 0) {
+    const obj_corner_t &corner = obj.corners[i];
+    int position_index = corner.position;
+    int texcoord_index = corner.texcoord;
+    int normal_index = corner.normal;
+    assert(position_index >= 0 && position_index < obj.positions.size());
+    assert(texcoord_index >= -1 && texcoord_index < (int)obj.texcoords.size());
+    assert(normal_index >= -1 && normal_index < (int)obj.normals.size());
+    vertices[i].position = obj.positions[position_index];
+    mesh->bounds_min = glm::min(mesh->bounds_min, vertices[i].position);
+    mesh->bounds_max = glm::max(mesh->bounds_max, vertices[i].position);
+
+    if (texcoord_index >= 0) {
+      vertices[i].texcoord = obj.texcoords[texcoord_index];
+    } else {
+      vertices[i].texcoord = glm::vec2(0, 0);
+    }
+
+    if (normal_index >= 0) {
+      vertices[i].normal = obj.normals[normal_index];
+    } else {
+      /* flat normal of the triangle the corner belongs to */
+      int first = i - i % 3;
+      glm::vec3 p0 = obj.positions[obj.corners[first].position];
+      glm::vec3 p1 = obj.positions[obj.corners[first + 1].position];
+      glm::vec3 p2 = obj.positions[obj.corners[first + 2].position];
+      glm::vec3 n = glm::cross(p1 - p0, p2 - p0);
+      float len = glm::length(n);
+      vertices[i].normal = len > 0 ? n / len : glm::vec3(0, 1, 0);
+    }
+
+    if (obj.tangents.size() != 0) {
       int tangent_index = position_index;
-      assert(tangent_index >= 0 && tangent_index < tangents.size());
-      vertices[i].tangent = tangents[tangent_index];
+      assert(tangent_index >= 0 && tangent_index < obj.tangents.size());
+      vertices[i].tangent = obj.tangents[tangent_index];
     } else {
       vertices[i].tangent = glm::vec4(1, 0, 0, 1);
     }
 
-    if (joints.size() != 0) {
+    if (obj.joints.size() != 0) {
       int joint_index = position_index;
-      assert(joint_index >= 0 && joint_index < joints.size());
-      vertices[i].joint = joints[joint_index];
+      assert(joint_index >= 0 && joint_index < obj.joints.size());
+      vertices[i].joint = obj.joints[joint_index];
     } else {
       vertices[i].joint = glm::vec4(0, 0, 0, 0);
     }
 
-    if (weights.size() != 0) {
+    if (obj.weights.size() != 0) {
       int weight_index = position_index;
-      assert(weight_index >= 0 && weight_index < weights.size());
-      vertices[i].weight = weights[weight_index];
+      assert(weight_index >= 0 && weight_index < obj.weights.size());
+      vertices[i].weight = obj.weights[weight_index];
     } else {
       vertices[i].weight = glm::vec4(0, 0, 0, 0);
     }
   }
 
   mesh->num_faces = num_faces;
-  mesh->vertices = vertices;
+  mesh->vertices = std::move(vertices);
 
   return mesh;
 }
 
-static mesh_t *loadObj(std::string filename) {
-  std::vector<glm::vec3> positions;
-  std::vector<glm::vec2> texcoords;
-  std::vector<glm::vec3> normals;
-  std::vector<glm::vec4> tangents;
-  std::vector<glm::vec4> joints;
-  std::vector<glm::vec4> weights;
-  std::vector<int> position_indices;
-  std::vector<int> texcoord_indices;
-  std::vector<int> normal_indices;
-  char line[256];
-  mesh_t *mesh;
-  FILE *file;
-
-  file = fopen(filename.c_str(), "rb");
-  assert(file != nullptr);
+static inline const char *skipSpace(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\r'))
+    p++;
+  return p;
+}
+
+static inline bool startsWith(const char *p, const char *end,
+                              const char *prefix, size_t length) {
+  return (size_t)(end - p) >= length && memcmp(p, prefix, length) == 0;
+}
+
+/* parses up to count floats, returns how many were read */
+static int parseFloats(const char *p, const char *end, float *values,
+                       int count) {
+  int items = 0;
+  while (items < count) {
+    p = skipSpace(p, end);
+    if (p < end && *p == '+')
+      p++;
+    std::from_chars_result result = std::from_chars(p, end, values[items]);
+    if (result.ec != std::errc())
+      break;
+    p = result.ptr;
+    items++;
+  }
+  return items;
+}
+
+/* one face index, relative indices are resolved against the chunk count */
+static const char *parseIndex(const char *p, const char *end, int count,
+                              int *index, int *relative, int relative_bit) {
+  int value = 0;
+  std::from_chars_result result = std::from_chars(p, end, value);
+  if (result.ec != std::errc() || value == 0)
+    return NULL;
+  if (value > 0) {
+    *index = value - 1;
+  } else {
+    *index = count + value;
+    *relative |= relative_bit;
+  }
+  return result.ptr;
+}
+
+/* v, v/t, v//n or v/t/n */
+static const char *parseCorner(const char *p, const char *end,
+                               obj_chunk_t *chunk, obj_corner_t *corner) {
+  corner->texcoord = -1;
+  corner->normal = -1;
+  corner->relative = 0;
+  p = parseIndex(p, end, chunk->positions.size(), &corner->position,
+                 &corner->relative, OBJ_RELATIVE_POSITION);
+  if (p == NULL || p == end || *p != '/')
+    return p;
+  p++;
+  if (p < end && *p != '/') {
+    p = parseIndex(p, end, chunk->texcoords.size(), &corner->texcoord,
+                   &corner->relative, OBJ_RELATIVE_TEXCOORD);
+    if (p == NULL || p == end || *p != '/')
+      return p;
+  }
+  p++;
+  return parseIndex(p, end, chunk->normals.size(), &corner->normal,
+                    &corner->relative, OBJ_RELATIVE_NORMAL);
+}
+
+/* polygons are triangulated as a fan around their first corner */
+static void parseFace(const char *p, const char *end, obj_chunk_t *chunk) {
+  obj_corner_t first, previous, corner;
+  int num_corners = 0;
   while (1) {
-    int items;
-    if (fgets(line, 256, file) == NULL) {
+    p = skipSpace(p, end);
+    if (p == end)
       break;
-    } else if (strncmp(line, "v ", 2) == 0) { /* position */
-      glm::vec3 position;
-      items = sscanf(line, "v %f %f %f", &position.x, &position.y, &position.z);
-      assert(items == 3);
-      positions.push_back(position);
-    } else if (strncmp(line, "vt ", 3) == 0) { /* texcoord */
-      glm::vec2 texcoord;
-      items = sscanf(line, "vt %f %f", &texcoord.x, &texcoord.y);
-      assert(items == 2);
-      texcoords.push_back(texcoord);
-    } else if (strncmp(line, "vn ", 3) == 0) { /* normal */
-      glm::vec3 normal;
-      items = sscanf(line, "vn %f %f %f", &normal.x, &normal.y, &normal.z);
-      assert(items == 3);
-      normals.push_back(normal);
-    } else if (strncmp(line, "f ", 2) == 0) { /* face */
-      int i;
-      int pos_indices[3], uv_indices[3], n_indices[3];
-      items =
-          sscanf(line, "f %d/%d/%d %d/%d/%d %d/%d/%d", &pos_indices[0],
-                 &uv_indices[0], &n_indices[0], &pos_indices[1], &uv_indices[1],
-                 &n_indices[1], &pos_indices[2], &uv_indices[2], &n_indices[2]);
-      assert(items == 9);
-      for (i = 0; i < 3; i++) {
-        position_indices.push_back(pos_indices[i] - 1);
-        texcoord_indices.push_back(uv_indices[i] - 1);
-        normal_indices.push_back(n_indices[i] - 1);
+    p = parseCorner(p, end, chunk, &corner);
+    assert(p != NULL);
+    if (num_corners == 0) {
+      first = corner;
+    } else if (num_corners >= 2) {
+      chunk->corners.push_back(first);
+      chunk->corners.push_back(previous);
+      chunk->corners.push_back(corner);
+    }
+    previous = corner;
+    num_corners++;
+  }
+  assert(num_corners >= 3);
+}
+
+static void parseObjLine(const char *p, const char *end, obj_chunk_t *chunk) {
+  int items;
+  if (startsWith(p, end, "v ", 2) || startsWith(p, end, "v\t", 2)) { /* position */
+    glm::vec3 position;
+    items = parseFloats(p + 2, end, &position.x, 3);
+    assert(items == 3);
+    chunk->positions.push_back(position);
+  } else if (startsWith(p, end, "vt", 2)) { /* texcoord */
+    glm::vec2 texcoord(0, 0);
+    items = parseFloats(p + 2, end, &texcoord.x, 2);
+    assert(items >= 1);
+    chunk->texcoords.push_back(texcoord);
+  } else if (startsWith(p, end, "vn", 2)) { /* normal */
+    glm::vec3 normal;
+    items = parseFloats(p + 2, end, &normal.x, 3);
+    assert(items == 3);
+    chunk->normals.push_back(normal);
+  } else if (startsWith(p, end, "f ", 2) || startsWith(p, end, "f\t", 2)) { /* face */
+    parseFace(p + 2, end, chunk);
+  } else if (startsWith(p, end, "# ext.tangent ", 14)) { /* tangent */
+    glm::vec4 tangent;
+    items = parseFloats(p + 14, end, &tangent.x, 4);
+    assert(items == 4);
+    chunk->tangents.push_back(tangent);
+  } else if (startsWith(p, end, "# ext.joint ", 12)) { /* joint */
+    glm::vec4 joint;
+    items = parseFloats(p + 12, end, &joint.x, 4);
+    assert(items == 4);
+    chunk->joints.push_back(joint);
+  } else if (startsWith(p, end, "# ext.weight ", 13)) { /* weight */
+    glm::vec4 weight;
+    items = parseFloats(p + 13, end, &weight.x, 4);
+    assert(items == 4);
+    chunk->weights.push_back(weight);
+  }
+}
+
+static void parseObjChunk(const char *begin, const char *end,
+                          obj_chunk_t *chunk) {
+  size_t size = end - begin;
+  chunk->positions.reserve(size / 128);
+  chunk->texcoords.reserve(size / 128);
+  chunk->normals.reserve(size / 128);
+  chunk->corners.reserve(size / 32);
+
+  const char *line = begin;
+  while (line < end) {
+    const char *eol = (const char *)memchr(line, '\n', end - line);
+    if (eol == NULL)
+      eol = end;
+    parseObjLine(skipSpace(line, eol), eol, chunk);
+    line = eol + 1;
+  }
+}
+
+template <typename T>
+static void appendChunk(std::vector<T> &dst, const std::vector<T> &src) {
+  dst.insert(dst.end(), src.begin(), src.end());
+}
+
+mesh_t *loadObj(std::string filename) {
+  mapped_file_t file;
+  bool opened = file.open(filename);
+  assert(opened);
+
+  /* line-aligned slices, one per thread that can take one; on a pool
+     worker that is just the caller, which parses the file whole */
+  size_t num_chunks =
+      std::min((size_t)parallelism(), file.size / OBJ_MIN_CHUNK + 1);
+  std::vector<const char *> bounds(num_chunks + 1);
+  const char *file_end = file.data + file.size;
+  bounds[0] = file.data;
+  bounds[num_chunks] = file_end;
+  for (size_t i = 1; i < num_chunks; i++) {
+    const char *p = file.data + file.size * i / num_chunks;
+    p = std::max(p, bounds[i - 1]);
+    const char *eol = (const char *)memchr(p, '\n', file_end - p);
+    bounds[i] = eol != NULL ? eol + 1 : file_end;
+  }
+
+  std::vector<obj_chunk_t> chunks(num_chunks);
+  parallelFor((int)num_chunks, [&](int i) {
+    parseObjChunk(bounds[i], bounds[i + 1], &chunks[i]);
+  });
+
+  if (num_chunks == 1)
+    return buildMesh(chunks[0]);
+
+  /* relative indices only know the counts inside their own chunk */
+  obj_chunk_t obj;
+  for (size_t i = 0; i < num_chunks; i++) {
+    const obj_chunk_t &chunk = chunks[i];
+    int position_offset = obj.positions.size();
+    int texcoord_offset = obj.texcoords.size();
+    int normal_offset = obj.normals.size();
+    size_t first_corner = obj.corners.size();
+    appendChunk(obj.positions, chunk.positions);
+    appendChunk(obj.texcoords, chunk.texcoords);
+    appendChunk(obj.normals, chunk.normals);
+    appendChunk(obj.tangents, chunk.tangents);
+    appendChunk(obj.joints, chunk.joints);
+    appendChunk(obj.weights, chunk.weights);
+    appendChunk(obj.corners, chunk.corners);
+    for (size_t j = first_corner; j < obj.corners.size(); j++) {
+      obj_corner_t &corner = obj.corners[j];
+      if (corner.relative & OBJ_RELATIVE_POSITION)
+        corner.position += position_offset;
+      if (corner.relative & OBJ_RELATIVE_TEXCOORD)
+        corner.texcoord += texcoord_offset;
+      if (corner.relative & OBJ_RELATIVE_NORMAL)
+        corner.normal += normal_offset;
+    }
+  }
+
+  return buildMesh(obj);
+}
+
+/* merges byte-identical vertices of a de-indexed mesh into an index buffer */
+static void weldVertices(mesh_t *mesh) {
+  const std::vector<vertex_t> &corners = mesh->vertices;
+  size_t num_corners = corners.size();
+  size_t table_size = 1;
+  while (table_size < num_corners * 2)
+    table_size <<= 1;
+  std::vector<unsigned int> table(table_size, UINT32_MAX);
+
+  std::vector<vertex_t> vertices;
+  std::vector<unsigned int> indices(num_corners);
+  vertices.reserve(num_corners);
+  for (size_t i = 0; i < num_corners; i++) {
+    const vertex_t &corner = corners[i];
+    size_t slot = hashBytes(&corner, sizeof(vertex_t)) & (table_size - 1);
+    while (table[slot] != UINT32_MAX &&
+           memcmp(&vertices[table[slot]], &corner, sizeof(vertex_t)) != 0) {
+      slot = (slot + 1) & (table_size - 1);
+    }
+    if (table[slot] == UINT32_MAX) {
+      table[slot] = vertices.size();
+      vertices.push_back(corner);
+    }
+    indices[i] = table[slot];
+  }
+
+  mesh->vertices = std::move(vertices);
+  mesh->indices = std::move(indices);
+}
+
+/* average cache miss ratio: transformed vertices per triangle */
+static float computeACMR(const std::vector<unsigned int> &indices,
+                         int num_vertices) {
+  std::vector<int> stamps(num_vertices, -ACMR_FIFO_SIZE - 1);
+  int misses = 0;
+  for (unsigned int index : indices) {
+    if (misses - stamps[index] > ACMR_FIFO_SIZE) {
+      stamps[index] = misses;
+      misses++;
+    }
+  }
+  return indices.empty() ? 0.0f : (float)misses / (indices.size() / 3);
+}
+
+/*
+  Forsyth, "Linear-Speed Vertex Cache Optimisation": triangles are emitted
+  greedily by the score of their vertices in a simulated LRU cache
+*/
+static float vertexScore(int cache_position, int remaining) {
+  if (remaining == 0)
+    return -1.0f;
+  float score = 0.0f;
+  if (cache_position >= 0) {
+    if (cache_position < 3) {
+      score = 0.75f;
+    } else {
+      float scaler = 1.0f / (VERTEX_CACHE_SIZE - 3);
+      score = powf(1.0f - (cache_position - 3) * scaler, 1.5f);
+    }
+  }
+  return score + 2.0f * powf((float)remaining, -0.5f);
+}
+
+static void optimizeVertexCache(std::vector<unsigned int> &indices,
+                                int num_vertices) {
+  int num_faces = indices.size() / 3;
+  std::vector<int> remaining(num_vertices, 0);
+  for (unsigned int index : indices)
+    remaining[index]++;
+
+  /* triangles adjacent to each vertex, compacted as they get emitted */
+  std::vector<int> offsets(num_vertices + 1, 0);
+  for (int i = 0; i < num_vertices; i++)
+    offsets[i + 1] = offsets[i] + remaining[i];
+  std::vector<int> adjacency(indices.size());
+  std::vector<int> fill(offsets.begin(), offsets.end() - 1);
+  for (int i = 0; i < (int)indices.size(); i++)
+    adjacency[fill[indices[i]]++] = i / 3;
+
+  std::vector<int> cache_position(num_vertices, -1);
+  std::vector<float> score(num_vertices);
+  for (int i = 0; i < num_vertices; i++)
+    score[i] = vertexScore(-1, remaining[i]);
+  std::vector<float> face_score(num_faces);
+  std::vector<char> emitted(num_faces, 0);
+  for (int f = 0; f < num_faces; f++)
+    face_score[f] = score[indices[f * 3]] + score[indices[f * 3 + 1]] +
+                    score[indices[f * 3 + 2]];
+
+  std::vector<unsigned int> result;
+  result.reserve(indices.size());
+  std::vector<int> cache, next_cache;
+  int best = -1;
+  int scan = 0;
+  for (int emitted_faces = 0; emitted_faces < num_faces; emitted_faces++) {
+    if (best < 0) {
+      /* nothing useful in the cache, restart from the next triangle in order */
+      while (emitted[scan])
+        scan++;
+      best = scan;
+    }
+
+    emitted[best] = 1;
+    next_cache.clear();
+    for (int k = 0; k < 3; k++) {
+      unsigned int v = indices[best * 3 + k];
+      result.push_back(v);
+      next_cache.push_back(v);
+      /* drop the triangle from the vertex adjacency */
+      int *begin = &adjacency[offsets[v]];
+      int *end = begin + remaining[v];
+      *std::find(begin, end, best) = *(end - 1);
+      remaining[v]--;
+    }
+    for (int v : cache) {
+      if (v != (int)result[result.size() - 3] &&
+          v != (int)result[result.size() - 2] &&
+          v != (int)result[result.size() - 1])
+        next_cache.push_back(v);
+    }
+    for (int v : cache)
+      cache_position[v] = -1;
+    for (int i = 0; i < (int)next_cache.size(); i++)
+      cache_position[next_cache[i]] = i < VERTEX_CACHE_SIZE ? i : -1;
+
+    /* rescore everything that was or is in the cache */
+    best = -1;
+    float best_score = -1.0f;
+    for (int v : next_cache) {
+      float old_score = score[v];
+      score[v] = vertexScore(cache_position[v], remaining[v]);
+      float delta = score[v] - old_score;
+      for (int j = 0; j < remaining[v]; j++) {
+        int f = adjacency[offsets[v] + j];
+        face_score[f] += delta;
+      }
+    }
+    for (int v : next_cache) {
+      if (cache_position[v] < 0)
+        continue;
+      for (int j = 0; j < remaining[v]; j++) {
+        int f = adjacency[offsets[v] + j];
+        if (face_score[f] > best_score) {
+          best_score = face_score[f];
+          best = f;
+        }
       }
-    } else if (strncmp(line, "# ext.tangent ", 14) == 0) { /* tangent */
-      glm::vec4 tangent;
-      items = sscanf(line, "# ext.tangent %f %f %f %f", &tangent.x, &tangent.y,
-                     &tangent.z, &tangent.w);
-      assert(items == 4);
-      tangents.push_back(tangent);
-    } else if (strncmp(line, "# ext.joint ", 12) == 0) { /* joint */
-      glm::vec4 joint;
-      items = sscanf(line, "# ext.joint %f %f %f %f", &joint.x, &joint.y,
-                     &joint.z, &joint.w);
-      assert(items == 4);
-      joints.push_back(joint);
-    } else if (strncmp(line, "# ext.weight ", 13) == 0) { /* weight */
-      glm::vec4 weight;
-      items = sscanf(line, "# ext.weight %f %f %f %f", &weight.x, &weight.y,
-                     &weight.z, &weight.w);
-      assert(items == 4);
-      weights.push_back(weight);
-    }
-  }
-  fclose(file);
-
-  mesh = buildMesh(positions, texcoords, normals, tangents, joints, weights,
-                      position_indices, texcoord_indices, normal_indices);
+    }
+
+    if (next_cache.size() > VERTEX_CACHE_SIZE)
+      next_cache.resize(VERTEX_CACHE_SIZE);
+    std::swap(cache, next_cache);
+  }
+
+  indices = std::move(result);
+}
+
+/* renumbers vertices in order of first use so fetches walk memory forward */
+static void optimizeVertexFetch(mesh_t *mesh) {
+  std::vector<unsigned int> remap(mesh->vertices.size(), UINT32_MAX);
+  std::vector<vertex_t> vertices;
+  vertices.reserve(mesh->vertices.size());
+  for (unsigned int &index : mesh->indices) {
+    if (remap[index] == UINT32_MAX) {
+      remap[index] = vertices.size();
+      vertices.push_back(mesh->vertices[index]);
+    }
+    index = remap[index];
+  }
+  mesh->vertices = std::move(vertices);
+}
+
+/* 12 floats per vertex, as uploaded by model_t::configBuffer */
+static size_t vertexBytes(size_t num_vertices) {
+  return num_vertices * 12 * sizeof(float);
+}
+
+static size_t indexBytes(size_t num_indices, size_t num_vertices) {
+  return num_indices *
+         (num_vertices <= 65536 ? sizeof(unsigned short) : sizeof(unsigned int));
+}
+
+static void optimizeMesh(std::string filename, mesh_t *mesh) {
+  size_t num_corners = mesh->vertices.size();
+  weldVertices(mesh);
+  int num_vertices = mesh->vertices.size();
+  float welded_acmr = computeACMR(mesh->indices, num_vertices);
+  optimizeVertexCache(mesh->indices, num_vertices);
+  optimizeVertexFetch(mesh);
+  float optimized_acmr = computeACMR(mesh->indices, num_vertices);
+
+  size_t before = vertexBytes(num_corners);
+  size_t after = vertexBytes(mesh->vertices.size()) +
+                 indexBytes(mesh->indices.size(), mesh->vertices.size());
+  if (VERBOSE_ASSETS)
+    printf("mesh %s: %d faces, %zu -> %zu vertices, ACMR 3.00 -> %.2f "
+           "(welded) -> %.2f (optimized), VRAM %.1f KB -> %.1f KB\n",
+           filename.c_str(), mesh->num_faces, num_corners,
+           mesh->vertices.size(), welded_acmr, optimized_acmr,
+           before / 1024.0, after / 1024.0);
+}
+
+/* changes whenever a field of vertex_t is added, removed or moved */
+static unsigned long long vertexLayout() {
+  size_t layout[] = {sizeof(vertex_t),
+                     offsetof(vertex_t, position),
+                     offsetof(vertex_t, texcoord),
+                     offsetof(vertex_t, normal),
+                     offsetof(vertex_t, tangent),
+                     offsetof(vertex_t, joint),
+                     offsetof(vertex_t, weight)};
+  return hashBytes(layout, sizeof(layout));
+}
+
+static mesh_t *loadMeshCache(std::string filename) {
+  long long mtime;
+  unsigned long long size;
+  if (!fileStamp(filename, &mtime, &size))
+    return NULL;
+
+  mapped_file_t file;
+  if (!file.open(filename + ".cache"))
+    return NULL;
+  if (file.size < sizeof(mesh_cache_header_t))
+    return NULL;
+
+  mesh_cache_header_t header;
+  memcpy(&header, file.data, sizeof(header));
+  if (header.magic != MESH_CACHE_MAGIC ||
+      header.version != MESH_CACHE_VERSION ||
+      header.layout != vertexLayout() || header.source_mtime != mtime ||
+      header.source_size != size)
+    return NULL;
+  size_t vertices_size = header.num_vertices * sizeof(vertex_t);
+  size_t indices_size = header.num_indices * sizeof(unsigned int);
+  if (file.size != sizeof(header) + vertices_size + indices_size)
+    return NULL;
 
+  const vertex_t *vertices = (const vertex_t *)(file.data + sizeof(header));
+  const unsigned int *indices =
+      (const unsigned int *)(file.data + sizeof(header) + vertices_size);
+  mesh_t *mesh = new mesh_t();
+  mesh->vertices.assign(vertices, vertices + header.num_vertices);
+  mesh->indices.assign(indices, indices + header.num_indices);
+  mesh->num_faces = header.num_faces;
+  mesh->bounds_min = glm::vec3(header.bounds_min[0], header.bounds_min[1],
+                                header.bounds_min[2]);
+  mesh->bounds_max = glm::vec3(header.bounds_max[0], header.bounds_max[1],
+                                header.bounds_max[2]);
   return mesh;
 }
 
+static void saveMeshCache(std::string filename, mesh_t *mesh) {
+  mesh_cache_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = MESH_CACHE_MAGIC;
+  header.version = MESH_CACHE_VERSION;
+  header.layout = vertexLayout();
+  if (!fileStamp(filename, &header.source_mtime, &header.source_size))
+    return;
+  header.num_vertices = mesh->vertices.size();
+  header.num_indices = mesh->indices.size();
+  header.num_faces = mesh->num_faces;
+  for (int i = 0; i < 3; i++) {
+    header.bounds_min[i] = mesh->bounds_min[i];
+    header.bounds_max[i] = mesh->bounds_max[i];
+  }
+
+  const void *chunks[] = {&header, mesh->vertices.data(), mesh->indices.data()};
+  size_t sizes[] = {sizeof(header), mesh->vertices.size() * sizeof(vertex_t),
+                    mesh->indices.size() * sizeof(unsigned int)};
+  if (!writeFileAtomic(filename + ".cache", chunks, sizes, 3))
+    std::cout << "Failed to write mesh cache: " << filename << std::endl;
+}
+
 mesh_t *loadMesh(std::string filename) {
   std::string extension = "";
   size_t last_dot = filename.find_last_of('.');
   if (last_dot != std::string::npos) {
     extension = filename.substr(last_dot + 1);
   }
-  if (extension == "obj")
-    return loadObj(filename);
-  else {
+  if (extension == "obj") {
+    mesh_t *mesh = loadMeshCache(filename);
+    if (mesh == NULL) {
+      mesh = loadObj(filename);
+      optimizeMesh(filename, mesh);
+      saveMeshCache(filename, mesh);
+    }
+    return mesh;
+  } else {
     assert(0);
     return NULL;
   }
 }
+
+mesh_t *mergeMeshes(const std::vector<const mesh_t *> &parts,
+                    const std::vector<glm::mat4> &transforms,
+                    std::vector<submesh_t> *ranges) {
+  mesh_t *merged = new mesh_t();
+  merged->num_faces = 0;
+  merged->bounds_min = glm::vec3(INFINITY);
+  merged->bounds_max = glm::vec3(-INFINITY);
+  size_t num_vertices = 0, num_indices = 0;
+  for (const mesh_t *part : parts) {
+    num_vertices += part->vertices.size();
+    num_indices += part->indices.size();
+  }
+  merged->vertices.reserve(num_vertices);
+  merged->indices.reserve(num_indices);
+  ranges->clear();
+
+  for (size_t i = 0; i < parts.size(); i++) {
+    const mesh_t *part = parts[i];
+    glm::mat4 transform = transforms[i];
+    glm::mat3 linear(transform);
+    glm::mat3 normal_matrix = glm::transpose(glm::inverse(linear));
+    /* a mirroring transform flips the winding and the bitangent */
+    bool mirrored = glm::determinant(linear) < 0.0f;
+
+    submesh_t range;
+    range.first_index = merged->indices.size();
+    range.index_count = part->indices.size();
+    range.bounds_min = glm::vec3(INFINITY);
+    range.bounds_max = glm::vec3(-INFINITY);
+    unsigned int base = merged->vertices.size();
+    for (vertex_t vertex : part->vertices) {
+      vertex.position = glm::vec3(transform * glm::vec4(vertex.position, 1.0f));
+      glm::vec3 normal = normal_matrix * vertex.normal;
+      if (glm::length(normal) > 0.0f)
+        vertex.normal = glm::normalize(normal);
+      glm::vec3 tangent = linear * glm::vec3(vertex.tangent);
+      if (glm::length(tangent) > 0.0f)
+        tangent = glm::normalize(tangent);
+      vertex.tangent = glm::vec4(tangent, mirrored ? -vertex.tangent.w
+                                                   : vertex.tangent.w);
+      range.bounds_min = glm::min(range.bounds_min, vertex.position);
+      range.bounds_max = glm::max(range.bounds_max, vertex.position);
+      merged->vertices.push_back(vertex);
+    }
+    for (size_t j = 0; j + 2 < part->indices.size(); j += 3) {
+      unsigned int a = part->indices[j], b = part->indices[j + 1];
+      if (mirrored)
+        std::swap(a, b);
+      merged->indices.push_back(base + a);
+      merged->indices.push_back(base + b);
+      merged->indices.push_back(base + part->indices[j + 2]);
+    }
+    merged->num_faces += part->num_faces;
+    merged->bounds_min = glm::min(merged->bounds_min, range.bounds_min);
+    merged->bounds_max = glm::max(merged->bounds_max, range.bounds_max);
+    ranges->push_back(range);
+  }
+  return merged;
+}
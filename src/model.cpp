@@ -1,27 +1,179 @@
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdio>
 #include <glad/glad.h>
+#include <gtc/packing.hpp>
 #include <iostream>
-#include <stb_image.h>
 #include <stb_image_write.h>
 
 #include "model.hpp"
+#include "profile.hpp"
 
-model_t::model_t(mesh_t *mesh, material_t *material, glm::mat4 transform) {
-  this->mesh = mesh;
+const char *const MATERIAL_FEATURE_DEFINES[MATERIAL_FEATURES] = {
+    "HAS_BASECOLOR_MAP", "HAS_ROUGHNESS_MAP", "HAS_METALNESS_MAP",
+    "HAS_OCCLUSION_MAP", "HAS_NORMAL_MAP",    "HAS_EMISSION_MAP"};
+
+model_t::model_t(mesh_buffer_t *buffer, material_t *material,
+                 glm::mat4 transform) {
+  this->buffer = buffer;
   this->material = material;
   this->transform = transform;
   this->basecolor_map = 0xfff;
-  this->metalness_map = 0xfff;
-  this->roughness_map = 0xfff;
+  this->rmo_map = 0xfff;
   this->normal_map = 0xfff;
-  this->occlusion_map = 0xfff;
   this->emission_map = 0xfff;
+}
+
+/* ids of released meshes, handed out again before new ones */
+static std::vector<unsigned int> free_mesh_ids;
+static unsigned int next_mesh_id = 1;
+
+mesh_buffer_t::mesh_buffer_t(mesh_t *mesh) {
+  this->mesh = mesh;
+  if (free_mesh_ids.empty()) {
+    this->id = next_mesh_id++;
+  } else {
+    this->id = free_mesh_ids.back();
+    free_mesh_ids.pop_back();
+  }
   configBuffer();
-  configTexture();
 }
 
-void model_t::configBuffer() {
-  glGenVertexArrays(1, &VAO);
-  glGenBuffers(1, &VBO);
+mesh_buffer_t::~mesh_buffer_t() {
+  geometry_arena_t &arena = geometryArena();
+  arena.releaseVertices(this->base_vertex, mesh->vertices.size());
+  arena.releaseIndices(this->first_index, this->index_count, indexSize());
+  free_mesh_ids.push_back(this->id);
+  delete this->mesh;
+}
+
+extern const bool QUANTIZE_VERTICES = true;
+
+class packed_vertex_t {
+public:
+  unsigned short position[4];
+  unsigned short texcoord[2];
+  short normal[2];
+  short tangent[2];
+};
+
+/* a model matrix, basecolor, position offset with metalness and position
+   scale with roughness per instance, see instance_data_t */
+static void configInstanceAttributes() {
+  for (int location = 4; location <= 10; location++) {
+    glEnableVertexAttribArray(location);
+    glVertexAttribDivisor(location, 1);
+  }
+}
+
+static void floatFormat() {
+  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 12 * sizeof(float), (void *)0);
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 12 * sizeof(float),
+                        (void *)(3 * sizeof(float)));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 12 * sizeof(float),
+                        (void *)(5 * sizeof(float)));
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 12 * sizeof(float),
+                        (void *)(8 * sizeof(float)));
+  glEnableVertexAttribArray(3);
+  configInstanceAttributes();
+}
+
+/* fed unnormalized so the shaders see the exact integers */
+static void quantizedFormat() {
+  glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_FALSE, sizeof(packed_vertex_t),
+                        (void *)offsetof(packed_vertex_t, position));
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(1, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(packed_vertex_t),
+                        (void *)offsetof(packed_vertex_t, texcoord));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(2, 2, GL_SHORT, GL_FALSE, sizeof(packed_vertex_t),
+                        (void *)offsetof(packed_vertex_t, normal));
+  glEnableVertexAttribArray(2);
+  glVertexAttribPointer(3, 2, GL_SHORT, GL_FALSE, sizeof(packed_vertex_t),
+                        (void *)offsetof(packed_vertex_t, tangent));
+  glEnableVertexAttribArray(3);
+  configInstanceAttributes();
+}
+
+geometry_arena_t &geometryArena() {
+  static geometry_arena_t arena(
+      QUANTIZE_VERTICES ? sizeof(packed_vertex_t) : 12 * sizeof(float),
+      QUANTIZE_VERTICES ? quantizedFormat : floatFormat);
+  return arena;
+}
+
+static glm::vec2 octEncode(glm::vec3 n) {
+  float length = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  if (length == 0.0f)
+    return glm::vec2(0.0f);
+  n /= length;
+  if (n.z < 0.0f) {
+    glm::vec2 folded = 1.0f - glm::abs(glm::vec2(n.y, n.x));
+    n.x = n.x >= 0.0f ? folded.x : -folded.x;
+    n.y = n.y >= 0.0f ? folded.y : -folded.y;
+  }
+  return glm::vec2(n.x, n.y);
+}
+
+/* mirrors octDecode in the vertex shaders */
+static glm::vec3 octDecode(glm::vec2 e) {
+  glm::vec3 n(e.x, e.y, 1.0f - std::abs(e.x) - std::abs(e.y));
+  float t = std::max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+  return glm::normalize(n);
+}
+
+static short quantizeSnorm(float v) {
+  return (short)std::lround(glm::clamp(v, -1.0f, 1.0f) * 32767.0f);
+}
+
+static float angleBetween(glm::vec3 a, glm::vec3 b) {
+  float la = glm::length(a), lb = glm::length(b);
+  if (la == 0.0f || lb == 0.0f)
+    return 0.0f;
+  float c = glm::clamp(glm::dot(a, b) / (la * lb), -1.0f, 1.0f);
+  return glm::degrees(std::acos(c));
+}
+
+void mesh_buffer_t::configBuffer() {
+  this->bounds_min = this->bounds_max = glm::vec3(0.0f);
+  if (!mesh->vertices.empty()) {
+    this->bounds_min = mesh->bounds_min;
+    this->bounds_max = mesh->bounds_max;
+  }
+
+  if (QUANTIZE_VERTICES)
+    configQuantizedBuffer();
+  else
+    configFloatBuffer();
+
+  /* 16-bit indices whenever the mesh is small enough, relative to the
+     base vertex */
+  geometry_arena_t &arena = geometryArena();
+  this->index_count = mesh->indices.size();
+  if (mesh->vertices.size() <= 65536) {
+    std::vector<unsigned short> indices(mesh->indices.begin(),
+                                        mesh->indices.end());
+    index_type = GL_UNSIGNED_SHORT;
+    this->first_index = arena.addIndices(indices.data(), indices.size(),
+                                         sizeof(unsigned short));
+  } else {
+    index_type = GL_UNSIGNED_INT;
+    this->first_index = arena.addIndices(
+        mesh->indices.data(), mesh->indices.size(), sizeof(unsigned int));
+  }
+  this->buffer_bytes += this->index_count * indexSize();
+}
+
+void mesh_buffer_t::configFloatBuffer() {
+  this->quantized = false;
+  this->position_offset = glm::vec3(0.0f);
+  this->position_scale = glm::vec3(1.0f);
   float *vertices = new float[mesh->vertices.size() * 12];
   for (int i = 0; i < mesh->vertices.size(); i++) {
     for (int j = 0; j < 3; j++) {
@@ -41,159 +193,126 @@ void model_t::configBuffer() {
       vertices[index] = mesh->vertices[i].tangent[j - 8];
     }
   }
-  glBindVertexArray(VAO);
-  glBindBuffer(GL_ARRAY_BUFFER, VBO);
-  glBufferData(GL_ARRAY_BUFFER, mesh->vertices.size() * 12 * sizeof(float),
-               vertices, GL_STATIC_DRAW);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 12 * sizeof(float), (void *)0);
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 12 * sizeof(float),
-                        (void *)(3 * sizeof(float)));
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, 12 * sizeof(float),
-                        (void *)(5 * sizeof(float)));
-  glEnableVertexAttribArray(2);
-  glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, 12 * sizeof(float),
-                        (void *)(8 * sizeof(float)));
-  glEnableVertexAttribArray(3);
-  glBindVertexArray(0);
-}
-
-void model_t::configTexture() {
-  if (material->basecolor_map != "null") {
-    glGenTextures(1, &this->basecolor_map);
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(1);
-    unsigned char *data = stbi_load(material->basecolor_map.c_str(), &width,
-                                    &height, &nrChannels, 0);
-    glBindTexture(GL_TEXTURE_2D, this->basecolor_map);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-                 GL_UNSIGNED_BYTE, data);
-    stbi_image_free(data);
-    material->basecolor_factor = glm::vec4(-1.0);
-  }
-  if (material->metalness_map != "null") {
-    glGenTextures(1, &this->metalness_map);
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(1);
-    unsigned char *data = stbi_load(material->metalness_map.c_str(), &width,
-                                    &height, &nrChannels, 0);
-    glBindTexture(GL_TEXTURE_2D, this->metalness_map);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, width, height, 0, GL_RED,
-                 GL_UNSIGNED_BYTE, data);
-    stbi_image_free(data);
-    material->metalness_factor = -1.0;
-  }
-  if (material->roughness_map != "null") {
-    glGenTextures(1, &this->roughness_map);
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(1);
-    unsigned char *data = stbi_load(material->roughness_map.c_str(), &width,
-                                    &height, &nrChannels, 0);
-    glBindTexture(GL_TEXTURE_2D, this->roughness_map);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, width, height, 0, GL_RED,
-                 GL_UNSIGNED_BYTE, data);
-    stbi_image_free(data);
-    material->roughness_factor = -1.0;
-  }
-  if (material->normal_map != "null") {
-    glGenTextures(1, &this->normal_map);
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(1);
-    unsigned char *data = stbi_load(material->normal_map.c_str(), &width,
-                                    &height, &nrChannels, 0);
-    glBindTexture(GL_TEXTURE_2D, this->normal_map);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-                 GL_UNSIGNED_BYTE, data);
-    stbi_image_free(data);
-  }
-  if (material->occlusion_map != "null") {
-    glGenTextures(1, &this->occlusion_map);
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(1);
-    unsigned char *data = stbi_load(material->occlusion_map.c_str(), &width,
-                                    &height, &nrChannels, 0);
-    glBindTexture(GL_TEXTURE_2D, this->occlusion_map);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RED, width, height, 0, GL_RED,
-                 GL_UNSIGNED_BYTE, data);
-    stbi_image_free(data);
-  }
-  if (material->emission_map != "null") {
-    glGenTextures(1, &this->emission_map);
-    int width, height, nrChannels;
-    stbi_set_flip_vertically_on_load(1);
-    unsigned char *data = stbi_load(material->emission_map.c_str(), &width,
-                                    &height, &nrChannels, 0);
-    glBindTexture(GL_TEXTURE_2D, this->emission_map);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-                 GL_UNSIGNED_BYTE, data);
-    stbi_image_free(data);
-  }
+  this->buffer_bytes = mesh->vertices.size() * 12 * sizeof(float);
+  this->base_vertex =
+      geometryArena().addVertices(vertices, mesh->vertices.size());
+  delete[] vertices;
 }
 
-void model_t::draw() {
-  if(this->basecolor_map < 0xfff){
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, this->basecolor_map); 
-  }
-  if(this->metalness_map < 0xfff){
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, this->metalness_map);
-  }
-  if(this->roughness_map < 0xfff){
-    glActiveTexture(GL_TEXTURE2);
-    glBindTexture(GL_TEXTURE_2D, this->roughness_map);
-  }
-  if(this->normal_map < 0xfff){
-    glActiveTexture(GL_TEXTURE3);
-    glBindTexture(GL_TEXTURE_2D, this->normal_map);
+/*
+  20 bytes per vertex instead of 48:
+  position  3 x u16 relative to the mesh bounds (+ 1 pad)
+  texcoord  2 x f16
+  normal    2 x s16 octahedral
+  tangent   2 x s16 octahedral, handedness in the low bit of y
+  see quantizedFormat for the attributes
+*/
+void mesh_buffer_t::configQuantizedBuffer() {
+  this->quantized = true;
+  glm::vec3 lower = this->bounds_min, upper = this->bounds_max;
+  this->position_offset = lower;
+  this->position_scale = (upper - lower) / 65535.0f;
+
+  float position_error = 0.0f, texcoord_error = 0.0f;
+  float normal_error = 0.0f, tangent_error = 0.0f;
+  int sign_errors = 0;
+  std::vector<packed_vertex_t> vertices(mesh->vertices.size());
+  for (int i = 0; i < mesh->vertices.size(); i++) {
+    const vertex_t &vertex = mesh->vertices[i];
+    packed_vertex_t &packed = vertices[i];
+
+    glm::vec3 position;
+    for (int j = 0; j < 3; j++) {
+      float extent = upper[j] - lower[j];
+      float t = extent > 0.0f ? (vertex.position[j] - lower[j]) / extent : 0.0f;
+      packed.position[j] = (unsigned short)std::lround(glm::clamp(t, 0.0f, 1.0f) * 65535.0f);
+      position[j] = lower[j] + packed.position[j] * this->position_scale[j];
+    }
+    packed.position[3] = 0;
+    position_error = std::max(position_error, glm::length(position - vertex.position));
+
+    for (int j = 0; j < 2; j++) {
+      packed.texcoord[j] = glm::packHalf1x16(vertex.texcoord[j]);
+      texcoord_error = std::max(texcoord_error,
+          std::abs(glm::unpackHalf1x16(packed.texcoord[j]) - vertex.texcoord[j]));
+    }
+
+    glm::vec2 normal = octEncode(vertex.normal);
+    packed.normal[0] = quantizeSnorm(normal.x);
+    packed.normal[1] = quantizeSnorm(normal.y);
+    glm::vec3 decoded_normal =
+        octDecode(glm::vec2(packed.normal[0], packed.normal[1]) / 32767.0f);
+    normal_error = std::max(normal_error, angleBetween(decoded_normal, vertex.normal));
+
+    glm::vec3 tangent(vertex.tangent);
+    glm::vec2 encoded = octEncode(tangent);
+    packed.tangent[0] = quantizeSnorm(encoded.x);
+    packed.tangent[1] = (quantizeSnorm(encoded.y) & ~1) | (vertex.tangent.w < 0.0f);
+    glm::vec3 decoded_tangent =
+        octDecode(glm::vec2(packed.tangent[0], packed.tangent[1] & ~1) / 32767.0f);
+    tangent_error = std::max(tangent_error, angleBetween(decoded_tangent, tangent));
+    if ((packed.tangent[1] & 1) != (vertex.tangent.w < 0.0f))
+      sign_errors++;
   }
-  if(this->occlusion_map < 0xfff){
-    glActiveTexture(GL_TEXTURE4);
-    glBindTexture(GL_TEXTURE_2D, this->occlusion_map);
+
+  this->buffer_bytes = vertices.size() * sizeof(packed_vertex_t);
+  this->base_vertex =
+      geometryArena().addVertices(vertices.data(), vertices.size());
+
+  if (!VERBOSE_ASSETS)
+    return;
+  float diagonal = glm::length(upper - lower);
+  printf("quantized %zu vertices, %d -> %zu bytes/vertex, max error: position "
+         "%.2e (%.4f%% of bounds), uv %.2e, normal %.3f deg, tangent %.3f deg, "
+         "%d handedness flips\n",
+         vertices.size(), (int)(12 * sizeof(float)), sizeof(packed_vertex_t),
+         position_error, diagonal > 0.0f ? 100.0f * position_error / diagonal : 0.0f,
+         texcoord_error, normal_error, tangent_error, sign_errors);
+}
+
+unsigned int model_t::features() const {
+  unsigned int features = 0;
+  if (this->basecolor_map < 0xfff)
+    features |= FEATURE_BASECOLOR_MAP;
+  /* the packed map has every channel, only those with a source count */
+  if (this->rmo_map < 0xfff) {
+    if (material->roughness_map != "null")
+      features |= FEATURE_ROUGHNESS_MAP;
+    if (material->metalness_map != "null")
+      features |= FEATURE_METALNESS_MAP;
+    if (material->occlusion_map != "null")
+      features |= FEATURE_OCCLUSION_MAP;
   }
-  if(this->emission_map < 0xfff){
-    glActiveTexture(GL_TEXTURE5);
-    glBindTexture(GL_TEXTURE_2D, this->emission_map);
+  if (this->normal_map < 0xfff)
+    features |= FEATURE_NORMAL_MAP;
+  if (this->emission_map < 0xfff)
+    features |= FEATURE_EMISSION_MAP;
+  return features;
+}
+
+unsigned int materialFeatures(const material_t *material) {
+  const std::string *maps[] = {
+      &material->basecolor_map, &material->roughness_map,
+      &material->metalness_map, &material->occlusion_map,
+      &material->normal_map,    &material->emission_map};
+  unsigned int features = 0;
+  for (int i = 0; i < MATERIAL_FEATURES; i++) {
+    if (*maps[i] != "null")
+      features |= 1u << i;
   }
+  return features;
+}
+
+void mesh_buffer_t::draw(int instances, unsigned int first_index,
+                         unsigned int index_count) const {
+  glDrawElementsInstancedBaseVertex(
+      GL_TRIANGLES, index_count, index_type,
+      (void *)((this->first_index + first_index) * indexSize()), instances,
+      this->base_vertex);
+}
 
-  glBindVertexArray(VAO);
-  glDrawArrays(GL_TRIANGLES, 0, 3 * mesh->num_faces);
+size_t mesh_buffer_t::indexSize() const {
+  return index_type == GL_UNSIGNED_SHORT ? sizeof(unsigned short)
+                                         : sizeof(unsigned int);
 }
 
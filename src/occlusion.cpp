@@ -0,0 +1,248 @@
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <cmath>
+#include <glad/glad.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "occlusion.hpp"
+#include "pool.hpp"
+#include "profile.hpp"
+#include "state.hpp"
+
+/* rows of the buffer one job clears and rasterizes */
+#define OCCLUSION_BAND_ROWS 16
+
+occlusion_buffer_t::occlusion_buffer_t() {
+  this->width = 0;
+  this->height = 0;
+  this->debug_texture = 0;
+  this->world_to_clip = glm::mat4(1.0f);
+}
+
+occlusion_buffer_t::~occlusion_buffer_t() {
+  if (this->debug_texture != 0)
+    glDeleteTextures(1, &this->debug_texture);
+}
+
+void occlusion_buffer_t::config(int width, int height) {
+  assert(width % 4 == 0 && height > 0);
+  this->width = width;
+  this->height = height;
+  this->depth.assign((size_t)width * height, 0.0f);
+
+  glGenTextures(1, &this->debug_texture);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->debug_texture);
+  glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, width, height, 0, GL_RED, GL_FLOAT,
+               this->depth.data());
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+}
+
+void occlusion_buffer_t::setup(const occluder_t &occluder,
+                               std::vector<occluder_triangle_t> *out) {
+  out->clear();
+  const mesh_t *mesh = occluder.mesh;
+  glm::mat4 model_to_clip = this->world_to_clip * occluder.transform;
+  size_t begin = occluder.first_index;
+  size_t end = begin + occluder.index_count;
+
+  /* only the vertices the range uses, a submesh's are contiguous */
+  unsigned int first_vertex = UINT_MAX, last_vertex = 0;
+  for (size_t i = begin; i < end; i++) {
+    first_vertex = std::min(first_vertex, mesh->indices[i]);
+    last_vertex = std::max(last_vertex, mesh->indices[i]);
+  }
+  if (first_vertex > last_vertex)
+    return;
+  std::vector<glm::vec4> clip(last_vertex - first_vertex + 1);
+  for (size_t i = 0; i < clip.size(); i++)
+    clip[i] = model_to_clip *
+              glm::vec4(mesh->vertices[first_vertex + i].position, 1.0f);
+
+  for (size_t i = begin; i + 2 < end; i += 3) {
+    /* x and y in pixels, z the 1 / w that interpolates linearly */
+    glm::vec3 screen[3];
+    bool clipped = false;
+    for (int k = 0; k < 3 && !clipped; k++) {
+      const glm::vec4 &vertex = clip[mesh->indices[i + k] - first_vertex];
+      clipped = vertex.z < -vertex.w;
+      float inv_w = 1.0f / vertex.w;
+      screen[k] = glm::vec3((vertex.x * inv_w * 0.5f + 0.5f) * this->width,
+                            (vertex.y * inv_w * 0.5f + 0.5f) * this->height,
+                            inv_w);
+    }
+    if (clipped)
+      continue;
+
+    /* counter-clockwise is front facing, as in GL */
+    const glm::vec3 &p0 = screen[0], &p1 = screen[1], &p2 = screen[2];
+    float area = (p1.x - p0.x) * (p2.y - p0.y) - (p2.x - p0.x) * (p1.y - p0.y);
+    if (!(area > 0.0f))
+      continue;
+
+    float min_x = std::max(std::min({p0.x, p1.x, p2.x}), 0.0f);
+    float max_x = std::min(std::max({p0.x, p1.x, p2.x}), (float)this->width);
+    float min_y = std::max(std::min({p0.y, p1.y, p2.y}), 0.0f);
+    float max_y = std::min(std::max({p0.y, p1.y, p2.y}), (float)this->height);
+    occluder_triangle_t triangle;
+    triangle.min_x = (int)std::floor(min_x) & ~3;
+    triangle.max_x = (int)std::ceil(max_x);
+    triangle.min_y = (int)std::floor(min_y);
+    triangle.max_y = (int)std::ceil(max_y);
+    if (triangle.min_x >= triangle.max_x || triangle.min_y >= triangle.max_y)
+      continue;
+
+    /* edge e runs from vertex e to the next, and weighs the vertex
+       across from it */
+    for (int e = 0; e < 3; e++) {
+      const glm::vec3 &a = screen[e], &b = screen[(e + 1) % 3];
+      triangle.edge_a[e] = a.y - b.y;
+      triangle.edge_b[e] = b.x - a.x;
+      triangle.edge_c[e] = a.x * b.y - b.x * a.y;
+    }
+    float weight = 1.0f / area;
+    triangle.depth_a = (triangle.edge_a[1] * p0.z + triangle.edge_a[2] * p1.z +
+                        triangle.edge_a[0] * p2.z) * weight;
+    triangle.depth_b = (triangle.edge_b[1] * p0.z + triangle.edge_b[2] * p1.z +
+                        triangle.edge_b[0] * p2.z) * weight;
+    triangle.depth_c = (triangle.edge_c[1] * p0.z + triangle.edge_c[2] * p1.z +
+                        triangle.edge_c[0] * p2.z) * weight;
+    out->push_back(triangle);
+  }
+}
+
+void occlusion_buffer_t::rasterRows(int row_begin, int row_end) {
+  std::fill(this->depth.begin() + (size_t)row_begin * this->width,
+            this->depth.begin() + (size_t)row_end * this->width, 0.0f);
+  for (const std::vector<occluder_triangle_t> &occluder : this->triangles) {
+    for (const occluder_triangle_t &triangle : occluder) {
+      int y_begin = std::max(triangle.min_y, row_begin);
+      int y_end = std::min(triangle.max_y, row_end);
+      for (int y = y_begin; y < y_end; y++) {
+        float center_y = y + 0.5f;
+        float *row = &this->depth[(size_t)y * this->width];
+#ifdef __SSE2__
+        const __m128 zero = _mm_setzero_ps();
+        const __m128 centers = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+        __m128 edge_a[3], edge_row[3];
+        for (int e = 0; e < 3; e++) {
+          edge_a[e] = _mm_set1_ps(triangle.edge_a[e]);
+          edge_row[e] = _mm_set1_ps(triangle.edge_b[e] * center_y +
+                                    triangle.edge_c[e]);
+        }
+        __m128 depth_a = _mm_set1_ps(triangle.depth_a);
+        __m128 depth_row =
+            _mm_set1_ps(triangle.depth_b * center_y + triangle.depth_c);
+        for (int x = triangle.min_x; x < triangle.max_x; x += 4) {
+          __m128 center_x = _mm_add_ps(_mm_set1_ps((float)x), centers);
+          __m128 inside = _mm_cmpge_ps(
+              _mm_add_ps(_mm_mul_ps(edge_a[0], center_x), edge_row[0]), zero);
+          for (int e = 1; e < 3; e++)
+            inside = _mm_and_ps(
+                inside, _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(edge_a[e], center_x),
+                                                edge_row[e]),
+                                     zero));
+          if (_mm_movemask_ps(inside) == 0)
+            continue;
+          __m128 depth = _mm_add_ps(_mm_mul_ps(depth_a, center_x), depth_row);
+          __m128 old = _mm_loadu_ps(row + x);
+          __m128 nearest = _mm_max_ps(old, depth);
+          _mm_storeu_ps(row + x, _mm_or_ps(_mm_and_ps(inside, nearest),
+                                           _mm_andnot_ps(inside, old)));
+        }
+#else
+        for (int x = triangle.min_x; x < triangle.max_x; x++) {
+          float center_x = x + 0.5f;
+          bool inside = true;
+          for (int e = 0; e < 3; e++)
+            inside = inside && triangle.edge_a[e] * center_x +
+                                       triangle.edge_b[e] * center_y +
+                                       triangle.edge_c[e] >=
+                                   0.0f;
+          if (!inside)
+            continue;
+          float depth = triangle.depth_a * center_x +
+                        triangle.depth_b * center_y + triangle.depth_c;
+          row[x] = std::max(row[x], depth);
+        }
+#endif
+      }
+    }
+  }
+}
+
+void occlusion_buffer_t::render(const std::vector<occluder_t> &occluders,
+                                const glm::mat4 &world_to_clip) {
+  stopwatch_t watch;
+  this->stats = occlusion_stats_t();
+  this->world_to_clip = world_to_clip;
+  this->triangles.resize(occluders.size());
+  parallelFor((int)occluders.size(),
+              [&](int i) { setup(occluders[i], &this->triangles[i]); });
+  int bands = (this->height + OCCLUSION_BAND_ROWS - 1) / OCCLUSION_BAND_ROWS;
+  parallelFor(bands, [&](int band) {
+    rasterRows(band * OCCLUSION_BAND_ROWS,
+               std::min((band + 1) * OCCLUSION_BAND_ROWS, this->height));
+  });
+
+  this->stats.occluders = (int)occluders.size();
+  for (const std::vector<occluder_triangle_t> &occluder : this->triangles)
+    this->stats.triangles += (int)occluder.size();
+  this->stats.raster_ms = watch.ms();
+}
+
+bool occlusion_buffer_t::visible(const glm::vec3 &world_min,
+                                 const glm::vec3 &world_max) const {
+  /* the box's screen rectangle and the 1 / w of its nearest corner */
+  glm::vec2 rect_min(INFINITY), rect_max(-INFINITY);
+  float nearest = 0.0f;
+  for (int corner = 0; corner < 8; corner++) {
+    glm::vec3 position(corner & 1 ? world_max.x : world_min.x,
+                       corner & 2 ? world_max.y : world_min.y,
+                       corner & 4 ? world_max.z : world_min.z);
+    glm::vec4 clip = this->world_to_clip * glm::vec4(position, 1.0f);
+    if (clip.z < -clip.w)
+      return true;
+    float inv_w = 1.0f / clip.w;
+    glm::vec2 screen((clip.x * inv_w * 0.5f + 0.5f) * this->width,
+                     (clip.y * inv_w * 0.5f + 0.5f) * this->height);
+    rect_min = glm::min(rect_min, screen);
+    rect_max = glm::max(rect_max, screen);
+    nearest = std::max(nearest, inv_w);
+  }
+
+  /* widened to whole groups of four, which only keeps more */
+  int x_begin = (int)std::floor(std::max(rect_min.x, 0.0f)) & ~3;
+  int x_end = (int)std::ceil(std::min(rect_max.x, (float)this->width));
+  int y_begin = (int)std::floor(std::max(rect_min.y, 0.0f));
+  int y_end = (int)std::ceil(std::min(rect_max.y, (float)this->height));
+  if (x_begin >= x_end || y_begin >= y_end)
+    return true;
+  for (int y = y_begin; y < y_end; y++) {
+    const float *row = &this->depth[(size_t)y * this->width];
+#ifdef __SSE2__
+    __m128 box = _mm_set1_ps(nearest);
+    for (int x = x_begin; x < x_end; x += 4) {
+      if (_mm_movemask_ps(_mm_cmple_ps(_mm_loadu_ps(row + x), box)) != 0)
+        return true;
+    }
+#else
+    for (int x = x_begin; x < x_end; x++) {
+      if (row[x] <= nearest)
+        return true;
+    }
+#endif
+  }
+  return false;
+}
+
+void occlusion_buffer_t::uploadDebug() {
+  glState().bindTexture(0, GL_TEXTURE_2D, this->debug_texture);
+  glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, this->width, this->height, GL_RED,
+                  GL_FLOAT, this->depth.data());
+}
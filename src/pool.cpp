@@ -0,0 +1,86 @@
+#include <algorithm>
+#include <atomic>
+
+#include "pool.hpp"
+
+static thread_local bool is_worker = false;
+
+pool_t::pool_t(int num_threads) {
+  this->stopping = false;
+  for (int i = 0; i < std::max(1, num_threads); i++)
+    this->workers.emplace_back(&pool_t::run, this);
+}
+
+pool_t::~pool_t() {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->stopping = true;
+  }
+  this->wake.notify_all();
+  for (std::thread &worker : this->workers)
+    worker.join();
+}
+
+int pool_t::size() const { return (int)this->workers.size(); }
+
+void pool_t::push(std::function<void()> job) {
+  {
+    std::lock_guard<std::mutex> lock(this->mutex);
+    this->jobs.push_back(std::move(job));
+  }
+  this->wake.notify_one();
+}
+
+void pool_t::run() {
+  is_worker = true;
+  for (;;) {
+    std::function<void()> job;
+    {
+      std::unique_lock<std::mutex> lock(this->mutex);
+      this->wake.wait(lock,
+                      [this]() { return this->stopping || !this->jobs.empty(); });
+      if (this->jobs.empty())
+        return;
+      job = std::move(this->jobs.front());
+      this->jobs.pop_front();
+    }
+    job();
+  }
+}
+
+pool_t &workerPool() {
+  static pool_t pool((int)std::thread::hardware_concurrency());
+  return pool;
+}
+
+bool onWorkerThread() { return is_worker; }
+
+/* outlives the call, for helpers that start after every index is taken */
+class parallel_for_t {
+public:
+  std::atomic<int> next{0};
+  std::atomic<int> done{0};
+  int count;
+  const std::function<void(int)> *job;
+};
+
+static void drain(parallel_for_t *state) {
+  for (int i; (i = state->next++) < state->count;) {
+    (*state->job)(i);
+    state->done++;
+  }
+}
+
+int parallelism() { return onWorkerThread() ? 1 : workerPool().size() + 1; }
+
+void parallelFor(int count, const std::function<void(int)> &job) {
+  auto state = std::make_shared<parallel_for_t>();
+  state->count = count;
+  state->job = &job;
+  int helpers = std::min(parallelism() - 1, count - 1);
+  for (int i = 0; i < helpers; i++)
+    workerPool().submit([state]() { drain(state.get()); });
+  drain(state.get());
+  while (state->done.load() < count)
+    std::this_thread::yield();
+}
@@ -0,0 +1,54 @@
+#include "profile.hpp"
+
+stopwatch_t::stopwatch_t() { reset(); }
+
+void stopwatch_t::reset() { this->start = std::chrono::steady_clock::now(); }
+
+double stopwatch_t::ms() const {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - this->start)
+      .count();
+}
+
+gpu_timer_t::gpu_timer_t() {
+  this->last_ms = 0.0;
+  this->total_ms = 0.0;
+  this->samples = 0;
+  this->next = 0;
+  this->created = false;
+  for (int i = 0; i < GPU_TIMER_QUERIES; i++)
+    this->pending[i] = false;
+}
+
+gpu_timer_t::~gpu_timer_t() {
+  if (this->created)
+    glDeleteQueries(GPU_TIMER_QUERIES, this->queries);
+}
+
+void gpu_timer_t::begin() {
+  if (!this->created) {
+    glGenQueries(GPU_TIMER_QUERIES, this->queries);
+    this->created = true;
+  }
+  /* collect the oldest query before reusing it */
+  unsigned int query = this->queries[this->next];
+  if (this->pending[this->next]) {
+    GLuint64 elapsed = 0;
+    glGetQueryObjectui64v(query, GL_QUERY_RESULT, &elapsed);
+    this->last_ms = elapsed / 1000000.0;
+    this->total_ms += this->last_ms;
+    this->samples++;
+    this->pending[this->next] = false;
+  }
+  glBeginQuery(GL_TIME_ELAPSED, query);
+}
+
+void gpu_timer_t::end() {
+  glEndQuery(GL_TIME_ELAPSED);
+  this->pending[this->next] = true;
+  this->next = (this->next + 1) % GPU_TIMER_QUERIES;
+}
+
+double gpu_timer_t::averageMs() const {
+  return this->samples > 0 ? this->total_ms / this->samples : 0.0;
+}
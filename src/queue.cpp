@@ -0,0 +1,326 @@
+#include <algorithm>
+#include <cassert>
+#include <glad/glad.h>
+
+#include "profile.hpp"
+#include "queue.hpp"
+#include "state.hpp"
+
+#define SORT_PASS_SHIFT (64 - SORT_PASS_BITS)
+#define SORT_PROGRAM_SHIFT (SORT_PASS_SHIFT - SORT_PROGRAM_BITS)
+
+static_assert(SORT_PASS_BITS + SORT_PROGRAM_BITS + SORT_MATERIAL_BITS +
+                      SORT_MESH_BITS + SORT_DEPTH_BITS ==
+                  64,
+              "sort key fields fill 64 bits");
+
+static unsigned long long field(unsigned long long value, int bits) {
+  return value & ((1ull << bits) - 1);
+}
+
+/* the units the material maps are bound to, see linkGeometryProgram */
+static void modelMaps(const model_t *model, unsigned int *maps) {
+  maps[0] = model->basecolor_map;
+  maps[1] = model->rmo_map;
+  maps[2] = model->normal_map;
+  maps[3] = model->emission_map;
+}
+
+/* attributes 4 to 10 at the instance_data_t records from offset on, each
+   a vec4 in order */
+static void pointInstances(size_t offset) {
+  for (int location = 4; location <= 10; location++)
+    glVertexAttribPointer(location, 4, GL_FLOAT, GL_FALSE,
+                          sizeof(instance_data_t),
+                          (void *)(offset + (location - 4) * sizeof(glm::vec4)));
+}
+
+/* passes drawn from the camera, the ones culling applies to */
+static bool cameraPass(Render_Pass pass) { return pass != PASS_SHADOW; }
+
+render_queue_t::render_queue_t() {
+  this->front_to_back = true;
+  this->multi_draw = false;
+  this->gpu_culling = false;
+  this->culled_instances = 0;
+  clear();
+}
+
+void render_queue_t::clear() {
+  this->items.clear();
+  this->batches.clear();
+  this->sorted = queue_stats_t();
+  this->unsorted = queue_stats_t();
+  for (unsigned int &program : this->last_program)
+    program = ~0u;
+}
+
+void render_queue_t::push(Render_Pass pass, int index, const model_t *model,
+                          unsigned int first_index, unsigned int index_count,
+                          unsigned int program, float depth) {
+  /* a wider id would alias another material or mesh in the key */
+  assert(model->material->index < (1u << SORT_MATERIAL_BITS));
+  assert(model->buffer->id < (1u << SORT_MESH_BITS));
+  assert(program < (1u << SORT_PROGRAM_BITS));
+  unsigned long long material = field(model->material->index, SORT_MATERIAL_BITS);
+  unsigned long long mesh = field(model->buffer->id, SORT_MESH_BITS);
+  float clamped = std::min(std::max(depth, 0.0f), 1.0f);
+  unsigned long long quantized =
+      (unsigned long long)(clamped * ((1 << SORT_DEPTH_BITS) - 1));
+
+  /* depth last, so equal material and mesh stay together as a batch */
+  unsigned long long key = (unsigned long long)pass << SORT_PASS_SHIFT;
+  key |= field(program, SORT_PROGRAM_BITS) << SORT_PROGRAM_SHIFT;
+  key |= material << (SORT_MESH_BITS + SORT_DEPTH_BITS);
+  key |= mesh << SORT_DEPTH_BITS;
+  key |= quantized;
+  this->items.push_back({key, index, model->buffer, first_index, index_count});
+
+  /* what a model order loop does: every map and the VAO on every draw */
+  this->unsorted.draws++;
+  if (program != this->last_program[pass])
+    this->unsorted.programs++;
+  this->last_program[pass] = program;
+  unsigned int maps[4];
+  modelMaps(model, maps);
+  for (unsigned int map : maps) {
+    if (map < 0xfff)
+      this->unsorted.textures++;
+  }
+  this->unsorted.meshes++;
+}
+
+/* least significant byte first, skipping bytes every key shares */
+template <typename T>
+static void radixSort(std::vector<T> &items, std::vector<T> &scratch) {
+  size_t count = items.size();
+  scratch.resize(count);
+  T *src = items.data();
+  T *dst = scratch.data();
+  for (int shift = 0; shift < 64; shift += 8) {
+    size_t offsets[256] = {0};
+    for (size_t i = 0; i < count; i++)
+      offsets[(src[i].key >> shift) & 0xff]++;
+    if (count == 0 || offsets[(src[0].key >> shift) & 0xff] == count)
+      continue;
+    size_t total = 0;
+    for (size_t &offset : offsets) {
+      size_t bucket = offset;
+      offset = total;
+      total += bucket;
+    }
+    for (size_t i = 0; i < count; i++)
+      dst[offsets[(src[i].key >> shift) & 0xff]++] = src[i];
+    std::swap(src, dst);
+  }
+  if (src != items.data())
+    std::copy(src, src + count, items.data());
+}
+
+void render_queue_t::sort() {
+  radixSort(this->items, this->item_scratch);
+
+  /* the first item of a run is its nearest, its depth orders the batch */
+  this->batches.clear();
+  for (int i = 0; i < (int)this->items.size();) {
+    unsigned long long group = this->items[i].key >> SORT_DEPTH_BITS;
+    int end = i + 1;
+    while (end < (int)this->items.size() &&
+           (this->items[end].key >> SORT_DEPTH_BITS) == group &&
+           this->items[end].buffer == this->items[i].buffer &&
+           this->items[end].first_index == this->items[i].first_index &&
+           this->items[end].index_count == this->items[i].index_count)
+      end++;
+    unsigned long long key = this->items[i].key;
+    if (this->front_to_back) {
+      unsigned long long depth = field(key, SORT_DEPTH_BITS);
+      unsigned long long state =
+          field(key >> SORT_DEPTH_BITS, SORT_MATERIAL_BITS + SORT_MESH_BITS);
+      key = (key >> SORT_PROGRAM_SHIFT) << SORT_PROGRAM_SHIFT;
+      key |= depth << (SORT_MATERIAL_BITS + SORT_MESH_BITS);
+      key |= state;
+    }
+    this->batches.push_back({key, i, end - i});
+    i = end;
+  }
+  radixSort(this->batches, this->batch_scratch);
+}
+
+/* the range of sorted entries whose keys start with pass */
+template <typename T>
+static void passRange(const std::vector<T> &entries, Render_Pass pass,
+                      int *first, int *count) {
+  auto before = [](const T &entry, unsigned long long key) {
+    return entry.key < key;
+  };
+  unsigned long long key = (unsigned long long)pass << SORT_PASS_SHIFT;
+  auto begin = std::lower_bound(entries.begin(), entries.end(), key, before);
+  auto end = std::lower_bound(begin, entries.end(),
+                              key + (1ull << SORT_PASS_SHIFT), before);
+  *first = (int)(begin - entries.begin());
+  *count = (int)(end - begin);
+}
+
+void render_queue_t::passItems(Render_Pass pass, int *first,
+                               int *count) const {
+  passRange(this->items, pass, first, count);
+}
+
+void render_queue_t::passBatches(Render_Pass pass, int *first,
+                                 int *count) const {
+  passRange(this->batches, pass, first, count);
+}
+
+void render_queue_t::upload(uniform_ring_t *instances,
+                            uniform_ring_t *commands, uniform_ring_t *objects,
+                            const std::vector<model_t *> &models) {
+  instances->map((int)this->items.size());
+  for (int i = 0; i < (int)this->items.size(); i++) {
+    const model_t *model = models[this->items[i].model];
+    const mesh_buffer_t *buffer = model->buffer;
+    instance_data_t instance;
+    instance.model = model->transform;
+    instance.basecolor = model->material->basecolor_factor;
+    instance.offset_metalness =
+        glm::vec4(buffer->position_offset, model->material->metalness_factor);
+    instance.scale_roughness =
+        glm::vec4(buffer->position_scale, model->material->roughness_factor);
+    instances->write(i, &instance);
+  }
+  instances->unmap();
+  if (!this->multi_draw)
+    return;
+
+  commands->map((int)this->batches.size());
+  for (int i = 0; i < (int)this->batches.size(); i++) {
+    const render_batch_t &batch = this->batches[i];
+    const render_item_t &item = this->items[batch.first];
+    const mesh_buffer_t *buffer = item.buffer;
+    /* the cull shader counts the instances of the camera passes */
+    bool culled = this->gpu_culling &&
+                  cameraPass((Render_Pass)(batch.key >> SORT_PASS_SHIFT));
+    draw_command_t command;
+    command.count = item.index_count;
+    command.instance_count = culled ? 0 : batch.count;
+    command.first_index = buffer->first_index + item.first_index;
+    command.base_vertex = buffer->base_vertex;
+    command.base_instance = batch.first;
+    commands->write(i, &command);
+  }
+  commands->unmap();
+  if (!this->gpu_culling)
+    return;
+
+  objects->map((int)this->items.size());
+  for (int i = 0; i < (int)this->batches.size(); i++) {
+    const render_batch_t &batch = this->batches[i];
+    if (!cameraPass((Render_Pass)(batch.key >> SORT_PASS_SHIFT)))
+      continue;
+    const mesh_buffer_t *buffer = models[this->items[batch.first].model]->buffer;
+    cull_object_t object;
+    object.bounds_min = buffer->bounds_min;
+    object.batch = i;
+    object.bounds_max = buffer->bounds_max;
+    object.padding = 0;
+    for (int item = batch.first; item < batch.first + batch.count; item++)
+      objects->write(item, &object);
+  }
+  objects->unmap();
+}
+
+void render_queue_t::submit(Render_Pass pass, program_cache_t *programs,
+                            const uniform_ring_t &instances,
+                            const uniform_ring_t &commands,
+                            const std::vector<model_t *> &models) {
+  stopwatch_t watch;
+  int first, count;
+  passBatches(pass, &first, &count);
+  if (count == 0)
+    return;
+  auto begin = this->batches.begin() + first;
+  auto end = begin + count;
+
+  /* every mesh is in the arena, one VAO for the whole pass */
+  glState().bindVertexArray(geometryArena().VAO);
+  this->sorted.meshes++;
+  if (programs == nullptr)
+    this->sorted.programs++;
+  if (this->multi_draw) {
+    /* base_instance of each command picks its instances */
+    if (this->gpu_culling && cameraPass(pass)) {
+      glBindBuffer(GL_ARRAY_BUFFER, this->culled_instances);
+      pointInstances(0);
+    } else {
+      glBindBuffer(GL_ARRAY_BUFFER, instances.buffer);
+      pointInstances(instances.offset(0));
+    }
+    glBindBuffer(GL_DRAW_INDIRECT_BUFFER, commands.buffer);
+  } else {
+    glBindBuffer(GL_ARRAY_BUFFER, instances.buffer);
+  }
+
+  /* the commands since the last bind, drawn in one call */
+  int run_first = 0, run_count = 0;
+  unsigned int run_type = 0;
+  auto flush = [&]() {
+    if (run_count == 0)
+      return;
+    glMultiDrawElementsIndirect(GL_TRIANGLES, run_type,
+                                (void *)commands.offset(run_first), run_count,
+                                sizeof(draw_command_t));
+    this->sorted.draws++;
+    run_count = 0;
+  };
+
+  /* GL state is unknown on entry, so the first draw binds everything */
+  unsigned int bound_features = ~0u;
+  unsigned int bound_maps[4] = {0, 0, 0, 0};
+  for (auto batch = begin; batch != end; ++batch) {
+    const model_t *model = models[this->items[batch->first].model];
+    const mesh_buffer_t *buffer = model->buffer;
+    if (programs != nullptr) {
+      unsigned int features =
+          (batch->key >> SORT_PROGRAM_SHIFT) & ((1u << SORT_PROGRAM_BITS) - 1);
+      unsigned int maps[4];
+      modelMaps(model, maps);
+      bool rebind = features != bound_features;
+      for (int unit = 0; unit < 4; unit++)
+        rebind = rebind || (maps[unit] < 0xfff && maps[unit] != bound_maps[unit]);
+      if (rebind)
+        flush();
+      if (features != bound_features) {
+        programs->get(features)->use();
+        bound_features = features;
+        this->sorted.programs++;
+      }
+      for (int unit = 0; unit < 4; unit++) {
+        if (maps[unit] < 0xfff && maps[unit] != bound_maps[unit]) {
+          glState().bindTexture(unit, GL_TEXTURE_2D, maps[unit]);
+          bound_maps[unit] = maps[unit];
+          this->sorted.textures++;
+        }
+      }
+    }
+    this->sorted.batches++;
+    this->sorted.instances += batch->count;
+
+    int index = (int)(batch - this->batches.begin());
+    if (this->multi_draw) {
+      if (buffer->index_type != run_type)
+        flush();
+      if (run_count == 0) {
+        run_first = index;
+        run_type = buffer->index_type;
+      }
+      run_count++;
+    } else {
+      /* GL 3.3 has no base instance, so the attributes move instead */
+      pointInstances(instances.offset(batch->first));
+      const render_item_t &item = this->items[batch->first];
+      buffer->draw(batch->count, item.first_index, item.index_count);
+      this->sorted.draws++;
+    }
+  }
+  flush();
+  this->sorted.submit_ms += watch.ms();
+}
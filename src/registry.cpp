@@ -0,0 +1,121 @@
+#include <filesystem>
+#include <system_error>
+
+#include "pool.hpp"
+#include "profile.hpp"
+#include "registry.hpp"
+#include "state.hpp"
+
+static std::string canonicalPath(const std::string &path) {
+  std::error_code ec;
+  std::filesystem::path canonical = std::filesystem::weakly_canonical(path, ec);
+  return ec ? path : canonical.string();
+}
+
+registry_t::registry_t() {
+  this->mesh_us = 0;
+  this->image_us = 0;
+}
+
+mesh_asset_t *registry_t::acquireMesh(const std::string &path) {
+  std::string key = canonicalPath(path);
+  auto found = this->meshes.find(key);
+  if (found != this->meshes.end()) {
+    found->second->refs++;
+    return found->second;
+  }
+
+  mesh_asset_t *asset = new mesh_asset_t();
+  asset->key = key;
+  asset->refs = 1;
+  asset->data = nullptr;
+  asset->buffer = nullptr;
+  std::atomic<long long> *us = &this->mesh_us;
+  asset->mesh = workerPool().submit([path, us]() {
+    stopwatch_t watch;
+    mesh_t *mesh = loadMesh(path);
+    *us += (long long)(watch.ms() * 1000.0);
+    return mesh;
+  });
+  this->meshes[key] = asset;
+  return asset;
+}
+
+texture_asset_t *registry_t::acquireTexture(const std::string &path,
+                                            Texture_Kind kind) {
+  std::string key = canonicalPath(path) + "#" + std::to_string(kind);
+  return acquireTextureKey(key, kind, [path, kind]() {
+    return loadTexture(path, kind);
+  });
+}
+
+texture_asset_t *registry_t::acquirePackedTexture(const std::string &roughness,
+                                                  const std::string &metalness,
+                                                  const std::string &occlusion) {
+  std::string key = "";
+  for (const std::string &path : {roughness, metalness, occlusion})
+    key += (path == "null" ? path : canonicalPath(path)) + "|";
+  key += "#" + std::to_string(PACKED_MAP);
+  return acquireTextureKey(key, PACKED_MAP, [roughness, metalness, occlusion]() {
+    return loadPackedTexture(roughness, metalness, occlusion);
+  });
+}
+
+texture_asset_t *
+registry_t::acquireTextureKey(const std::string &key, Texture_Kind kind,
+                              std::function<texture_data_t *()> load) {
+  auto found = this->textures.find(key);
+  if (found != this->textures.end()) {
+    found->second->refs++;
+    return found->second;
+  }
+
+  texture_asset_t *asset = new texture_asset_t();
+  asset->key = key;
+  asset->kind = kind;
+  asset->refs = 1;
+  asset->queued = false;
+  asset->texture = 0xfff;
+  asset->bytes = 0;
+  asset->raw_bytes = 0;
+  std::atomic<long long> *us = &this->image_us;
+  asset->data = workerPool().submit([load, us]() {
+    stopwatch_t watch;
+    texture_data_t *data = load();
+    *us += (long long)(watch.ms() * 1000.0);
+    return data;
+  });
+  this->textures[key] = asset;
+  return asset;
+}
+
+void registry_t::release(mesh_asset_t *asset) {
+  if (--asset->refs > 0)
+    return;
+  if (asset->mesh.valid())
+    delete asset->mesh.get();
+  if (asset->buffer != nullptr)
+    delete asset->buffer;
+  else
+    delete asset->data;
+  this->meshes.erase(asset->key);
+  delete asset;
+}
+
+void registry_t::release(texture_asset_t *asset) {
+  if (--asset->refs > 0)
+    return;
+  if (asset->data.valid())
+    delete asset->data.get();
+  if (asset->texture < 0xfff) {
+    glState().forgetTexture(asset->texture);
+    glDeleteTextures(1, &asset->texture);
+  }
+  this->textures.erase(asset->key);
+  delete asset;
+}
+
+registry_t &assetRegistry() {
+  static registry_t registry;
+  return registry;
+}
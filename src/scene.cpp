@@ -1,12 +1,27 @@
+#include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
 #include <cstring>
 #include <ext/matrix_clip_space.hpp>
 #include <ext/matrix_transform.hpp>
 #include <glad/glad.h>
 #include <iostream>
+#include <memory>
+#include <numeric>
 #include <stb_image.h>
+#include <unordered_map>
+#include <unordered_set>
 
+#include "brdf.hpp"
+#include "pool.hpp"
+#include "profile.hpp"
+#include "registry.hpp"
 #include "scene.hpp"
+#include "state.hpp"
 
 #define LINE_SIZE 256
 #define PI 3.1415926f
@@ -15,11 +30,85 @@ const unsigned int SCR_WIDTH = 1080;
 const unsigned int SCR_HEIGHT = 1080;
 const unsigned int SHADOW_WIDTH = 512;
 const unsigned int SHADOW_HEIGHT = 512;
+/* prefilter from source mips with few samples instead of 1024 full-res
+   taps per texel; false keeps the reference bake */
+const bool FILTERED_IMPORTANCE_SAMPLING = true;
+/* samples per texel above roughness 0, fits MAX_FILTERED_SAMPLES */
+const int FILTERED_SAMPLES = 240;
+/* render the first frames with a few samples per prefilter level and
+   refine the rest over later frames; the reference bake stays blocking */
+const bool PROGRESSIVE_IBL = true;
+/* samples per level in the pass before the first frame */
+const int IBL_FIRST_SAMPLES = 8;
+/* gpu time per frame given to refining the prefilter map */
+const double IBL_SLICE_MS = 4.0;
+/* sort opaque draws nearest first within a program instead of by
+   material and mesh */
+const bool FRONT_TO_BACK = true;
+/* view distance the depth bits of a sort key span */
+const float SORT_DEPTH_RANGE = 100.0f;
+/* merge the meshes of a material that are drawn once each into one
+   buffer at load, see groupStaticBatches */
+const bool STATIC_BATCHING = true;
+/* submit the batches between two binds as one indirect multi-draw where
+   the context has it, base-vertex draws otherwise */
+const bool MULTI_DRAW_INDIRECT = true;
+/* where the camera passes cull, CULL_GPU needs multi-draw and falls
+   back to CULL_CPU without it; the shadow pass culls on the CPU unless
+   culling is off */
+const Cull_Mode CULLING = CULL_GPU;
+/* with CULL_CPU also drop the models that the largest ones on screen
+   hide in a software depth buffer, see occlusion_buffer_t */
+const bool OCCLUSION_CULLING = true;
+/* size of that buffer, the width a multiple of four */
+const int OCCLUSION_WIDTH = 256;
+const int OCCLUSION_HEIGHT = OCCLUSION_WIDTH * SCR_HEIGHT / SCR_WIDTH;
+/* occluders drawn per frame at most, the most triangles one may have,
+   and the least diagonal over distance that makes one */
+const int OCCLUDER_COUNT = 32;
+const int OCCLUDER_TRIANGLES = 2048;
+const float OCCLUDER_MIN_SIZE = 0.25f;
 
 glm::mat4 pre_view;
 glm::mat4 pre_projection;
 
-scene_t::scene_t(std::string filename) {
+template <typename T> static bool isReady(std::future<T> &future) {
+  return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+/* what the cached IBL bake of these settings must match */
+static ibl_settings_t iblSettings() {
+  ibl_settings_t settings;
+  settings.flags = FILTERED_IMPORTANCE_SAMPLING;
+  settings.samples = FILTERED_SAMPLES;
+  settings.first_samples = IBL_FIRST_SAMPLES;
+  return settings;
+}
+
+/* the render queue binds the material maps to units 0 to 3 */
+static void linkGeometryProgram(shader_t &shader) {
+  shader.bindBlock("FrameBlock", FRAME_BLOCK_BINDING);
+  shader.bindSampler("uBasecolorMap", 0);
+  shader.bindSampler("uRMOMap", 1);
+  shader.bindSampler("uNormalMap", 2);
+  shader.bindSampler("uEmissionMap", 3);
+}
+
+static void linkForwardProgram(shader_t &shader) {
+  linkGeometryProgram(shader);
+  shader.bindSampler("uBRDFLut", 6);
+  shader.bindSampler("uPrefilterMap", 8);
+  shader.bindSampler("uShadowMap", 10);
+}
+
+scene_t::scene_t(std::string filename, bool streaming) {
+  stopwatch_t stage;
+  this->name = filename;
+  this->loaded = false;
+  this->stats = import_stats_t();
+  this->stats.mesh_us_base = assetRegistry().mesh_us;
+  this->stats.image_us_base = assetRegistry().image_us;
+
   char scene_type[LINE_SIZE];
   FILE *file;
   file = fopen(filename.c_str(), "rb");
@@ -29,12 +118,21 @@ scene_t::scene_t(std::string filename) {
   assert(items == 1);
 
   readLight(file);
+  initTextureFormats();
+  std::string environment = this->environment;
+  this->ibl_cached = false;
+  this->skybox_projected = 0;
+  ibl_settings_t settings = iblSettings();
+  this->ibl_cache = workerPool().submit([environment, settings]() {
+    return loadIBLCache(environment, settings);
+  });
 
   int num_materials = 0;
   items = fscanf(file, " materials %d:", &num_materials);
   assert(num_materials > 0);
   for (int i = 0; i < num_materials; i++) {
     this->materials.push_back(readMaterial(file));
+    this->materials.back()->index = i;
   }
 
   int num_transforms = 0;
@@ -44,19 +142,39 @@ scene_t::scene_t(std::string filename) {
     this->transforms.push_back(readTransform(file));
   }
 
+  /* meshes and maps decode once each on the pool, update() uploads them */
   int num_models = 0;
   items = fscanf(file, " models %d:", &num_models);
   assert(num_models > 0);
   for (int i = 0; i < num_models; i++) {
-    this->models.push_back(readModel(file));
+    this->imports.push_back(readModel(file));
   }
-  shader_t shader_t1("../src/shader/pbr_vertex_shader.glsl",
-                     "../src/shader/pbr_fragment_shader.glsl");
-  this->shader = shader_t1;
-
-  shader_t shader_t2("../src/shader/geometry_vertex_shader.glsl",
-                     "../src/shader/geometry_fragment_shader.glsl");
-  this->geometry_shader = shader_t2;
+  fclose(file);
+  if (STATIC_BATCHING)
+    groupStaticBatches();
+  this->stats.parse_ms = stage.ms();
+
+  stage.reset();
+  program_cache_t programs_t1("../src/shader/pbr_vertex_shader.glsl",
+                              "../src/shader/pbr_fragment_shader.glsl",
+                              MATERIAL_FEATURE_DEFINES, MATERIAL_FEATURES,
+                              linkForwardProgram);
+  this->forward_programs = programs_t1;
+
+  program_cache_t programs_t2("../src/shader/geometry_vertex_shader.glsl",
+                              "../src/shader/geometry_fragment_shader.glsl",
+                              MATERIAL_FEATURE_DEFINES, MATERIAL_FEATURES,
+                              linkGeometryProgram);
+  this->geometry_programs = programs_t2;
+
+  /* every program below compiles at once, the first use waits; the
+     deferred path draws each material with its maps, and without any
+     while they stream in */
+  this->stats.programs_base = programStats();
+  if (streaming)
+    this->geometry_programs.prepare(0);
+  for (model_import_t &import : this->imports)
+    this->geometry_programs.prepare(materialFeatures(import.material));
 
   shader_t shader_t3("../src/shader/shading_vertex_shader.glsl",
                      "../src/shader/shading_fragment_shader.glsl");
@@ -70,18 +188,314 @@ scene_t::scene_t(std::string filename) {
                      "../src/shader/final_fragment_shader.glsl");
   this->final_shader = shader_t5;
 
+  shader_t occlusion_shader("../src/shader/final_vertex_shader.glsl",
+                            "../src/shader/occlusion_fragment_shader.glsl");
+  this->occlusion_shader = occlusion_shader;
+
   shader_t shader_t6("../src/shader/taa_vertex_shader.glsl",
                      "../src/shader/taa_fragment_shader.glsl");
   this->taa_shader = shader_t6;
 
+  /* until update() bakes it this stays 0 and samples as black */
+  this->prefilter_map = 0;
+  this->ibl_bake = nullptr;
+  glGenBuffers(1, &this->upload_pbo);
+
   configSkybox();
-  configKullaConty();
-  configIBL();
+  configBRDFLut();
   configShadowMap();
   configDeferred();
+  configUniforms();
+  this->queue.front_to_back = FRONT_TO_BACK;
+  this->queue.multi_draw = MULTI_DRAW_INDIRECT && GLAD_GL_VERSION_4_3;
+  this->culling = CULLING;
+  this->queue_ms = 0.0;
+  if (this->queue.multi_draw)
+    this->culler.config(SCR_WIDTH, SCR_HEIGHT);
+  this->occlusion.config(OCCLUSION_WIDTH, OCCLUSION_HEIGHT);
+  this->show_occlusion = false;
 
   float border[] = { 0.0f, 0.0f, 0.0f, 0.0f };
   glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border);  
+  this->stats.setup_ms = stage.ms();
+
+  if (!streaming) {
+    while (!update(SIZE_MAX, true)) {
+    }
+  }
+}
+
+scene_t::~scene_t() {
+  for (texture_upload_t &upload : this->uploads)
+    delete upload.data;
+  for (std::future<image_t *> &face : this->skybox_faces) {
+    if (face.valid())
+      delete face.get();
+  }
+  if (this->ibl_cache.valid())
+    delete this->ibl_cache.get();
+  delete this->ibl_bake;
+
+  for (static_batch_t &batch : this->static_batches) {
+    delete batch.model;
+    delete batch.buffer;
+  }
+  registry_t &registry = assetRegistry();
+  for (model_import_t &import : this->imports) {
+    delete import.model;
+    registry.release(import.mesh);
+    texture_asset_t *maps[] = {import.basecolor_map, import.rmo_map,
+                               import.normal_map, import.emission_map};
+    for (texture_asset_t *map : maps) {
+      if (map != nullptr)
+        registry.release(map);
+    }
+  }
+}
+
+bool scene_t::update(size_t budget, bool block) {
+  if (this->loaded)
+    return true;
+  stopwatch_t frame, stage;
+  size_t spent = 0;
+
+  /* without a cached bake the faces are decoded and baked */
+  if (this->ibl_cache.valid() && (block || isReady(this->ibl_cache))) {
+    stage.reset();
+    ibl_data_t *ibl = this->ibl_cache.get();
+    this->stats.wait_ms += stage.ms();
+    if (ibl != nullptr)
+      queueIBL(ibl);
+    else
+      this->skybox_faces = loadSkyboxFaces();
+  }
+
+  /* skybox faces first, the IBL bake waits on them */
+  for (unsigned int i = 0; i < this->skybox_faces.size(); i++) {
+    if (!this->skybox_faces[i].valid())
+      continue;
+    if (!block && !isReady(this->skybox_faces[i]))
+      continue;
+    stage.reset();
+    image_t *face = this->skybox_faces[i].get();
+    this->stats.wait_ms += stage.ms();
+    this->skybox_sums.add(projectFace((const float *)face->data, face->width,
+                                      face->channels, i));
+    if (++this->skybox_projected == 6)
+      this->irradiance = irradianceSH9(this->skybox_sums);
+    texture_data_t *data = textureFromImage(face, GL_RGB16F, GL_RGB, GL_FLOAT);
+    delete face;
+    this->uploads.push_back(texture_upload_t(
+        data, this->skybox_texture, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, nullptr));
+  }
+
+  /* a model draws with its material factors as soon as its mesh is in,
+     maps are bound one by one as their last rows arrive */
+  bool importing = false;
+  for (model_import_t &import : this->imports) {
+    mesh_asset_t *mesh = import.mesh;
+    if (mesh->data == nullptr) {
+      if (!block && !isReady(mesh->mesh)) {
+        importing = true;
+        continue;
+      }
+      stage.reset();
+      mesh->data = mesh->mesh.get();
+      this->stats.wait_ms += stage.ms();
+    }
+    /* parts of a static batch are uploaded merged, below */
+    if (import.batch < 0 && mesh->buffer == nullptr) {
+      if (spent >= budget) {
+        importing = true;
+        continue;
+      }
+      mesh->buffer = new mesh_buffer_t(mesh->data);
+      spent += mesh->buffer->buffer_bytes;
+    }
+    if (import.batch < 0 && import.model == nullptr) {
+      import.model = new model_t(mesh->buffer, import.material, import.transform);
+      this->models.push_back(import.model);
+    }
+
+    texture_asset_t *maps[] = {import.basecolor_map, import.rmo_map,
+                               import.normal_map, import.emission_map};
+    for (texture_asset_t *map : maps) {
+      if (map == nullptr || map->texture < 0xfff)
+        continue;
+      if (!map->queued) {
+        if (!block && !isReady(map->data)) {
+          importing = true;
+          continue;
+        }
+        stage.reset();
+        texture_data_t *data = map->data.get();
+        this->stats.wait_ms += stage.ms();
+        queueMap(map, data);
+      }
+      /* bound on a later update once its upload has finished */
+      importing = true;
+    }
+  }
+
+  for (static_batch_t &batch : this->static_batches) {
+    if (batch.model != nullptr)
+      continue;
+    if (spent >= budget || !buildStaticBatch(batch)) {
+      importing = true;
+      continue;
+    }
+    spent += batch.buffer->buffer_bytes;
+  }
+
+  while (!this->uploads.empty() && spent < budget) {
+    spent += this->uploads.front().stream(this->upload_pbo, budget - spent);
+    if (this->uploads.front().done())
+      this->uploads.pop_front();
+  }
+
+  /* a batch shares the maps of its material with each of its parts */
+  for (model_import_t &import : this->imports) {
+    model_t *model = import.model;
+    if (import.batch >= 0)
+      model = this->static_batches[import.batch].model;
+    if (model == nullptr)
+      continue;
+    if (import.basecolor_map != nullptr)
+      model->basecolor_map = import.basecolor_map->texture;
+    if (import.rmo_map != nullptr)
+      model->rmo_map = import.rmo_map->texture;
+    if (import.normal_map != nullptr)
+      model->normal_map = import.normal_map->texture;
+    if (import.emission_map != nullptr)
+      model->emission_map = import.emission_map->texture;
+  }
+
+  bool skybox_pending = this->ibl_cache.valid();
+  for (std::future<image_t *> &face : this->skybox_faces)
+    skybox_pending = skybox_pending || face.valid();
+  for (texture_upload_t &upload : this->uploads)
+    skybox_pending = skybox_pending || upload.texture == this->skybox_texture;
+
+  this->stats.frames++;
+  this->stats.upload_bytes += spent;
+  this->stats.upload_ms += frame.ms();
+  this->stats.max_frame_ms = std::max(this->stats.max_frame_ms, frame.ms());
+
+  if (!skybox_pending && this->prefilter_map == 0 && !this->ibl_cached) {
+    stage.reset();
+    configIBL();
+    this->stats.ibl_ms = stage.ms();
+  }
+  if (this->ibl_bake != nullptr) {
+    double slice_ms = IBL_SLICE_MS;
+    if (block || !PROGRESSIVE_IBL)
+      slice_ms = INFINITY;
+    if (refineIBL(slice_ms))
+      saveIBL();
+  }
+
+  this->loaded = !importing && this->uploads.empty() &&
+                 this->prefilter_map != 0 && this->ibl_bake == nullptr;
+  if (this->loaded)
+    reportImport();
+  return this->loaded;
+}
+
+void scene_t::queueMap(texture_asset_t *map, texture_data_t *data) {
+  unsigned int texture;
+  glGenTextures(1, &texture);
+  glState().bindTexture(0, GL_TEXTURE_2D, texture);
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  if (data->levels.size() > 1)
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  else
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, (int)data->levels.size() - 1);
+
+  map->queued = true;
+  map->bytes = data->bytes.size();
+  map->raw_bytes = data->raw_bytes;
+  this->uploads.push_back(
+      texture_upload_t(data, texture, GL_TEXTURE_2D, &map->texture));
+}
+
+void scene_t::reportImport() {
+  registry_t &registry = assetRegistry();
+  double mesh_ms = (registry.mesh_us - this->stats.mesh_us_base) / 1000.0;
+  double image_ms = (registry.image_us - this->stats.image_us_base) / 1000.0;
+  double serial_ms = this->stats.parse_ms + this->stats.setup_ms + mesh_ms +
+                     image_ms + this->stats.upload_ms;
+  double import_ms = this->stats.total.ms() - this->stats.ibl_ms -
+                     this->stats.ibl_refine_ms;
+  printf("import %s: %zu models on %d threads\n"
+         "  parse %.1f ms, meshes %.1f ms cpu, maps %.1f ms cpu, "
+         "setup %.1f ms, ibl %.1f ms (refined over %d frames, %.1f ms)\n"
+         "  upload %.1f MB over %d frames, %.1f ms (worst frame %.1f ms), "
+         "waiting %.1f ms\n"
+         "  import %.1f ms wall vs %.1f ms serial (ibl excluded), total %.1f ms\n",
+         this->name.c_str(), this->imports.size(), workerPool().size(),
+         this->stats.parse_ms, mesh_ms, image_ms, this->stats.setup_ms,
+         this->stats.ibl_ms, this->stats.ibl_refine_frames,
+         this->stats.ibl_refine_ms, this->stats.upload_bytes / 1048576.0,
+         this->stats.frames, this->stats.upload_ms, this->stats.max_frame_ms,
+         this->stats.wait_ms, import_ms, serial_ms, this->stats.total.ms());
+
+  program_stats_t &programs = programStats();
+  printf("  programs: %d from binaries, %d compiled, %.1f ms issuing, "
+         "%.1f ms waiting on first use\n",
+         programs.cached - this->stats.programs_base.cached,
+         programs.compiled - this->stats.programs_base.compiled,
+         programs.issue_ms - this->stats.programs_base.issue_ms,
+         programs.wait_ms - this->stats.programs_base.wait_ms);
+
+  /* what per-model copies would have cost against what is resident */
+  std::unordered_set<const void *> seen;
+  size_t requested = 0, resident = 0, map_bytes = 0, raw_map_bytes = 0;
+  int mesh_refs = 0, map_refs = 0, unique_meshes = 0, unique_maps = 0;
+  for (model_import_t &import : this->imports) {
+    mesh_refs++;
+    if (import.batch < 0) {
+      requested += import.mesh->buffer->buffer_bytes;
+      if (seen.insert(import.mesh).second) {
+        unique_meshes++;
+        resident += import.mesh->buffer->buffer_bytes;
+      }
+    }
+    texture_asset_t *maps[] = {import.basecolor_map, import.rmo_map,
+                               import.normal_map, import.emission_map};
+    for (texture_asset_t *map : maps) {
+      if (map == nullptr)
+        continue;
+      map_refs++;
+      requested += map->bytes;
+      if (seen.insert(map).second) {
+        unique_maps++;
+        resident += map->bytes;
+        map_bytes += map->bytes;
+        raw_map_bytes += map->raw_bytes;
+      }
+    }
+  }
+  int batched = 0;
+  size_t batch_bytes = 0;
+  for (static_batch_t &batch : this->static_batches) {
+    batched += batch.imports.size();
+    batch_bytes += batch.buffer->buffer_bytes;
+  }
+  requested += batch_bytes;
+  resident += batch_bytes;
+  unique_meshes += this->static_batches.size();
+  printf("  static batches: %d models of %zu materials merged, %.2f MB\n",
+         batched, this->static_batches.size(), batch_bytes / 1048576.0);
+  printf("  assets: %d mesh refs -> %d buffers, %d map refs -> %d textures, "
+         "%.2f MB resident, %.2f MB saved\n",
+         mesh_refs, unique_meshes, map_refs, unique_maps, resident / 1048576.0,
+         (requested - resident) / 1048576.0);
+  printf("  maps: %.2f MB with mips, %.2f MB as single raw levels\n",
+         map_bytes / 1048576.0, raw_map_bytes / 1048576.0);
 }
 
 void scene_t::readLight(FILE *file) {
@@ -165,14 +579,14 @@ material_t *scene_t::readMaterial(FILE *file) {
 
   char switcher[LINE_SIZE];
   items = fscanf(file, " double_sided: %s", switcher);
-  if (switcher == "off")
+  if (strcmp(switcher, "off") == 0)
     material->double_sided = 0;
   else
     material->double_sided = 1;
   assert(items == 1);
 
   items = fscanf(file, " enable_blend: %s", switcher);
-  if (switcher == "off")
+  if (strcmp(switcher, "off") == 0)
     material->enable_blend = 0;
   else
     material->enable_blend = 1;
@@ -199,7 +613,13 @@ glm::mat4 scene_t::readTransform(FILE *file) {
   return transform;
 }
 
-model_t *scene_t::readModel(FILE *file) {
+static texture_asset_t *acquireMap(const std::string &path, Texture_Kind kind) {
+  if (path == "null")
+    return nullptr;
+  return assetRegistry().acquireTexture(path, kind);
+}
+
+model_import_t scene_t::readModel(FILE *file) {
   int index;
   char path[LINE_SIZE];
 
@@ -230,32 +650,140 @@ model_t *scene_t::readModel(FILE *file) {
   items = fscanf(file, " transform: %d", &transform_index);
   assert(items == 1);
 
-  return new model_t(loadMesh(mesh_path), this->materials[material_index],
-                     this->transforms[transform_index]);
+  model_import_t import;
+  import.model = nullptr;
+  import.batch = -1;
+  import.material = this->materials[material_index];
+  import.transform = this->transforms[transform_index];
+
+  registry_t &registry = assetRegistry();
+  const material_t *material = import.material;
+  import.mesh = registry.acquireMesh(mesh_path);
+  import.basecolor_map = acquireMap(material->basecolor_map, COLOR_MAP);
+  import.normal_map = acquireMap(material->normal_map, NORMAL_MAP);
+  import.emission_map = acquireMap(material->emission_map, COLOR_MAP);
+  import.rmo_map = nullptr;
+  if (material->roughness_map != "null" || material->metalness_map != "null" ||
+      material->occlusion_map != "null")
+    import.rmo_map = registry.acquirePackedTexture(material->roughness_map,
+                                                   material->metalness_map,
+                                                   material->occlusion_map);
+  return import;
+}
+
+/* a mesh drawn more than once stays shared and is instanced instead, and
+   blended parts keep their own sort depth */
+void scene_t::groupStaticBatches() {
+  std::unordered_map<const mesh_asset_t *, int> mesh_refs;
+  for (const model_import_t &import : this->imports)
+    mesh_refs[import.mesh]++;
+
+  std::vector<std::vector<int>> groups(this->materials.size());
+  for (int i = 0; i < (int)this->imports.size(); i++) {
+    const model_import_t &import = this->imports[i];
+    if (mesh_refs[import.mesh] > 1 || import.material->enable_blend)
+      continue;
+    groups[import.material->index].push_back(i);
+  }
+  for (int i = 0; i < (int)groups.size(); i++) {
+    if (groups[i].size() < 2)
+      continue;
+    static_batch_t batch;
+    batch.material = this->materials[i];
+    batch.imports = groups[i];
+    batch.model = nullptr;
+    batch.buffer = nullptr;
+    for (int import : groups[i])
+      this->imports[import].batch = this->static_batches.size();
+    this->static_batches.push_back(batch);
+  }
+}
+
+bool scene_t::buildStaticBatch(static_batch_t &batch) {
+  std::vector<const mesh_t *> parts;
+  std::vector<glm::mat4> transforms;
+  for (int index : batch.imports) {
+    const model_import_t &import = this->imports[index];
+    if (import.mesh->data == nullptr)
+      return false;
+    parts.push_back(import.mesh->data);
+    transforms.push_back(import.transform);
+  }
+  std::vector<submesh_t> ranges;
+  mesh_t *merged = mergeMeshes(parts, transforms, &ranges);
+  batch.buffer = new mesh_buffer_t(merged);
+  batch.buffer->submeshes = ranges;
+  batch.model = new model_t(batch.buffer, batch.material, glm::mat4(1.0f));
+  this->models.push_back(batch.model);
+  return true;
+}
+
+std::vector<std::future<image_t *>> scene_t::loadSkyboxFaces() {
+  std::vector<std::string> textures_faces = environmentFaces(this->environment);
+
+  std::vector<std::future<image_t *>> faces;
+  for (const std::string &path : textures_faces) {
+    std::atomic<long long> *us = &assetRegistry().image_us;
+    faces.push_back(workerPool().submit([path, us]() {
+      stopwatch_t watch;
+      image_t *image = new image_t();
+      image->load(path, false, true);
+      *us += (long long)(watch.ms() * 1000.0);
+      return image;
+    }));
+  }
+  return faces;
+}
+
+/* the cached bake streams in like any map, the IBL textures are published
+   once their last face has landed */
+void scene_t::queueIBL(ibl_data_t *ibl) {
+  this->ibl_cached = true;
+  this->irradiance = ibl->irradiance;
+  for (int i = 0; i < 6; i++) {
+    this->uploads.push_back(texture_upload_t(ibl->skybox[i], this->skybox_texture,
+                                             GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+                                             nullptr));
+    ibl->skybox[i] = nullptr;
+  }
+
+  unsigned int prefilter_map;
+  glGenTextures(1, &prefilter_map);
+  glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, prefilter_map);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAX_LEVEL,
+                  IBL_PREFILTER_LEVELS - 1);
+  for (int i = 0; i < 6; i++) {
+    this->uploads.push_back(texture_upload_t(
+        ibl->prefilter[i], prefilter_map, GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+        i == 5 ? &this->prefilter_map : nullptr));
+    ibl->prefilter[i] = nullptr;
+  }
+  delete ibl;
+}
+
+/* packs the fresh bake on the GL thread, writes it on the pool */
+void scene_t::saveIBL() {
+  std::shared_ptr<ibl_data_t> ibl(
+      readIBL(this->skybox_texture, this->prefilter_map));
+  ibl->irradiance = this->irradiance;
+  std::string environment = this->environment;
+  ibl_settings_t settings = iblSettings();
+  workerPool().submit([environment, settings, ibl]() {
+    saveIBLCache(environment, settings, ibl.get());
+    return true;
+  });
 }
 
 void scene_t::configSkybox() {
   unsigned int skybox_texture;
   glGenTextures(1, &skybox_texture);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, skybox_texture);
-
-  std::vector<std::string> textures_faces;
-  textures_faces.push_back("../assets/" + this->environment + "/m0_px.hdr");
-  textures_faces.push_back("../assets/" + this->environment + "/m0_nx.hdr");
-  textures_faces.push_back("../assets/" + this->environment + "/m0_py.hdr");
-  textures_faces.push_back("../assets/" + this->environment + "/m0_ny.hdr");
-  textures_faces.push_back("../assets/" + this->environment + "/m0_pz.hdr");
-  textures_faces.push_back("../assets/" + this->environment + "/m0_nz.hdr");
-
-  int width, height, nrChannels;
-  float *data;
-  stbi_set_flip_vertically_on_load(0);
-  for (unsigned int i = 0; i < textures_faces.size(); i++) {
-    data =
-        stbi_loadf(textures_faces[i].c_str(), &width, &height, &nrChannels, 0);
-    glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, width, height,
-                 0, GL_RGB, GL_FLOAT, data);
-  }
+  glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, skybox_texture);
 
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
@@ -302,7 +830,7 @@ void scene_t::configSkybox() {
 
   glGenVertexArrays(1, &skybox_vao);
   glGenBuffers(1, &skybox_vbo);
-  glBindVertexArray(skybox_vao);
+  glState().bindVertexArray(skybox_vao);
   glBindBuffer(GL_ARRAY_BUFFER, skybox_vbo);
 
   glBufferData(GL_ARRAY_BUFFER, sizeof(cube_vertices), cube_vertices,
@@ -316,7 +844,7 @@ void scene_t::configSkybox() {
   glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, 8 * sizeof(float),
                         (void *)(6 * sizeof(float)));
   glBindBuffer(GL_ARRAY_BUFFER, 0);
-  glBindVertexArray(0);
+  glState().bindVertexArray(0);
 
   this->skybox_texture = skybox_texture;
 
@@ -327,96 +855,114 @@ void scene_t::configSkybox() {
 }
 
 void scene_t::drawSkybox(camera_t camera) {
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, this->skybox_texture);
+  glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, this->skybox_texture);
 
   glm::mat4 view = camera.getViewMatrix();
   glm::mat4 skybox_view = glm::mat4(glm::mat3(view));
   glm::mat4 skybox_projection = glm::perspective(glm::radians(camera.Zoom),
                                                 (float)SCR_WIDTH / (float)SCR_HEIGHT, 0.1f, 100.0f);
   this->skybox_shader.use();
-  this->skybox_shader.setInt("uSkyboxMap", 0);
   this->skybox_shader.setMat4("uProjectionMatrix", skybox_projection);
   this->skybox_shader.setMat4("uViewMatrix", skybox_view);
 
-  glEnable(GL_STENCIL_TEST);
-  glStencilMask(0xff);
-  glStencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
-  glStencilFunc(GL_NOTEQUAL, 1, 0xFF);
+  glState().enable(GL_STENCIL_TEST);
+  glState().stencilMask(0xff);
+  glState().stencilOp(GL_KEEP, GL_KEEP, GL_KEEP);
+  glState().stencilFunc(GL_NOTEQUAL, 1, 0xFF);
 
-  glDepthFunc(GL_ALWAYS);
-  glDepthMask(GL_FALSE);
-  glBindVertexArray(this->skybox_vao);
+  glState().depthFunc(GL_ALWAYS);
+  glState().depthMask(false);
+  glState().bindVertexArray(this->skybox_vao);
   glDrawArrays(GL_TRIANGLES, 0, 36);
-  glDepthMask(GL_TRUE);
-  glDepthFunc(GL_LESS);
+  glState().depthMask(true);
+  glState().depthFunc(GL_LESS);
 
-  glStencilMask(0x00);
-  glDisable(GL_STENCIL_TEST);
+  glState().stencilMask(0x00);
+  glState().disable(GL_STENCIL_TEST);
 
 }
 
-void scene_t::configKullaConty() {
-  glGenTextures(1, &this->e_lut);
-  int width, height, nrChannels;
-  stbi_set_flip_vertically_on_load(1);
-  unsigned char *data =
-      stbi_load("../assets/GGX_E_LUT.png", &width, &height, &nrChannels, 0);
-  glBindTexture(GL_TEXTURE_2D, this->e_lut);
-
+void scene_t::configBRDFLut() {
+  texture_data_t *data = loadBRDFLut();
+  glGenTextures(1, &this->brdf_lut);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->brdf_lut);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexImage2D(GL_TEXTURE_2D, 0, data->internal_format, data->levels[0].width,
+               data->levels[0].height, 0, data->format, data->type,
+               data->bytes.data());
+  delete data;
+}
 
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-               GL_UNSIGNED_BYTE, data);
-  glGenerateMipmap(GL_TEXTURE_2D);
-  stbi_image_free(data);
-
-  glGenTextures(1, &this->e_avg);
-  stbi_set_flip_vertically_on_load(1);
-  data =
-      stbi_load("../assets/GGX_Eavg_LUT.png", &width, &height, &nrChannels, 0);
-  glBindTexture(GL_TEXTURE_2D, this->e_avg);
-
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+/*
+  GGX samples of the prefilter lobe around +z, tangent space direction in
+  xyz and the source lod in w; with V = N the pdf of a sample reduces to
+  D / 4 and the lod picks the mip whose texels cover its solid angle
+*/
+static float filteredSamples(float roughness, int count, int source_size,
+                             std::vector<glm::vec4> *samples) {
+  float a = roughness * roughness;
+  float alpha2 = a * a;
+  float sa_texel = 4.0f * PI / (6.0f * source_size * source_size);
+  float total_weight = 0.0f;
+  for (unsigned int i = 0; i < (unsigned int)count; i++) {
+    unsigned int bits = i;
+    bits = (bits << 16u) | (bits >> 16u);
+    bits = ((bits & 0x55555555u) << 1u) | ((bits & 0xAAAAAAAAu) >> 1u);
+    bits = ((bits & 0x33333333u) << 2u) | ((bits & 0xCCCCCCCCu) >> 2u);
+    bits = ((bits & 0x0F0F0F0Fu) << 4u) | ((bits & 0xF0F0F0F0u) >> 4u);
+    bits = ((bits & 0x00FF00FFu) << 8u) | ((bits & 0xFF00FF00u) >> 8u);
+    float u = (float)i / (float)count;
+    float v = bits * 2.3283064365386963e-10f;
+
+    float phi = 2.0f * PI * u;
+    float cos_theta = std::sqrt((1.0f - v) / (1.0f + (alpha2 - 1.0f) * v));
+    float sin_theta = std::sqrt(1.0f - cos_theta * cos_theta);
+    glm::vec3 h(std::cos(phi) * sin_theta, std::sin(phi) * sin_theta,
+                cos_theta);
+    glm::vec3 l = glm::normalize(2.0f * h.z * h - glm::vec3(0.0f, 0.0f, 1.0f));
+    if (l.z <= 0.0f)
+      continue;
+
+    float denom = h.z * h.z * (alpha2 - 1.0f) + 1.0f;
+    float pdf = alpha2 / (PI * denom * denom) / 4.0f;
+    float sa_sample = 1.0f / (count * pdf + 0.0001f);
+    float lod = std::max(0.5f * std::log2(sa_sample / sa_texel) + 1.0f, 0.0f);
+    /* a mirror lobe has no spread, it reads the source itself */
+    if (roughness == 0.0f)
+      lod = 0.0f;
+    samples->push_back(glm::vec4(l, lod));
+    total_weight += l.z;
+  }
+  return total_weight;
+}
 
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, width, height, 0, GL_RGB,
-               GL_UNSIGNED_BYTE, data);
-  glGenerateMipmap(GL_TEXTURE_2D);
-  stbi_image_free(data);
+/* looks at cube face i from the origin, in cube map face order */
+static glm::mat4 cubeFaceView(unsigned int i) {
+  static const glm::vec3 targets[] = {
+      glm::vec3(1.0f, 0.0f, 0.0f),  glm::vec3(-1.0f, 0.0f, 0.0f),
+      glm::vec3(0.0f, 1.0f, 0.0f),  glm::vec3(0.0f, -1.0f, 0.0f),
+      glm::vec3(0.0f, 0.0f, 1.0f),  glm::vec3(0.0f, 0.0f, -1.0f)};
+  static const glm::vec3 ups[] = {
+      glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
+      glm::vec3(0.0f, 0.0f, 1.0f),  glm::vec3(0.0f, 0.0f, -1.0f),
+      glm::vec3(0.0f, -1.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f)};
+  return glm::lookAt(glm::vec3(0.0f), targets[i], ups[i]);
 }
 
 void scene_t::configIBL() {
   glGenFramebuffers(1, &this->ibl_fbo);
   glGenRenderbuffers(1, &this->ibl_rbo);
-  glBindFramebuffer(GL_FRAMEBUFFER, this->ibl_fbo);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->ibl_fbo);
   glBindRenderbuffer(GL_RENDERBUFFER, this->ibl_rbo);
   glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
   glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT,
                             GL_RENDERBUFFER, this->ibl_rbo);
 
-  glm::mat4 projection = glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f);
-  glm::mat4 views[] = {
-      glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(1.0f, 0.0f, 0.0f),
-                  glm::vec3(0.0f, -1.0f, 0.0f)),
-      glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(-1.0f, 0.0f, 0.0f),
-                  glm::vec3(0.0f, -1.0f, 0.0f)),
-      glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 1.0f, 0.0f),
-                  glm::vec3(0.0f, 0.0f, 1.0f)),
-      glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, -1.0f, 0.0f),
-                  glm::vec3(0.0f, 0.0f, -1.0f)),
-      glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, 1.0f),
-                  glm::vec3(0.0f, -1.0f, 0.0f)),
-      glm::lookAt(glm::vec3(0.0f, 0.0f, 0.0f), glm::vec3(0.0f, 0.0f, -1.0f),
-                  glm::vec3(0.0f, -1.0f, 0.0f))};
-
   glGenTextures(1, &this->prefilter_map);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, this->prefilter_map);
+  glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, this->prefilter_map);
   for (unsigned int i = 0; i < 6; ++i) {
     glTexImage2D(GL_TEXTURE_CUBE_MAP_POSITIVE_X + i, 0, GL_RGB16F, 512, 512, 0,
                  GL_RGB, GL_FLOAT, nullptr);
@@ -429,92 +975,176 @@ void scene_t::configIBL() {
   glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
   glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
 
-  shader_t prefilter_shader("../src/shader/prefilter_vertex_shader.glsl",
-                            "../src/shader/prefilter_fragment_shader.glsl");
-  prefilter_shader.use();
-  prefilter_shader.setInt("uEnvironmentMap", 0);
-  prefilter_shader.setMat4("uProjectionMatrix", projection);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, this->skybox_texture);
+  ibl_bake_t *bake = new ibl_bake_t();
+  this->ibl_bake = bake;
+  bake->shader = shader_t("../src/shader/prefilter_vertex_shader.glsl",
+                          "../src/shader/prefilter_fragment_shader.glsl");
+  bake->shader.use();
+  bake->shader.setInt("uEnvironmentMap", 0);
+  bake->shader.setMat4("uProjectionMatrix",
+                       glm::perspective(glm::radians(90.0f), 1.0f, 0.1f, 10.0f));
+  bake->shader.setBool("uFiltered", FILTERED_IMPORTANCE_SAMPLING);
+  glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, this->skybox_texture);
+
+  int source_size = 0;
+  glGetTexLevelParameteriv(GL_TEXTURE_CUBE_MAP_POSITIVE_X, 0, GL_TEXTURE_WIDTH,
+                           &source_size);
+  if (FILTERED_IMPORTANCE_SAMPLING) {
+    /* the source mips are only needed while baking */
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glGenerateMipmap(GL_TEXTURE_CUBE_MAP);
+  }
 
-  glBindFramebuffer(GL_FRAMEBUFFER, this->ibl_fbo);
-  unsigned int max_level = 5;
+  unsigned int max_level = IBL_PREFILTER_LEVELS;
   for (unsigned int mip = 0; mip < max_level; mip++) {
-    unsigned int width = static_cast<unsigned int>(512 * std::pow(0.5, mip));
-    unsigned int height = static_cast<unsigned int>(512 * std::pow(0.5, mip));
-    glBindRenderbuffer(GL_RENDERBUFFER, this->ibl_rbo);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
-    glBindRenderbuffer(GL_RENDERBUFFER, 0);
-
-    glViewport(0, 0, width, height);
-
     float roughness = (float)mip / (float)(max_level - 1);
-    prefilter_shader.setFloat("uRoughness", roughness);
-    for (unsigned int i = 0; i < 6; ++i) {
-      prefilter_shader.setMat4("uViewMatrix", views[i]);
-      glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
-                             GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
-                             this->prefilter_map, mip);
-      glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-      glDepthMask(GL_FALSE);
-      glBindVertexArray(this->skybox_vao);
-      glDrawArrays(GL_TRIANGLES, 0, 36);
-      glDepthMask(GL_TRUE);
+    std::vector<glm::vec4> samples;
+    if (FILTERED_IMPORTANCE_SAMPLING) {
+      /* a mirror lobe is a single tap of the source; rougher lobes
+         already read coarser mips, so they share one count */
+      int count = mip == 0 ? 1 : FILTERED_SAMPLES;
+      filteredSamples(roughness, count, source_size, &samples);
+    } else {
+      /* the reference shader takes all its taps in one batch */
+      samples.push_back(glm::vec4(0.0f, 0.0f, 1.0f, 0.0f));
     }
+    bake->samples.push_back(samples);
+    bake->next_sample.push_back(0);
+    bake->done_weight.push_back(0.0f);
   }
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-  glGenTextures(1, &this->brdf_lut);
-  glBindTexture(GL_TEXTURE_2D, this->brdf_lut);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, 512, 512, 0, GL_RG, GL_FLOAT, 0);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-  glBindFramebuffer(GL_FRAMEBUFFER, this->ibl_fbo);
-  glBindRenderbuffer(GL_RENDERBUFFER, this->ibl_rbo);
-  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, 512, 512);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D,
-                         brdf_lut, 0);
-  glViewport(0, 0, 512, 512);
+  bake->mip = 0;
+  bake->timed_work = 0.0;
+  bake->frames = 0;
+
+  /* a rough first pass over every level, so shading has something */
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->ibl_fbo);
+  if (FILTERED_IMPORTANCE_SAMPLING)
+    glState().enable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+  glState().enable(GL_BLEND);
+  glState().blendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+  for (unsigned int mip = 0; mip < max_level; mip++)
+    prefilterBatch(mip, IBL_FIRST_SAMPLES);
+  glState().disable(GL_BLEND);
+  glState().disable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
+}
 
-  float quad_vertices[] = {
-      -1.0f, 1.0f, 0.0f, 0.0f, 1.0f, -1.0f, -1.0f, 0.0f, 0.0f, 0.0f,
-      1.0f,  1.0f, 0.0f, 1.0f, 1.0f, 1.0f,  -1.0f, 0.0f, 1.0f, 0.0f,
-  };
-  unsigned int quad_vao;
-  unsigned int quad_vbo;
-  glGenBuffers(1, &quad_vbo);
-  glGenVertexArrays(1, &quad_vao);
-  glBindVertexArray(quad_vao);
-  glBindBuffer(GL_ARRAY_BUFFER, quad_vbo);
-  glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), &quad_vertices,
-               GL_STATIC_DRAW);
-  glEnableVertexAttribArray(0);
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
-  glEnableVertexAttribArray(1);
-  glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float),
-                        (void *)(3 * sizeof(float)));
+/*
+  renders the next count samples of a level into all six faces, blended
+  into the level's running mean by their share of the weight so far; the
+  first batch replaces whatever the level held; needs the bake's fbo
+  bound and constant alpha blending on
+*/
+void scene_t::prefilterBatch(unsigned int mip, int count) {
+  ibl_bake_t *bake = this->ibl_bake;
+  const std::vector<glm::vec4> &samples = bake->samples[mip];
+  int first = bake->next_sample[mip];
+  count = std::min(count, (int)samples.size() - first);
+  if (count <= 0)
+    return;
+
+  float weight = 0.0f;
+  for (int i = first; i < first + count; i++)
+    weight += samples[i].z;
+  bake->next_sample[mip] += count;
+  bake->done_weight[mip] += weight;
+
+  unsigned int size = 512 >> mip;
+  glState().viewport(0, 0, size, size);
+  bake->shader.use();
+  bake->shader.setFloat("uRoughness",
+                        (float)mip / (float)(IBL_PREFILTER_LEVELS - 1));
+  bake->shader.setInt("uSampleCount", count);
+  bake->shader.setVec4Array("uSamples", &samples[first], count);
+  bake->shader.setFloat("uTotalWeight", weight);
+  glBlendColor(0.0f, 0.0f, 0.0f, weight / bake->done_weight[mip]);
+  glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, this->skybox_texture);
+  for (unsigned int i = 0; i < 6; ++i) {
+    bake->shader.setMat4("uViewMatrix", cubeFaceView(i));
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                           GL_TEXTURE_CUBE_MAP_POSITIVE_X + i,
+                           this->prefilter_map, mip);
+    glClear(GL_DEPTH_BUFFER_BIT);
+    glState().depthMask(false);
+    glState().bindVertexArray(this->skybox_vao);
+    glDrawArrays(GL_TRIANGLES, 0, 36);
+    glState().depthMask(true);
+  }
+}
 
-  shader_t brdf_shader("../src/shader/brdf_vertex_shader.glsl",
-                       "../src/shader/brdf_fragment_shader.glsl");
-  brdf_shader.use();
-  glBindVertexArray(quad_vao);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glDepthMask(GL_FALSE);
-  glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-  glDepthMask(GL_TRUE);
-  glBindVertexArray(0);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+/*
+  spends about slice_ms of gpu time on the prefilter bake, sized from
+  the timings read back so far; true once every level is complete
+*/
+bool scene_t::refineIBL(double slice_ms) {
+  ibl_bake_t *bake = this->ibl_bake;
+  int timed = bake->timer.samples;
+  bake->timer.begin();
+  for (; timed < bake->timer.samples; timed++) {
+    bake->timed_work += bake->pending_work.front();
+    bake->pending_work.pop_front();
+  }
+  /* until a timing is back, a first-pass sized batch probes the cost */
+  double ms_per_work = 0.0;
+  if (bake->timed_work > 0.0)
+    ms_per_work = bake->timer.total_ms / bake->timed_work;
+
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->ibl_fbo);
+  if (FILTERED_IMPORTANCE_SAMPLING)
+    glState().enable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+  glState().enable(GL_BLEND);
+  glState().blendFunc(GL_CONSTANT_ALPHA, GL_ONE_MINUS_CONSTANT_ALPHA);
+  double work = 0.0;
+  double budget = slice_ms;
+  if (ms_per_work > 0.0)
+    budget = slice_ms / ms_per_work;
+  bool probe = ms_per_work == 0.0 && !std::isinf(slice_ms);
+  while (bake->mip < IBL_PREFILTER_LEVELS && budget > 0.0) {
+    unsigned int mip = bake->mip;
+    int remaining = (int)bake->samples[mip].size() - bake->next_sample[mip];
+    if (remaining <= 0) {
+      bake->mip++;
+      continue;
+    }
+    double texels = 6.0 * (512 >> mip) * (512 >> mip);
+    int count = remaining;
+    if (probe)
+      count = std::min(IBL_FIRST_SAMPLES, remaining);
+    else if (!std::isinf(budget))
+      count = (int)std::min((double)remaining, std::max(1.0, budget / texels));
+    prefilterBatch(mip, count);
+    work += count * texels;
+    budget -= count * texels;
+    if (probe)
+      break;
+  }
+  glState().disable(GL_BLEND);
+  glState().disable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
+  bake->timer.end();
+  bake->pending_work.push_back(work);
+  bake->frames++;
+
+  if (bake->mip < IBL_PREFILTER_LEVELS)
+    return false;
+  if (FILTERED_IMPORTANCE_SAMPLING) {
+    glState().bindTexture(0, GL_TEXTURE_CUBE_MAP, this->skybox_texture);
+    glTexParameteri(GL_TEXTURE_CUBE_MAP, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  }
+  this->stats.ibl_refine_ms = bake->elapsed.ms();
+  this->stats.ibl_refine_frames = bake->frames;
+  delete bake;
+  this->ibl_bake = nullptr;
+  return true;
 }
 
 void scene_t::configShadowMap() {
   glGenFramebuffers(1, &this->shadow_fbo);
-  glBindFramebuffer(GL_FRAMEBUFFER, this->shadow_fbo);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->shadow_fbo);
 
   glGenTextures(1, &this->shadow_map);
-  glBindTexture(GL_TEXTURE_2D, this->shadow_map);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->shadow_map);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_RGBA, GL_FLOAT, nullptr);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -529,13 +1159,13 @@ void scene_t::configShadowMap() {
 
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
       std::cout << "Framebuffer not complete!" << std::endl;
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
 
   glGenFramebuffers(1, &this->SAT_fbo);
-  glBindFramebuffer(GL_FRAMEBUFFER, this->SAT_fbo);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->SAT_fbo);
 
   glGenTextures(1, &this->SAT_target);
-  glBindTexture(GL_TEXTURE_2D, this->SAT_target);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->SAT_target);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_RGBA, GL_FLOAT, nullptr);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -550,7 +1180,7 @@ void scene_t::configShadowMap() {
 
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
       std::cout << "Framebuffer not complete!" << std::endl;
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
 
   shader_t shader_t1("../src/shader/shadow_vertex_shader.glsl",
                         "../src/shader/shadow_fragment_shader.glsl");
@@ -562,103 +1192,85 @@ void scene_t::configShadowMap() {
 
 }
 
-void scene_t::drawShadowMap(glm::mat4 light_view, glm::mat4 light_projection) {
-  glBindFramebuffer(GL_FRAMEBUFFER, this->shadow_fbo);
+void scene_t::drawShadowMap() {
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->shadow_fbo);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+  glState().viewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
 
   this->shadow_shader.use();
-  this->shadow_shader.setMat4("uViewMatrix", light_view);
-  this->shadow_shader.setMat4("uProjectionMatrix", light_projection);
-  
-  for (int i = 0; i < this->models.size(); i++) {
-    glm::mat4 model = this->models[i]->transform;
-    
-    this->shadow_shader.setMat4("uModelMatrix", model);
-    this->models[i]->draw();
-  }
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  this->queue.submit(PASS_SHADOW, nullptr, this->instances,
+                     this->draw_commands, this->models);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
 
-  glBindFramebuffer(GL_FRAMEBUFFER, this->SAT_fbo);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->SAT_fbo);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
+  glState().viewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
 
   this->SAT_shader.use();
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, this->shadow_map);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->shadow_map);
 
   glm::vec2 shadow_size(SHADOW_WIDTH, SHADOW_HEIGHT);
   this->SAT_shader.setVec2("uShadowSize", shadow_size);
   const int samples = 8;
   this->SAT_shader.setInt("uSamples", samples);
-  this->SAT_shader.setInt("uShadowMap", 0);
   int times = 1;
   for (int i = 1; i < SHADOW_WIDTH; i *= samples) {
-    glActiveTexture(GL_TEXTURE0);
     if (times % 2 == 0) {
-      glBindTexture(GL_TEXTURE_2D, this->SAT_target); 
+      glState().bindTexture(0, GL_TEXTURE_2D, this->SAT_target); 
       glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->shadow_map, 0);
     }
     else {
-      glBindTexture(GL_TEXTURE_2D, this->shadow_map);
+      glState().bindTexture(0, GL_TEXTURE_2D, this->shadow_map);
       glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->SAT_target, 0);
     }
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glm::vec2 offset(i, 0);
     this->SAT_shader.setVec2("uOffset", offset);
-    glBindVertexArray(this->quad_vao);
+    glState().bindVertexArray(this->quad_vao);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     
     times ++;
   }
 
   if (times % 2 == 0) {
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, this->SAT_fbo);
-    glBindTexture(GL_TEXTURE_2D, this->shadow_map);
+    glState().bindFramebuffer(GL_READ_FRAMEBUFFER, this->SAT_fbo);
+    glState().bindTexture(0, GL_TEXTURE_2D, this->shadow_map);
     glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 0, 0, SHADOW_WIDTH, SHADOW_HEIGHT, 0);
   }
 
   times = 1;
   for (int i = 1; i < SHADOW_HEIGHT; i *= samples) {
-    glActiveTexture(GL_TEXTURE0);
     if (times % 2 == 0) {
-      glBindTexture(GL_TEXTURE_2D, this->SAT_target); 
+      glState().bindTexture(0, GL_TEXTURE_2D, this->SAT_target); 
       glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->shadow_map, 0);
     }
     else {
-      glBindTexture(GL_TEXTURE_2D, this->shadow_map);
+      glState().bindTexture(0, GL_TEXTURE_2D, this->shadow_map);
       glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->SAT_target, 0);
     }
 
     glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
     glm::vec2 offset(0, i);
     this->SAT_shader.setVec2("uOffset", offset);
-    glBindVertexArray(this->quad_vao);
+    glState().bindVertexArray(this->quad_vao);
     glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
     
     times ++;
   }
   if (times % 2 == 0) {
-    glBindFramebuffer(GL_READ_FRAMEBUFFER, this->SAT_fbo);
-    glBindTexture(GL_TEXTURE_2D, this->shadow_map);
+    glState().bindFramebuffer(GL_READ_FRAMEBUFFER, this->SAT_fbo);
+    glState().bindTexture(0, GL_TEXTURE_2D, this->shadow_map);
     glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, 0, 0, SHADOW_WIDTH, SHADOW_HEIGHT, 0);
   }
 
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 void scene_t::drawSceneForward(camera_t camera) {
-  glActiveTexture(GL_TEXTURE6);
-  glBindTexture(GL_TEXTURE_2D, this->e_lut);
-  glActiveTexture(GL_TEXTURE7);
-  glBindTexture(GL_TEXTURE_2D, this->e_avg);
-  glActiveTexture(GL_TEXTURE8);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, this->prefilter_map);
-  glActiveTexture(GL_TEXTURE9);
-  glBindTexture(GL_TEXTURE_2D, this->brdf_lut);
-  glActiveTexture(GL_TEXTURE10);
-  glBindTexture(GL_TEXTURE_2D, this->shadow_map);
+  glState().bindTexture(6, GL_TEXTURE_2D, this->brdf_lut);
+  glState().bindTexture(8, GL_TEXTURE_CUBE_MAP, this->prefilter_map);
+  glState().bindTexture(10, GL_TEXTURE_2D, this->shadow_map);
 
   glm::mat4 view = camera.getViewMatrix();
   glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom),
@@ -669,64 +1281,41 @@ void scene_t::drawSceneForward(camera_t camera) {
   glm::mat4 light_projection = glm::perspective(glm::radians(camera.Zoom),
                                                (float)SHADOW_WIDTH / (float)SHADOW_HEIGHT, 1.0f, 50.0f);
 
-  drawShadowMap(light_view, light_projection);
-
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  frame_uniforms_t frame;
+  frame.view = view;
+  frame.projection = projection;
+  frame.pre_view = view;
+  frame.pre_projection = projection;
+  frame.world_to_screen = projection * view;
+  frame.light_view = light_view;
+  frame.light_projection = light_projection;
+  frame.light_world_to_screen = light_projection * light_view;
+  frame.camera_pos = camera.Position;
+  frame.offset_idx = 0;
+  frame.light_pos = light_pos;
+  frame.frame_count = 0;
+  frame.quantized = QUANTIZE_VERTICES;
+  writeUniforms(frame);
+  /* there is no depth pyramid of the forward view */
+  this->culler.occlusion = false;
+  queueModels(frame, PASS_FORWARD);
+
+  drawShadowMap();
+
+  glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-
-  this->shader.use();
-  this->shader.setMat4("uViewMatrix", view);
-  this->shader.setMat4("uProjectionMatrix", projection);
-  this->shader.setVec3("uCameraPos", camera.Position);
-  this->shader.setVec3("uLightPos", light_pos);
-  this->shader.setMat4("uLightViewMatrix", light_view);
-  this->shader.setMat4("uLightProjectionMatrix", light_projection);
-  this->shader.setInt("uBasecolorMap", 0);
-  this->shader.setInt("uMetalnessMap", 1);
-  this->shader.setInt("uRoughnessMap", 2);
-  this->shader.setInt("uNormalMap", 3);
-  this->shader.setInt("uOcclusionMap", 4);
-  this->shader.setInt("uEmissionMap", 5);
-  this->shader.setInt("uBRDFLut", 6);
-  this->shader.setInt("uEavgLut", 7);
-  this->shader.setInt("uPrefilterMap", 8);
-  this->shader.setInt("uBRDFLut_ibl", 9);
-  this->shader.setInt("uShadowMap", 10);
-
-  for (int i = 0; i < this->models.size(); i++) {
-    glm::mat4 model = this->models[i]->transform;
-
-    this->shader.setMat4("uModelMatrix", model);
-    this->shader.setVec4("uBasecolor", this->models[i]->material->basecolor_factor);
-    this->shader.setFloat("uMetalness", this->models[i]->material->metalness_factor);
-    this->shader.setFloat("uRoughness", this->models[i]->material->roughness_factor);
-
-    if (this->models[i]->normal_map < 0xfff) {
-      this->shader.setInt("uEnableBump", 1);
-    }else{
-      this->shader.setInt("uEnableBump", 0);
-    }
-    if (this->models[i]->occlusion_map < 0xfff) {
-      this->shader.setInt("uEnableOcclusion", 1);
-    }else{
-      this->shader.setInt("uEnableOcclusion", 0);
-    }
-    if (this->models[i]->emission_map < 0xfff) {
-      this->shader.setInt("uEnableEmission", 1);
-    }else{
-      this->shader.setInt("uEnableEmission", 0);
-    }
-    this->models[i]->draw();
-  }
+  glState().viewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+
+  this->queue.submit(PASS_FORWARD, &this->forward_programs,
+                     this->instances, this->draw_commands, this->models);
 }
 
 void scene_t::configDeferred() {
   glGenFramebuffers(1, &this->geometry_fbo);
-  glBindFramebuffer(GL_FRAMEBUFFER, this->geometry_fbo);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->geometry_fbo);
 
   glGenTextures(1, &this->g_position);
-  glBindTexture(GL_TEXTURE_2D, this->g_position);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->g_position);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -735,7 +1324,7 @@ void scene_t::configDeferred() {
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, this->g_position, 0);
 
   glGenTextures(1, &this->g_normal);
-  glBindTexture(GL_TEXTURE_2D, this->g_normal);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->g_normal);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -744,7 +1333,7 @@ void scene_t::configDeferred() {
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT1, GL_TEXTURE_2D, this->g_normal, 0);
   
   glGenTextures(1, &this->g_basecolor);
-  glBindTexture(GL_TEXTURE_2D, this->g_basecolor);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->g_basecolor);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -754,7 +1343,7 @@ void scene_t::configDeferred() {
   
   // roughness, metallic, occusion
   glGenTextures(1, &this->g_rmo);
-  glBindTexture(GL_TEXTURE_2D, this->g_rmo);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->g_rmo);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -763,7 +1352,7 @@ void scene_t::configDeferred() {
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT3, GL_TEXTURE_2D, this->g_rmo, 0);
   
   glGenTextures(1, &this->g_emission);
-  glBindTexture(GL_TEXTURE_2D, this->g_emission);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->g_emission);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGB, GL_FLOAT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -772,7 +1361,7 @@ void scene_t::configDeferred() {
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT4, GL_TEXTURE_2D, this->g_emission, 0);
 
   glGenTextures(1, &this->g_depth);
-  glBindTexture(GL_TEXTURE_2D, this->g_depth);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->g_depth);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_R32F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RED, GL_FLOAT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -781,7 +1370,7 @@ void scene_t::configDeferred() {
   glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT5, GL_TEXTURE_2D, this->g_depth, 0);
 
   glGenTextures(1, &this->g_velocity);
-  glBindTexture(GL_TEXTURE_2D, this->g_velocity);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->g_velocity);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RG16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RG, GL_FLOAT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -799,13 +1388,13 @@ void scene_t::configDeferred() {
 
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         std::cout << "Framebuffer not complete!" << std::endl;
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
 
   glGenFramebuffers(1, &this->shading_fbo);
-  glBindFramebuffer(GL_FRAMEBUFFER, this->shading_fbo);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->shading_fbo);
 
   glGenTextures(1, &this->color_buffer);
-  glBindTexture(GL_TEXTURE_2D, this->color_buffer);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->color_buffer);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -820,13 +1409,13 @@ void scene_t::configDeferred() {
   
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
         std::cout << "Framebuffer not complete!" << std::endl;
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
 
   glGenFramebuffers(1, &this->post_fbo);
-  glBindFramebuffer(GL_FRAMEBUFFER, this->post_fbo);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->post_fbo);
   
   glGenTextures(1, &this->cur_frame);
-  glBindTexture(GL_TEXTURE_2D, this->cur_frame);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->cur_frame);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
@@ -841,14 +1430,14 @@ void scene_t::configDeferred() {
 
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
       std::cout << "Framebuffer not complete!" << std::endl;
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
 
 
   glGenFramebuffers(1, &this->taa_fbo);
-  glBindFramebuffer(GL_FRAMEBUFFER, this->taa_fbo);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->taa_fbo);
   
   glGenTextures(1, &this->final_color);
-  glBindTexture(GL_TEXTURE_2D, this->final_color);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->final_color);
   glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16F, SCR_WIDTH, SCR_HEIGHT, 0, GL_RGBA, GL_FLOAT, NULL);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
@@ -863,11 +1452,11 @@ void scene_t::configDeferred() {
 
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE)
       std::cout << "Framebuffer not complete!" << std::endl;
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
 
 
   glGenTextures(1, &this->pre_frame);
-  glBindTexture(GL_TEXTURE_2D, this->pre_frame);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->pre_frame);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
   glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
@@ -877,7 +1466,7 @@ void scene_t::configDeferred() {
   };
   glGenBuffers(1, &this->quad_vbo);
   glGenVertexArrays(1, &this->quad_vao);
-  glBindVertexArray(this->quad_vao);
+  glState().bindVertexArray(this->quad_vao);
   glBindBuffer(GL_ARRAY_BUFFER, this->quad_vbo);
   glBufferData(GL_ARRAY_BUFFER, sizeof(quad_vertices), &quad_vertices,
                GL_STATIC_DRAW);
@@ -886,7 +1475,246 @@ void scene_t::configDeferred() {
   glEnableVertexAttribArray(1);
   glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float),
                         (void *)(3 * sizeof(float)));
-  glBindVertexArray(0);
+  glState().bindVertexArray(0);
+}
+
+void scene_t::configUniforms() {
+  this->shadow_shader.bindBlock("FrameBlock", FRAME_BLOCK_BINDING);
+  this->shading_shader.bindBlock("FrameBlock", FRAME_BLOCK_BINDING);
+  this->post_shader.bindBlock("FrameBlock", FRAME_BLOCK_BINDING);
+
+  this->skybox_shader.bindSampler("uSkyboxMap", 0);
+  this->SAT_shader.bindSampler("uShadowMap", 0);
+
+  this->shading_shader.bindSampler("uPosition", 0);   /* needed in post processing */
+  this->shading_shader.bindSampler("uNormal", 1);     /* needed in post processing */
+  this->shading_shader.bindSampler("uBasecolor", 2);  /* needed in post processing */
+  this->shading_shader.bindSampler("uRMO", 3);        /* needed in post processing */
+  this->shading_shader.bindSampler("uEmission", 4);
+  this->shading_shader.bindSampler("uDepth", 5);      /* needed in post processing */
+  this->shading_shader.bindSampler("uBRDFLut", 6);    /* needed in post processing */
+  this->shading_shader.bindSampler("uShadowMap", 9);
+
+  this->post_shader.bindSampler("uShadingColor", 11);
+  this->post_shader.bindSampler("uPreFrame", 12);
+  this->post_shader.bindSampler("uPosition", 0);
+  this->post_shader.bindSampler("uNormal", 1);
+  this->post_shader.bindSampler("uBaseColor", 2);
+  this->post_shader.bindSampler("uRMO", 3);
+  this->post_shader.bindSampler("uDepth", 4);
+  this->post_shader.bindSampler("uBRDFLut", 5);
+  this->post_shader.bindSampler("uPrefilterMap", 6);
+  this->post_shader.bindSampler("uVelocity", 7);
+
+  this->taa_shader.bindSampler("uCurFrame", 0);
+  this->taa_shader.bindSampler("uPreFrame", 1);
+  this->taa_shader.bindSampler("uDepth", 2);
+  this->taa_shader.bindSampler("uVelocity", 3);
+
+  this->final_shader.bindSampler("uCurFrame", 0);
+  this->occlusion_shader.bindSampler("uOcclusion", 0);
+  glState().useProgram(0);
+}
+
+/* the world space box of a part */
+static void worldBounds(const model_t *model, const submesh_t &range,
+                        glm::vec3 *world_min, glm::vec3 *world_max) {
+  transformBounds(model->transform, range.bounds_min, range.bounds_max,
+                  world_min, world_max);
+}
+
+void scene_t::setTransform(int index, const glm::mat4 &transform) {
+  model_t *model = this->models[index];
+  model->transform = transform;
+  if (index + 1 < (int)this->model_parts.size()) {
+    for (int i = this->model_parts[index]; i < this->model_parts[index + 1];
+         i++) {
+      glm::vec3 world_min, world_max;
+      worldBounds(model, this->parts[i].range, &world_min, &world_max);
+      this->bvh.update(i, world_min, world_max);
+    }
+  }
+}
+
+void scene_t::refreshBVH() {
+  int count = (int)this->models.size();
+  if ((int)this->model_parts.size() != count + 1) {
+    this->parts.clear();
+    this->model_parts.clear();
+    for (int i = 0; i < count; i++) {
+      const mesh_buffer_t *buffer = this->models[i]->buffer;
+      this->model_parts.push_back((int)this->parts.size());
+      if (buffer->submeshes.empty()) {
+        submesh_t whole;
+        whole.first_index = 0;
+        whole.index_count = buffer->index_count;
+        whole.bounds_min = buffer->bounds_min;
+        whole.bounds_max = buffer->bounds_max;
+        this->parts.push_back({i, whole});
+      }
+      for (const submesh_t &submesh : buffer->submeshes)
+        this->parts.push_back({i, submesh});
+    }
+    this->model_parts.push_back((int)this->parts.size());
+
+    std::vector<glm::vec3> world_min(this->parts.size());
+    std::vector<glm::vec3> world_max(this->parts.size());
+    for (size_t i = 0; i < this->parts.size(); i++)
+      worldBounds(this->models[this->parts[i].model], this->parts[i].range,
+                  &world_min[i], &world_max[i]);
+    this->bvh.build(world_min, world_max);
+  }
+  this->bvh.refit();
+}
+
+void scene_t::cullPass(Render_Pass pass, const glm::mat4 &world_to_clip,
+                       bool cull, std::vector<int> *visible) {
+  stopwatch_t watch;
+  cull_stats_t &stats = this->cull_stats[pass];
+  stats.tested = (int)this->parts.size();
+  visible->clear();
+  if (!cull) {
+    visible->resize(this->parts.size());
+    std::iota(visible->begin(), visible->end(), 0);
+    return;
+  }
+  this->bvh.cull(frustum_t(world_to_clip), visible, &stats);
+  stats.culled = stats.tested - (int)visible->size();
+  stats.cpu_ms = watch.ms();
+}
+
+void scene_t::cullOccluded(const frame_uniforms_t &frame,
+                           std::vector<int> *visible) {
+  /* the parts largest on screen that are cheap enough to rasterize */
+  std::vector<std::pair<float, int>> candidates;
+  for (int i : *visible) {
+    const scene_part_t &part = this->parts[i];
+    if ((int)part.range.index_count > OCCLUDER_TRIANGLES * 3)
+      continue;
+    glm::vec3 world_min, world_max;
+    worldBounds(this->models[part.model], part.range, &world_min, &world_max);
+    float distance = glm::length(0.5f * (world_min + world_max) - frame.camera_pos);
+    float size = glm::length(world_max - world_min) / std::max(distance, 1e-3f);
+    if (size >= OCCLUDER_MIN_SIZE)
+      candidates.push_back({size, i});
+  }
+  if ((int)candidates.size() > OCCLUDER_COUNT) {
+    std::nth_element(candidates.begin(), candidates.begin() + OCCLUDER_COUNT,
+                     candidates.end(), std::greater<std::pair<float, int>>());
+    candidates.resize(OCCLUDER_COUNT);
+  }
+  std::vector<occluder_t> occluders;
+  std::unordered_set<int> occluding;
+  for (const std::pair<float, int> &candidate : candidates) {
+    const scene_part_t &part = this->parts[candidate.second];
+    const model_t *model = this->models[part.model];
+    occluders.push_back({model->buffer->mesh, part.range.first_index,
+                         part.range.index_count, model->transform});
+    occluding.insert(candidate.second);
+  }
+  glm::mat4 world_to_clip = frame.projection * frame.view;
+  this->occlusion.render(occluders, world_to_clip);
+  this->occlusion.stats.tested = (int)visible->size();
+  if (occluders.empty())
+    return;
+
+  /* occluders would only test against themselves */
+  stopwatch_t watch;
+  const int chunk = 256;
+  std::vector<char> keep(visible->size());
+  parallelFor(((int)visible->size() + chunk - 1) / chunk, [&](int first) {
+    int end = std::min((first + 1) * chunk, (int)visible->size());
+    for (int j = first * chunk; j < end; j++) {
+      int i = (*visible)[j];
+      const scene_part_t &part = this->parts[i];
+      glm::vec3 world_min, world_max;
+      worldBounds(this->models[part.model], part.range, &world_min,
+                  &world_max);
+      keep[j] = occluding.count(i) > 0 ||
+                this->occlusion.visible(world_min, world_max);
+    }
+  });
+  int kept = 0;
+  for (int j = 0; j < (int)visible->size(); j++) {
+    if (keep[j])
+      (*visible)[kept++] = (*visible)[j];
+  }
+  occlusion_stats_t &stats = this->occlusion.stats;
+  stats.culled = stats.tested - kept;
+  stats.test_ms = watch.ms();
+  visible->resize(kept);
+}
+
+void scene_t::queueParts(const frame_uniforms_t &frame, Render_Pass pass,
+                         std::vector<int> *visible) {
+  /* the BVH hands parts out in tree order, a batch's ranges are adjacent
+     in part order */
+  std::sort(visible->begin(), visible->end());
+  const glm::mat4 &eye = pass == PASS_SHADOW ? frame.light_view : frame.view;
+  for (int j = 0; j < (int)visible->size();) {
+    const scene_part_t &part = this->parts[(*visible)[j]];
+    submesh_t range = part.range;
+    int end = j + 1;
+    for (; end < (int)visible->size(); end++) {
+      const scene_part_t &next = this->parts[(*visible)[end]];
+      if (next.model != part.model ||
+          next.range.first_index != range.first_index + range.index_count)
+        break;
+      range.index_count += next.range.index_count;
+      range.bounds_min = glm::min(range.bounds_min, next.range.bounds_min);
+      range.bounds_max = glm::max(range.bounds_max, next.range.bounds_max);
+    }
+    j = end;
+
+    const model_t *model = this->models[part.model];
+    glm::vec3 center = 0.5f * (range.bounds_min + range.bounds_max);
+    glm::vec4 world = model->transform * glm::vec4(center, 1.0f);
+    float depth = -(eye * world).z / SORT_DEPTH_RANGE;
+    unsigned int program = pass == PASS_SHADOW ? 0 : model->features();
+    this->queue.push(pass, part.model, model, range.first_index,
+                     range.index_count, program, depth);
+  }
+}
+
+void scene_t::queueModels(const frame_uniforms_t &frame, Render_Pass pass) {
+  stopwatch_t watch;
+  Cull_Mode culling = this->culling;
+  if (culling == CULL_GPU && !this->queue.multi_draw)
+    culling = CULL_CPU;
+  this->queue.clear();
+  this->queue.gpu_culling = culling == CULL_GPU;
+  if (culling != CULL_GPU)
+    this->culler.occlusion = false;
+  for (cull_stats_t &stats : this->cull_stats)
+    stats = cull_stats_t();
+
+  refreshBVH();
+  cullPass(PASS_SHADOW, frame.light_world_to_screen, culling != CULL_NONE,
+           &this->shadow_visible);
+  cullPass(pass, frame.projection * frame.view, culling == CULL_CPU,
+           &this->camera_visible);
+  this->occlusion.stats = occlusion_stats_t();
+  if (culling == CULL_CPU && OCCLUSION_CULLING)
+    cullOccluded(frame, &this->camera_visible);
+
+  queueParts(frame, PASS_SHADOW, &this->shadow_visible);
+  queueParts(frame, pass, &this->camera_visible);
+  this->queue.sort();
+  this->queue.upload(&this->instances, &this->draw_commands,
+                     &this->cull_objects, this->models);
+  if (culling == CULL_GPU) {
+    this->culler.cull(this->queue, pass, this->instances, this->cull_objects,
+                      this->draw_commands);
+    this->queue.culled_instances = this->culler.culled_instances;
+  }
+  this->queue_ms = watch.ms();
+}
+
+void scene_t::writeUniforms(const frame_uniforms_t &frame) {
+  this->frame_uniforms.map(1);
+  this->frame_uniforms.write(0, &frame);
+  this->frame_uniforms.unmap();
+  this->frame_uniforms.bind(FRAME_BLOCK_BINDING, 0);
 }
 
 static void saveArrayToTextFile(const std::string& filename, const float* array, size_t size) {
@@ -926,198 +1754,126 @@ void scene_t::drawSceneDeferred(camera_t camera) {
                                                (float)SHADOW_WIDTH / (float)SHADOW_HEIGHT, 1.0f, 50.0f);
   glm::mat4 light_world_to_screen = light_projection * light_view;
 
-  glDisable(GL_STENCIL_TEST);
-  drawShadowMap(light_view, light_projection);
+  frame_uniforms_t frame;
+  frame.view = view;
+  frame.projection = projection;
+  frame.pre_view = pre_view;
+  frame.pre_projection = pre_projection;
+  frame.world_to_screen = world_to_screen;
+  frame.light_view = light_view;
+  frame.light_projection = light_projection;
+  frame.light_world_to_screen = light_world_to_screen;
+  frame.camera_pos = camera.Position;
+  frame.offset_idx = frame_idx % 8;
+  frame.light_pos = light_pos;
+  frame.frame_count = frame_idx;
+  frame.quantized = QUANTIZE_VERTICES;
+  writeUniforms(frame);
+  queueModels(frame, PASS_GEOMETRY);
+
+  glState().disable(GL_STENCIL_TEST);
+  drawShadowMap();
   
-  glBindFramebuffer(GL_FRAMEBUFFER, this->geometry_fbo);
-  glEnable(GL_STENCIL_TEST);
-  glStencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
-  glStencilFunc(GL_ALWAYS, 1, 0xFF);
-  glStencilMask(0xFF);
+  this->geometry_timer.begin();
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->geometry_fbo);
+  glState().enable(GL_STENCIL_TEST);
+  glState().stencilOp(GL_KEEP, GL_KEEP, GL_REPLACE);
+  glState().stencilFunc(GL_ALWAYS, 1, 0xFF);
+  glState().stencilMask(0xFF);
 
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT | GL_STENCIL_BUFFER_BIT);
-  glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-  glEnable(GL_CULL_FACE);
-  this->geometry_shader.use();
-  this->geometry_shader.setMat4("uViewMatrix", view);
-  this->geometry_shader.setMat4("uProjectionMatrix", projection);
-  this->geometry_shader.setMat4("uPreViewMatrix", pre_view);
-  this->geometry_shader.setMat4("uPreProjectionMatrix", pre_projection);
-  this->geometry_shader.setInt("uOffsetIdx", frame_idx % 8);
-  this->geometry_shader.setInt("uBasecolorMap", 0);
-  this->geometry_shader.setInt("uMetalnessMap", 1);
-  this->geometry_shader.setInt("uRoughnessMap", 2);
-  this->geometry_shader.setInt("uNormalMap", 3);
-  this->geometry_shader.setInt("uOcclusionMap", 4);
-  this->geometry_shader.setInt("uEmissionMap", 5);
-
-  for (int i = 0; i < this->models.size(); i++) {
-    glm::mat4 model = this->models[i]->transform;
-
-    this->geometry_shader.setMat4("uModelMatrix", model);
-    this->geometry_shader.setVec4("uBasecolor", this->models[i]->material->basecolor_factor);
-    this->geometry_shader.setFloat("uMetalness", this->models[i]->material->metalness_factor);
-    this->geometry_shader.setFloat("uRoughness", this->models[i]->material->roughness_factor);
-
-    if (this->models[i]->normal_map < 0xfff) {
-      this->geometry_shader.setInt("uEnableBump", 1);
-    }else{
-      this->geometry_shader.setInt("uEnableBump", 0);
-    }
-    if (this->models[i]->occlusion_map < 0xfff) {
-      this->geometry_shader.setInt("uEnableOcclusion", 1);
-    }else{
-      this->geometry_shader.setInt("uEnableOcclusion", 0);
-    }
-    if (this->models[i]->emission_map < 0xfff) {
-      this->geometry_shader.setInt("uEnableEmission", 1);
-    }else{
-      this->geometry_shader.setInt("uEnableEmission", 0);
-    }
-    this->models[i]->draw();
-  }
-  glStencilMask(0x00);
-  glDisable(GL_STENCIL_TEST);
-  glDisable(GL_CULL_FACE);
+  glState().viewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+  glState().enable(GL_CULL_FACE);
+  this->queue.submit(PASS_GEOMETRY, &this->geometry_programs,
+                     this->instances, this->draw_commands, this->models);
+  glState().stencilMask(0x00);
+  glState().disable(GL_STENCIL_TEST);
+  glState().disable(GL_CULL_FACE);
+  this->geometry_timer.end();
+  if (this->queue.gpu_culling)
+    this->culler.buildPyramid(this->g_depth);
 
   /* shading pass */
-  glBindFramebuffer(GL_FRAMEBUFFER, this->shading_fbo);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->shading_fbo);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, this->g_position);
-  glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, this->g_normal);
-  glActiveTexture(GL_TEXTURE2);
-  glBindTexture(GL_TEXTURE_2D, this->g_basecolor);
-  glActiveTexture(GL_TEXTURE3);
-  glBindTexture(GL_TEXTURE_2D, this->g_rmo);
-  glActiveTexture(GL_TEXTURE4);
-  glBindTexture(GL_TEXTURE_2D, this->g_emission);
-  glActiveTexture(GL_TEXTURE5);
-  glBindTexture(GL_TEXTURE_2D, this->g_depth);
-
-  glActiveTexture(GL_TEXTURE6);
-  glBindTexture(GL_TEXTURE_2D, this->e_lut);
-  glActiveTexture(GL_TEXTURE7);
-  glBindTexture(GL_TEXTURE_2D, this->e_avg);
-  glActiveTexture(GL_TEXTURE8);
-  glBindTexture(GL_TEXTURE_2D, this->brdf_lut);
-  glActiveTexture(GL_TEXTURE9);
-  glBindTexture(GL_TEXTURE_2D, this->shadow_map);
+  glState().viewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+
+  glState().bindTexture(0, GL_TEXTURE_2D, this->g_position);
+  glState().bindTexture(1, GL_TEXTURE_2D, this->g_normal);
+  glState().bindTexture(2, GL_TEXTURE_2D, this->g_basecolor);
+  glState().bindTexture(3, GL_TEXTURE_2D, this->g_rmo);
+  glState().bindTexture(4, GL_TEXTURE_2D, this->g_emission);
+  glState().bindTexture(5, GL_TEXTURE_2D, this->g_depth);
+
+  glState().bindTexture(6, GL_TEXTURE_2D, this->brdf_lut);
+  glState().bindTexture(9, GL_TEXTURE_2D, this->shadow_map);
   
   this->shading_shader.use();
-
-  this->shading_shader.setMat4("uWorldToScreen", world_to_screen);
-  this->shading_shader.setMat4("uLightView", light_view);
-  this->shading_shader.setMat4("uLightWorldToScreen", light_world_to_screen);
-  this->shading_shader.setVec3("uCameraPos", camera.Position);
-  this->shading_shader.setVec3("uLightPos", light_pos);
-  this->shading_shader.setInt("uPosition", 0);         /* needed in post processing */
-  this->shading_shader.setInt("uNormal", 1);           /* needed in post processing */
-  this->shading_shader.setInt("uBasecolor", 2);        /* needed in post processing */
-  this->shading_shader.setInt("uRMO", 3);              /* needed in post processing */
-  this->shading_shader.setInt("uEmission", 4);
-  this->shading_shader.setInt("uDepth", 5);            /* needed in post processing */
-  this->shading_shader.setInt("uBRDFLut", 6);
-  this->shading_shader.setInt("uEavgLut", 7);
-  this->shading_shader.setInt("uBRDFLut_ibl", 8);      /* needed in post processing */
-  this->shading_shader.setInt("uShadowMap", 9);
+  this->shading_shader.setVec3Array("uIrradianceSH", this->irradiance.coefficients,
+                                    SH9_COEFFICIENTS);
   
-  glBindVertexArray(this->quad_vao);
+  glState().bindVertexArray(this->quad_vao);
   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-  glBindFramebuffer(GL_READ_FRAMEBUFFER, this->geometry_fbo);
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, this->post_fbo);
+  glState().bindFramebuffer(GL_READ_FRAMEBUFFER, this->geometry_fbo);
+  glState().bindFramebuffer(GL_DRAW_FRAMEBUFFER, this->post_fbo);
   glBlitFramebuffer(0, 0, SCR_WIDTH, SCR_HEIGHT, 0, 0, SCR_WIDTH, SCR_HEIGHT, GL_STENCIL_BUFFER_BIT, GL_NEAREST);
 
   /* post processing pass */
-  glBindFramebuffer(GL_FRAMEBUFFER, this->post_fbo);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->post_fbo);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-
-  glActiveTexture(GL_TEXTURE11);
-  glBindTexture(GL_TEXTURE_2D, this->color_buffer);
-  glActiveTexture(GL_TEXTURE12);
-  glBindTexture(GL_TEXTURE_2D, this->pre_frame);
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, this->g_position);
-  glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, this->g_normal);
-  glActiveTexture(GL_TEXTURE2);
-  glBindTexture(GL_TEXTURE_2D, this->g_basecolor);
-  glActiveTexture(GL_TEXTURE3);
-  glBindTexture(GL_TEXTURE_2D, this->g_rmo);
-  glActiveTexture(GL_TEXTURE4);
-  glBindTexture(GL_TEXTURE_2D, this->g_depth);
-  glActiveTexture(GL_TEXTURE5);
-  glBindTexture(GL_TEXTURE_2D, this->brdf_lut);
-  glActiveTexture(GL_TEXTURE6);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, this->prefilter_map);
-  glActiveTexture(GL_TEXTURE7);
-  glBindTexture(GL_TEXTURE_2D, this->g_velocity);
+  glState().viewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+
+  glState().bindTexture(11, GL_TEXTURE_2D, this->color_buffer);
+  glState().bindTexture(12, GL_TEXTURE_2D, this->pre_frame);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->g_position);
+  glState().bindTexture(1, GL_TEXTURE_2D, this->g_normal);
+  glState().bindTexture(2, GL_TEXTURE_2D, this->g_basecolor);
+  glState().bindTexture(3, GL_TEXTURE_2D, this->g_rmo);
+  glState().bindTexture(4, GL_TEXTURE_2D, this->g_depth);
+  glState().bindTexture(5, GL_TEXTURE_2D, this->brdf_lut);
+  glState().bindTexture(6, GL_TEXTURE_CUBE_MAP, this->prefilter_map);
+  glState().bindTexture(7, GL_TEXTURE_2D, this->g_velocity);
 
 
   this->post_shader.use();
-  this->post_shader.setInt("uShadingColor", 11);
-  this->post_shader.setInt("uPreFrame", 12);
-  this->post_shader.setInt("uPosition", 0);
-  this->post_shader.setInt("uNormal", 1);
-  this->post_shader.setInt("uBaseColor", 2);
-  this->post_shader.setInt("uRMO", 3);
-  this->post_shader.setInt("uDepth", 4);
-  this->post_shader.setInt("uBRDFLut_ibl", 5);
-  this->post_shader.setInt("uPrefilterMap", 6);
-  this->post_shader.setInt("uVelocity", 7);
-
-  this->post_shader.setInt("uFrameCount", frame_idx);
-  this->post_shader.setMat4("uViewMatrix", view);
-  this->post_shader.setMat4("uWorldToScreen", projection * view);
-  this->post_shader.setVec3("uCameraPos", camera.Position);
-  glBindVertexArray(this->quad_vao);
+  glState().bindVertexArray(this->quad_vao);
   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
   drawSkybox(camera);
 
   /* TAA pass */
-  glBindFramebuffer(GL_FRAMEBUFFER, this->taa_fbo);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, this->taa_fbo);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+  glState().viewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
 
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, this->cur_frame);
-  glActiveTexture(GL_TEXTURE1);
-  glBindTexture(GL_TEXTURE_2D, this->pre_frame);
-  glActiveTexture(GL_TEXTURE2);
-  glBindTexture(GL_TEXTURE_2D, this->g_depth);
-  glActiveTexture(GL_TEXTURE3);
-  glBindTexture(GL_TEXTURE_2D, this->g_velocity);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->cur_frame);
+  glState().bindTexture(1, GL_TEXTURE_2D, this->pre_frame);
+  glState().bindTexture(2, GL_TEXTURE_2D, this->g_depth);
+  glState().bindTexture(3, GL_TEXTURE_2D, this->g_velocity);
 
   this->taa_shader.use();
-  this->taa_shader.setInt("uCurFrame", 0);
-  this->taa_shader.setInt("uPreFrame", 1);
-  this->taa_shader.setInt("uDepth", 2);
-  this->taa_shader.setInt("uVelocity", 3);
   this->taa_shader.setFloat("uBlend", blend);
-  glBindVertexArray(this->quad_vao);
+  glState().bindVertexArray(this->quad_vao);
   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
-  glBindFramebuffer(GL_READ_FRAMEBUFFER, this->taa_fbo);
-  glBindTexture(GL_TEXTURE_2D, this->pre_frame);
+  glState().bindFramebuffer(GL_READ_FRAMEBUFFER, this->taa_fbo);
+  glState().bindTexture(0, GL_TEXTURE_2D, this->pre_frame);
   glCopyTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16, 0, 0, SCR_WIDTH, SCR_HEIGHT, 0);
 
   /* final pass */
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glState().bindFramebuffer(GL_FRAMEBUFFER, 0);
   glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-  glViewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
-
-  glActiveTexture(GL_TEXTURE0);
-  glBindTexture(GL_TEXTURE_2D, this->final_color);
-
-  this->final_shader.use();
-  this->final_shader.setInt("uCurFrame", 0);
-  glBindVertexArray(this->quad_vao);
+  glState().viewport(0, 0, SCR_WIDTH, SCR_HEIGHT);
+
+  if (this->show_occlusion) {
+    this->occlusion.uploadDebug();
+    this->occlusion_shader.use();
+  } else {
+    glState().bindTexture(0, GL_TEXTURE_2D, this->final_color);
+    this->final_shader.use();
+  }
+  glState().bindVertexArray(this->quad_vao);
   glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
 
   frame_idx ++;
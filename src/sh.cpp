@@ -0,0 +1,219 @@
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "pool.hpp"
+#include "sh.hpp"
+
+/* fewest face rows a pool job projects */
+#define SH_MIN_BAND_ROWS 32
+
+/*
+  cube face axes in GL order: texel (s, t) of face i looks along
+  major + sc * s_axis + tc * t_axis with sc, tc in [-1, 1]
+*/
+static const float FACE_AXES[6][3][3] = {
+    {{1, 0, 0}, {0, 0, -1}, {0, -1, 0}},  {{-1, 0, 0}, {0, 0, 1}, {0, -1, 0}},
+    {{0, 1, 0}, {1, 0, 0}, {0, 0, 1}},    {{0, -1, 0}, {1, 0, 0}, {0, 0, -1}},
+    {{0, 0, 1}, {1, 0, 0}, {0, -1, 0}},   {{0, 0, -1}, {-1, 0, 0}, {0, -1, 0}}};
+
+sh9_sums_t::sh9_sums_t() {
+  for (int k = 0; k < SH9_COEFFICIENTS; k++)
+    this->rgb[k][0] = this->rgb[k][1] = this->rgb[k][2] = 0.0;
+  this->weight = 0.0;
+}
+
+void sh9_sums_t::add(const sh9_sums_t &other) {
+  for (int k = 0; k < SH9_COEFFICIENTS; k++)
+    for (int c = 0; c < 3; c++)
+      this->rgb[k][c] += other.rgb[k][c];
+  this->weight += other.weight;
+}
+
+sh9_t::sh9_t() {
+  for (int k = 0; k < SH9_COEFFICIENTS; k++)
+    this->coefficients[k] = glm::vec3(0.0f);
+}
+
+glm::vec3 sh9_t::evaluate(const glm::vec3 &n) const {
+  const glm::vec3 *c = this->coefficients;
+  return c[0] + c[1] * n.y + c[2] * n.z + c[3] * n.x + c[4] * (n.x * n.y) +
+         c[5] * (n.y * n.z) + c[6] * (3.0f * n.z * n.z - 1.0f) +
+         c[7] * (n.x * n.z) + c[8] * (n.x * n.x - n.y * n.y);
+}
+
+/* one texel: sc along the face's s axis, row base already holds tc */
+static void projectTexel(const float *axes, float base_x, float base_y,
+                         float base_z, float sc, const float *pixel,
+                         double row[SH9_COEFFICIENTS][3], double *weight) {
+  float x = base_x + sc * axes[0];
+  float y = base_y + sc * axes[1];
+  float z = base_z + sc * axes[2];
+  /* solid angle of a texel falls off with the cube of its distance */
+  float inv = 1.0f / std::sqrt(x * x + y * y + z * z);
+  float w = inv * inv * inv;
+  x *= inv;
+  y *= inv;
+  z *= inv;
+  float basis[SH9_COEFFICIENTS] = {1.0f,  y,     z,
+                                   x,     x * y, y * z,
+                                   3.0f * z * z - 1.0f, x * z, x * x - y * y};
+  for (int k = 0; k < SH9_COEFFICIENTS; k++) {
+    float wb = w * basis[k];
+    row[k][0] += wb * pixel[0];
+    row[k][1] += wb * pixel[1];
+    row[k][2] += wb * pixel[2];
+  }
+  *weight += w;
+}
+
+void projectRowsScalar(const float *pixels, int size, int channels, int face,
+                       int row_begin, int row_end, sh9_sums_t *sums) {
+  const float(*axes)[3] = FACE_AXES[face];
+  float step = 2.0f / size;
+  for (int y = row_begin; y < row_end; y++) {
+    float tc = (y + 0.5f) * step - 1.0f;
+    float base_x = axes[0][0] + tc * axes[2][0];
+    float base_y = axes[0][1] + tc * axes[2][1];
+    float base_z = axes[0][2] + tc * axes[2][2];
+    const float *pixel = pixels + (size_t)y * size * channels;
+    for (int x = 0; x < size; x++, pixel += channels)
+      projectTexel(axes[1], base_x, base_y, base_z, (x + 0.5f) * step - 1.0f,
+                   pixel, sums->rgb, &sums->weight);
+  }
+}
+
+#ifdef __SSE2__
+/* four texels of a row per step, float lanes summed into doubles per row */
+void projectRows(const float *pixels, int size, int channels, int face,
+                 int row_begin, int row_end, sh9_sums_t *sums) {
+  const float(*axes)[3] = FACE_AXES[face];
+  float step = 2.0f / size;
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 three = _mm_set1_ps(3.0f);
+  const __m128 lane = _mm_setr_ps(0.5f, 1.5f, 2.5f, 3.5f);
+  const __m128 vstep = _mm_set1_ps(step);
+  const __m128 sx = _mm_set1_ps(axes[1][0]);
+  const __m128 sy = _mm_set1_ps(axes[1][1]);
+  const __m128 sz = _mm_set1_ps(axes[1][2]);
+  int wide = size & ~3;
+
+  for (int y = row_begin; y < row_end; y++) {
+    float tc = (y + 0.5f) * step - 1.0f;
+    float base_x = axes[0][0] + tc * axes[2][0];
+    float base_y = axes[0][1] + tc * axes[2][1];
+    float base_z = axes[0][2] + tc * axes[2][2];
+    const __m128 bx = _mm_set1_ps(base_x);
+    const __m128 by = _mm_set1_ps(base_y);
+    const __m128 bz = _mm_set1_ps(base_z);
+    const float *row = pixels + (size_t)y * size * channels;
+
+    __m128 acc[SH9_COEFFICIENTS][3];
+    for (int k = 0; k < SH9_COEFFICIENTS; k++)
+      acc[k][0] = acc[k][1] = acc[k][2] = _mm_setzero_ps();
+    __m128 acc_w = _mm_setzero_ps();
+
+    for (int x = 0; x < wide; x += 4) {
+      __m128 sc = _mm_sub_ps(
+          _mm_mul_ps(_mm_add_ps(_mm_set1_ps((float)x), lane), vstep), one);
+      __m128 dx = _mm_add_ps(bx, _mm_mul_ps(sc, sx));
+      __m128 dy = _mm_add_ps(by, _mm_mul_ps(sc, sy));
+      __m128 dz = _mm_add_ps(bz, _mm_mul_ps(sc, sz));
+      __m128 len2 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                               _mm_mul_ps(dz, dz));
+      __m128 inv = _mm_div_ps(one, _mm_sqrt_ps(len2));
+      __m128 w = _mm_mul_ps(_mm_mul_ps(inv, inv), inv);
+      dx = _mm_mul_ps(dx, inv);
+      dy = _mm_mul_ps(dy, inv);
+      dz = _mm_mul_ps(dz, inv);
+
+      const float *p = row + (size_t)x * channels;
+      __m128 r = _mm_setr_ps(p[0], p[channels], p[2 * channels], p[3 * channels]);
+      __m128 g = _mm_setr_ps(p[1], p[channels + 1], p[2 * channels + 1],
+                             p[3 * channels + 1]);
+      __m128 b = _mm_setr_ps(p[2], p[channels + 2], p[2 * channels + 2],
+                             p[3 * channels + 2]);
+
+      __m128 basis[SH9_COEFFICIENTS] = {
+          one,
+          dy,
+          dz,
+          dx,
+          _mm_mul_ps(dx, dy),
+          _mm_mul_ps(dy, dz),
+          _mm_sub_ps(_mm_mul_ps(three, _mm_mul_ps(dz, dz)), one),
+          _mm_mul_ps(dx, dz),
+          _mm_sub_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy))};
+      for (int k = 0; k < SH9_COEFFICIENTS; k++) {
+        __m128 wb = _mm_mul_ps(w, basis[k]);
+        acc[k][0] = _mm_add_ps(acc[k][0], _mm_mul_ps(wb, r));
+        acc[k][1] = _mm_add_ps(acc[k][1], _mm_mul_ps(wb, g));
+        acc[k][2] = _mm_add_ps(acc[k][2], _mm_mul_ps(wb, b));
+      }
+      acc_w = _mm_add_ps(acc_w, w);
+    }
+
+    float lanes[4];
+    for (int k = 0; k < SH9_COEFFICIENTS; k++) {
+      for (int c = 0; c < 3; c++) {
+        _mm_storeu_ps(lanes, acc[k][c]);
+        sums->rgb[k][c] += (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+      }
+    }
+    _mm_storeu_ps(lanes, acc_w);
+    sums->weight += (double)lanes[0] + lanes[1] + lanes[2] + lanes[3];
+
+    for (int x = wide; x < size; x++)
+      projectTexel(axes[1], base_x, base_y, base_z, (x + 0.5f) * step - 1.0f,
+                   row + (size_t)x * channels, sums->rgb, &sums->weight);
+  }
+}
+#else
+void projectRows(const float *pixels, int size, int channels, int face,
+                 int row_begin, int row_end, sh9_sums_t *sums) {
+  projectRowsScalar(pixels, size, channels, face, row_begin, row_end, sums);
+}
+#endif
+
+sh9_sums_t projectFace(const float *pixels, int size, int channels, int face) {
+  int num_bands = std::max(1, std::min(parallelism(), size / SH_MIN_BAND_ROWS));
+  std::vector<sh9_sums_t> bands(num_bands);
+  parallelFor(num_bands, [&](int i) {
+    projectRows(pixels, size, channels, face, size * i / num_bands,
+                size * (i + 1) / num_bands, &bands[i]);
+  });
+
+  sh9_sums_t sums;
+  for (const sh9_sums_t &band : bands)
+    sums.add(band);
+  return sums;
+}
+
+sh9_t irradianceSH9(const sh9_sums_t &sums) {
+  const double PI = 3.14159265358979;
+  /* basis normalization times the cosine lobe's band factor, PI, 2 PI / 3
+     and PI / 4, over PI for the Lambert term */
+  const double Y[SH9_COEFFICIENTS] = {0.282095, 0.488603, 0.488603,
+                                      0.488603, 1.092548, 1.092548,
+                                      0.315392, 1.092548, 0.546274};
+  const double A[SH9_COEFFICIENTS] = {PI,          2.0 * PI / 3.0, 2.0 * PI / 3.0,
+                                      2.0 * PI / 3.0, PI / 4.0,    PI / 4.0,
+                                      PI / 4.0,    PI / 4.0,       PI / 4.0};
+  sh9_t sh;
+  if (sums.weight <= 0.0)
+    return sh;
+  /* the texel weights cover the sphere, 4 PI steradians */
+  double scale = 4.0 * PI / sums.weight;
+  for (int k = 0; k < SH9_COEFFICIENTS; k++) {
+    double factor = scale * Y[k] * Y[k] * A[k] / PI;
+    sh.coefficients[k] =
+        glm::vec3((float)(sums.rgb[k][0] * factor),
+                  (float)(sums.rgb[k][1] * factor),
+                  (float)(sums.rgb[k][2] * factor));
+  }
+  return sh;
+}
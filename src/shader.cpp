@@ -1,7 +1,154 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <system_error>
+
+#include "file.hpp"
+#include "profile.hpp"
 #include "shader.hpp"
+#include "state.hpp"
+
+#define PROGRAM_BINARY_MAGIC 0x47525041 /* "APRG" */
+#define PROGRAM_BINARY_VERSION 1
+#define PROGRAM_BINARY_DIR "../assets/programs/"
+
+struct program_binary_header_t {
+  unsigned int magic;
+  unsigned int version;
+  unsigned long long key;
+  unsigned int format;
+  unsigned int size;
+};
+
+/* defines go after the #version line, which must come first */
+static std::string withDefines(const std::string &code,
+                               const std::vector<std::string> &defines) {
+  if (defines.empty())
+    return code;
+  std::string block;
+  for (const std::string &define : defines)
+    block += "#define " + define + "\n";
+  size_t version = code.find("#version");
+  size_t line_end = version == std::string::npos ? std::string::npos
+                                                 : code.find('\n', version);
+  if (line_end == std::string::npos)
+    return block + code;
+  return code.substr(0, line_end + 1) + block + code.substr(line_end + 1);
+}
+
+/* one file per linked program, named by its key */
+static std::string binaryName(unsigned long long key) {
+  char name[64];
+  snprintf(name, sizeof(name), "%016llx.cache", key);
+  return std::string(PROGRAM_BINARY_DIR) + name;
+}
+
+program_stats_t &programStats() {
+  static program_stats_t stats;
+  return stats;
+}
+
+/* empty when the driver cannot hand out binaries */
+static const std::vector<GLint> &programBinaryFormats() {
+  static std::vector<GLint> formats;
+  static bool queried = false;
+  if (!queried) {
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &count);
+    formats.resize(count);
+    if (count > 0)
+      glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, formats.data());
+    queried = true;
+  }
+  return formats;
+}
+
+/* a binary is only valid for the driver that produced it */
+static unsigned long long programKey(const std::string *codes, int num_codes) {
+  static unsigned long long driver = 0;
+  if (driver == 0) {
+    unsigned int version = PROGRAM_BINARY_VERSION;
+    driver = hashBytes(&version, sizeof(version));
+    GLenum names[] = {GL_VENDOR, GL_RENDERER, GL_VERSION};
+    for (GLenum name : names) {
+      const char *string = (const char *)glGetString(name);
+      if (string != nullptr)
+        driver = hashBytes(string, strlen(string), driver);
+    }
+  }
+  unsigned long long hash = driver;
+  for (int i = 0; i < num_codes; i++) {
+    size_t size = codes[i].size();
+    hash = hashBytes(&size, sizeof(size), hash);
+    hash = hashBytes(codes[i].data(), size, hash);
+  }
+  return hash;
+}
+
+/* the linked program for key, or 0 when there is no usable binary */
+static unsigned int loadProgramBinary(unsigned long long key) {
+  const std::vector<GLint> &formats = programBinaryFormats();
+  if (formats.empty())
+    return 0;
+  mapped_file_t file;
+  if (!file.open(binaryName(key)))
+    return 0;
+  program_binary_header_t header;
+  if (file.size < sizeof(header))
+    return 0;
+  memcpy(&header, file.data, sizeof(header));
+  if (header.magic != PROGRAM_BINARY_MAGIC ||
+      header.version != PROGRAM_BINARY_VERSION || header.key != key ||
+      header.size != file.size - sizeof(header))
+    return 0;
+  if (std::find(formats.begin(), formats.end(), (GLint)header.format) ==
+      formats.end())
+    return 0;
+
+  unsigned int program = glCreateProgram();
+  glProgramBinary(program, header.format, file.data + sizeof(header),
+                  (GLsizei)header.size);
+  GLint linked = GL_FALSE;
+  glGetProgramiv(program, GL_LINK_STATUS, &linked);
+  if (!linked) {
+    glDeleteProgram(program);
+    return 0;
+  }
+  return program;
+}
+
+static void saveProgramBinary(unsigned int program, unsigned long long key) {
+  if (programBinaryFormats().empty())
+    return;
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0)
+    return;
+  std::vector<char> binary(length);
+  GLenum format;
+  glGetProgramBinary(program, length, &length, &format, binary.data());
+
+  program_binary_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = PROGRAM_BINARY_MAGIC;
+  header.version = PROGRAM_BINARY_VERSION;
+  header.key = key;
+  header.format = format;
+  header.size = (unsigned int)length;
+
+  std::error_code ec;
+  std::filesystem::create_directories(PROGRAM_BINARY_DIR, ec);
+  const void *chunks[] = {&header, binary.data()};
+  size_t sizes[] = {sizeof(header), (size_t)length};
+  std::string filename = binaryName(key);
+  if (!writeFileAtomic(filename, chunks, sizes, 2))
+    std::cout << "Failed to write program binary: " << filename << std::endl;
+}
 
 shader_t::shader_t(const char *vertexPath, const char *fragmentPath,
-                   const char *geometryPath) {
+                   const char *geometryPath,
+                   const std::vector<std::string> &defines) {
   std::string vertex_code;
   std::string fragment_code;
   std::string geometry_code;
@@ -24,61 +171,123 @@ shader_t::shader_t(const char *vertexPath, const char *fragmentPath,
     vertex_shader_file.close();
     fragment_shader_file.close();
 
-    vertex_code = vertex_shader_stream.str();
-    fragment_code = fragment_shader_stream.str();
+    vertex_code = withDefines(vertex_shader_stream.str(), defines);
+    fragment_code = withDefines(fragment_shader_stream.str(), defines);
 
     if (geometryPath != nullptr) {
       geometry_shader_file.open(geometryPath);
       std::stringstream geometry_shader_stream;
       geometry_shader_stream << geometry_shader_file.rdbuf();
       geometry_shader_file.close();
-      geometry_code = geometry_shader_stream.str();
+      geometry_code = withDefines(geometry_shader_stream.str(), defines);
     }
   } catch (std::ifstream::failure &e) {
     std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what()
               << std::endl;
   }
-  const char *vertex_shader_code = vertex_code.c_str();
-  const char *fragment_shader_code = fragment_code.c_str();
-
-  unsigned int vertex, fragment;
-
-  vertex = glCreateShader(GL_VERTEX_SHADER);
-  glShaderSource(vertex, 1, &vertex_shader_code, NULL);
-  glCompileShader(vertex);
-  checkCompileErrors(vertex, "VERTEX");
-
-  fragment = glCreateShader(GL_FRAGMENT_SHADER);
-  glShaderSource(fragment, 1, &fragment_shader_code, NULL);
-  glCompileShader(fragment);
-  checkCompileErrors(fragment, "FRAGMENT");
-
-  unsigned int geometry;
-  if (geometryPath != nullptr) {
-    const char *geometry_shader_code = geometry_code.c_str();
-    geometry = glCreateShader(GL_GEOMETRY_SHADER);
-    glShaderSource(geometry, 1, &geometry_shader_code, NULL);
-    glCompileShader(geometry);
-    checkCompileErrors(geometry, "GEOMETRY");
+  std::string codes[] = {vertex_code, fragment_code, geometry_code};
+  GLenum types[] = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER, GL_GEOMETRY_SHADER};
+  create(codes, types, geometryPath != nullptr ? 3 : 2);
+}
+
+shader_t shader_t::compute(const char *computePath,
+                           const std::vector<std::string> &defines) {
+  std::string compute_code;
+  std::ifstream compute_shader_file;
+  compute_shader_file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+  try {
+    compute_shader_file.open(computePath);
+    std::stringstream compute_shader_stream;
+    compute_shader_stream << compute_shader_file.rdbuf();
+    compute_shader_file.close();
+    compute_code = withDefines(compute_shader_stream.str(), defines);
+  } catch (std::ifstream::failure &e) {
+    std::cout << "ERROR::SHADER::FILE_NOT_SUCCESSFULLY_READ: " << e.what()
+              << std::endl;
+  }
+  shader_t shader;
+  GLenum type = GL_COMPUTE_SHADER;
+  shader.create(&compute_code, &type, 1);
+  return shader;
+}
+
+void shader_t::create(const std::string *codes, const GLenum *types,
+                      int num_codes) {
+  stopwatch_t issue;
+  this->num_stages = 0;
+  this->pending = false;
+  this->key = programKey(codes, num_codes);
+  this->ID = loadProgramBinary(this->key);
+  if (this->ID != 0) {
+    programStats().cached++;
+    programStats().issue_ms += issue.ms();
+    return;
   }
-  ID = glCreateProgram();
-  glAttachShader(ID, vertex);
-  glAttachShader(ID, fragment);
-  if (geometryPath != nullptr)
-    glAttachShader(ID, geometry);
-  glLinkProgram(ID);
-  checkCompileErrors(ID, "PROGRAM");
-  glDeleteShader(vertex);
-  glDeleteShader(fragment);
-  if (geometryPath != nullptr)
-    glDeleteShader(geometry);
+
+  /* nothing here waits on the driver, finish() collects the result */
+  this->ID = glCreateProgram();
+  for (int i = 0; i < num_codes; i++) {
+    const char *code = codes[i].c_str();
+    unsigned int stage = glCreateShader(types[i]);
+    glShaderSource(stage, 1, &code, NULL);
+    glCompileShader(stage);
+    glAttachShader(this->ID, stage);
+    this->stage_types[this->num_stages] = types[i];
+    this->stages[this->num_stages++] = stage;
+  }
+  if (!programBinaryFormats().empty())
+    glProgramParameteri(this->ID, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+  glLinkProgram(this->ID);
+  this->pending = true;
+  programStats().compiled++;
+  programStats().issue_ms += issue.ms();
+}
+
+void shader_t::finish() {
+  if (!this->pending)
+    return;
+  stopwatch_t wait;
+  for (int i = 0; i < this->num_stages; i++) {
+    GLenum type = this->stage_types[i];
+    checkCompileErrors(this->stages[i],
+                       type == GL_VERTEX_SHADER     ? "VERTEX"
+                       : type == GL_FRAGMENT_SHADER ? "FRAGMENT"
+                       : type == GL_GEOMETRY_SHADER ? "GEOMETRY"
+                                                    : "COMPUTE");
+    glDetachShader(this->ID, this->stages[i]);
+    glDeleteShader(this->stages[i]);
+  }
+  this->num_stages = 0;
+  this->pending = false;
+  if (checkCompileErrors(this->ID, "PROGRAM"))
+    saveProgramBinary(this->ID, this->key);
+  programStats().wait_ms += wait.ms();
 }
 
 shader_t::shader_t() {
+  this->ID = 0;
+  this->key = 0;
+  this->num_stages = 0;
+  this->pending = false;
+}
 
+void shader_t::use() {
+  finish();
+  glState().useProgram(ID);
 }
 
-void shader_t::use() { glUseProgram(ID); }
+void shader_t::bindSampler(const std::string &name, int unit) {
+  finish();
+  glState().useProgram(ID);
+  glUniform1i(glGetUniformLocation(ID, name.c_str()), unit);
+}
+
+void shader_t::bindBlock(const std::string &name, unsigned int binding) {
+  finish();
+  unsigned int index = glGetUniformBlockIndex(ID, name.c_str());
+  if (index != GL_INVALID_INDEX)
+    glUniformBlockBinding(ID, index, binding);
+}
 
 void shader_t::setBool(const std::string &name, bool value) const {
   glUniform1i(glGetUniformLocation(ID, name.c_str()), (int)value);
@@ -109,6 +318,11 @@ void shader_t::setVec3(const std::string &name, float x, float y,
   glUniform3f(glGetUniformLocation(ID, name.c_str()), x, y, z);
 }
 
+void shader_t::setVec3Array(const std::string &name, const glm::vec3 *values,
+                            int count) const {
+  glUniform3fv(glGetUniformLocation(ID, name.c_str()), count, &values[0][0]);
+}
+
 void shader_t::setVec4(const std::string &name, const glm::vec4 &value) const {
   glUniform4fv(glGetUniformLocation(ID, name.c_str()), 1, &value[0]);
 }
@@ -118,6 +332,11 @@ void shader_t::setVec4(const std::string &name, float x, float y, float z,
   glUniform4f(glGetUniformLocation(ID, name.c_str()), x, y, z, w);
 }
 
+void shader_t::setVec4Array(const std::string &name, const glm::vec4 *values,
+                            int count) const {
+  glUniform4fv(glGetUniformLocation(ID, name.c_str()), count, &values[0][0]);
+}
+
 void shader_t::setMat2(const std::string &name, const glm::mat2 &mat) const {
   glUniformMatrix2fv(glGetUniformLocation(ID, name.c_str()), 1, GL_FALSE,
                      &mat[0][0]);
@@ -133,7 +352,7 @@ void shader_t::setMat4(const std::string &name, const glm::mat4 &mat) const {
                      &mat[0][0]);
 }
 
-void shader_t::checkCompileErrors(GLuint shader, std::string type) {
+bool shader_t::checkCompileErrors(GLuint shader, std::string type) {
   GLint success;
   GLchar info_log[1024];
   if (type != "PROGRAM") {
@@ -157,4 +376,57 @@ void shader_t::checkCompileErrors(GLuint shader, std::string type) {
           << std::endl;
     }
   }
-}
\ No newline at end of file
+  return success;
+}
+program_cache_t::program_cache_t() { this->link = nullptr; }
+
+program_cache_t::program_cache_t(const char *vertexPath,
+                                 const char *fragmentPath,
+                                 const char *const *defines, int num_defines,
+                                 void (*link)(shader_t &shader)) {
+  this->vertex_path = vertexPath;
+  this->fragment_path = fragmentPath;
+  for (int i = 0; i < num_defines; i++)
+    this->defines.push_back(defines[i]);
+  this->link = link;
+}
+
+static std::vector<std::string> enabledDefines(
+    const std::vector<std::string> &defines, unsigned int features) {
+  std::vector<std::string> enabled;
+  for (size_t i = 0; i < defines.size(); i++) {
+    if (features & (1u << i))
+      enabled.push_back(defines[i]);
+  }
+  return enabled;
+}
+
+void program_cache_t::prepare(unsigned int features) {
+  if (this->programs.count(features) > 0)
+    return;
+  this->programs[features] =
+      shader_t(this->vertex_path.c_str(), this->fragment_path.c_str(), nullptr,
+               enabledDefines(this->defines, features));
+  this->linked[features] = false;
+}
+
+shader_t *program_cache_t::get(unsigned int features) {
+  auto found = this->programs.find(features);
+  if (found != this->programs.end() && this->linked[features])
+    return &found->second;
+
+  stopwatch_t compile;
+  prepare(features);
+  shader_t &shader = this->programs[features];
+  if (this->link != nullptr)
+    this->link(shader);
+  shader.finish();
+  this->linked[features] = true;
+  if (VERBOSE_ASSETS)
+    printf("%s permutation 0x%x ready in %.1f ms, %d cached\n",
+           this->fragment_path.c_str(), features, compile.ms(),
+           (int)this->programs.size());
+  return &shader;
+}
+
+int program_cache_t::size() const { return (int)this->programs.size(); }
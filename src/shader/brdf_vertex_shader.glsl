@@ -1,11 +0,0 @@
-#version 330 core
-layout (location = 0) in vec3 aPos;
-layout (location = 1) in vec2 aTex;
-
-out vec2 vTextureCoord;
-
-void main()
-{
-    vTextureCoord = aTex;
-	  gl_Position = vec4(aPos, 1.0);
-}
\ No newline at end of file
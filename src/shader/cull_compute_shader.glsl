@@ -0,0 +1,138 @@
+#version 430 core
+layout(local_size_x = 64) in;
+
+/* frame_uniforms_t in uniforms.hpp */
+layout(std140) uniform FrameBlock {
+  mat4 uViewMatrix;
+  mat4 uProjectionMatrix;
+  mat4 uPreViewMatrix;
+  mat4 uPreProjectionMatrix;
+  mat4 uWorldToScreen;
+  mat4 uLightView;
+  mat4 uLightProjection;
+  mat4 uLightWorldToScreen;
+  vec3 uCameraPos;
+  int uOffsetIdx;
+  vec3 uLightPos;
+  int uFrameCount;
+  /* vertex format of the geometry arena */
+  bool uQuantized;
+};
+
+/* instance_data_t, cull_object_t and draw_command_t in queue.hpp */
+struct Instance {
+  mat4 model;
+  vec4 basecolor;
+  vec4 offset_metalness;
+  vec4 scale_roughness;
+};
+struct CullObject {
+  vec3 bounds_min;
+  uint batch;
+  vec3 bounds_max;
+  uint padding;
+};
+struct Command {
+  uint count;
+  uint instance_count;
+  uint first_index;
+  int base_vertex;
+  uint base_instance;
+};
+
+layout(std430, binding = 0) readonly buffer Instances { Instance instances[]; };
+layout(std430, binding = 1) readonly buffer Objects { CullObject objects[]; };
+layout(std430, binding = 2) buffer Commands { Command commands[]; };
+layout(std430, binding = 3) writeonly buffer Culled { Instance culled[]; };
+
+/* where this frame's segment of each ring starts, in records */
+uniform int uFirstInstance;
+uniform int uFirstObject;
+uniform int uFirstCommand;
+/* the pass's items */
+uniform int uFirstItem;
+uniform int uItemCount;
+/* farthest depth of last frame, mip 0 at half resolution */
+uniform sampler2D uDepthPyramid;
+/* of mip 0; each level is half the one above, rounded down, as GL sizes
+   mips, and not taken from textureSize, which some drivers round up */
+uniform int uPyramidWidth;
+uniform int uPyramidHeight;
+uniform int uPyramidLevels;
+uniform bool uOcclusion;
+
+vec3 corner(CullObject object, int i) {
+  return mix(object.bounds_min, object.bounds_max,
+             vec3(i & 1, (i >> 1) & 1, (i >> 2) & 1));
+}
+
+bool outsideFrustum(CullObject object, mat4 to_clip) {
+  /* a bit per plane a corner is behind, set only if every corner is */
+  int outside = 63;
+  for (int i = 0; i < 8; i++) {
+    vec4 clip = to_clip * vec4(corner(object, i), 1.0);
+    int planes = 0;
+    planes |= clip.x < -clip.w ? 1 : 0;
+    planes |= clip.x > clip.w ? 2 : 0;
+    planes |= clip.y < -clip.w ? 4 : 0;
+    planes |= clip.y > clip.w ? 8 : 0;
+    planes |= clip.z < -clip.w ? 16 : 0;
+    planes |= clip.z > clip.w ? 32 : 0;
+    outside &= planes;
+  }
+  return outside != 0;
+}
+
+/* the box against the depth of last frame, seen the way last frame was */
+bool occluded(CullObject object, mat4 to_pre_clip) {
+  vec3 lower = vec3(1.0), upper = vec3(-1.0);
+  for (int i = 0; i < 8; i++) {
+    vec4 clip = to_pre_clip * vec4(corner(object, i), 1.0);
+    /* crossing the eye plane, the projection says nothing */
+    if (clip.w <= 0.0)
+      return false;
+    vec3 ndc = clip.xyz / clip.w;
+    lower = min(lower, ndc);
+    upper = max(upper, ndc);
+  }
+  /* in pixels of the depth buffer, a pixel wider for the TAA jitter */
+  ivec2 pyramid_size = ivec2(uPyramidWidth, uPyramidHeight);
+  vec2 depth_size = vec2(pyramid_size * 2);
+  vec2 low = clamp(lower.xy * 0.5 + 0.5, 0.0, 1.0) * depth_size - 1.0;
+  vec2 high = clamp(upper.xy * 0.5 + 0.5, 0.0, 1.0) * depth_size + 1.0;
+  low = max(low, vec2(0.0));
+  high = min(high, depth_size - 1.0);
+
+  /* the level where the box spans at most two texels each way; a pixel
+     p falls into texel p >> (level + 1), the last one taking the rest */
+  float extent = max(high.x - low.x, high.y - low.y) + 1.0;
+  int level = clamp(int(ceil(log2(extent))) - 1, 0, uPyramidLevels - 1);
+  ivec2 last = max(pyramid_size >> level, 1) - 1;
+  ivec2 first_texel = min(ivec2(low) >> (level + 1), last);
+  ivec2 last_texel = min(ivec2(high) >> (level + 1), last);
+  float farthest = max(
+      max(texelFetch(uDepthPyramid, first_texel, level).r,
+          texelFetch(uDepthPyramid, ivec2(last_texel.x, first_texel.y), level).r),
+      max(texelFetch(uDepthPyramid, ivec2(first_texel.x, last_texel.y), level).r,
+          texelFetch(uDepthPyramid, last_texel, level).r));
+  return lower.z * 0.5 + 0.5 > farthest;
+}
+
+void main() {
+  int index = int(gl_GlobalInvocationID.x);
+  if (index >= uItemCount)
+    return;
+  int item = uFirstItem + index;
+  Instance instance = instances[uFirstInstance + item];
+  CullObject object = objects[uFirstObject + item];
+
+  if (outsideFrustum(object, uProjectionMatrix * uViewMatrix * instance.model))
+    return;
+  if (uOcclusion &&
+      occluded(object, uPreProjectionMatrix * uPreViewMatrix * instance.model))
+    return;
+
+  uint command = uFirstCommand + object.batch;
+  uint slot = atomicAdd(commands[command].instance_count, 1u);
+  culled[commands[command].base_instance + slot] = instance;
+}
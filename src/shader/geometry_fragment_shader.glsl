@@ -1,5 +1,8 @@
 #version 330 core
 in vec2 vTextureCoord;
+/* factors of the instance's material */
+flat in vec4 vBasecolor;
+flat in vec2 vMetalnessRoughness;
 in vec3 vNormal;
 in vec3 vFragPos;
 in vec3 vTangent;
@@ -9,19 +12,17 @@ in float vDepth;
 in vec4 vPrePos;
 in vec4 vCurPos;
 
-uniform int uEnableBump;
-uniform int uEnableOcclusion;
-uniform int uEnableEmission;
-
-uniform vec4 uBasecolor;
-uniform float uMetalness;
-uniform float uRoughness;
+/*
+  permutation defines, one per material map the model has, see
+  Material_Feature: HAS_BASECOLOR_MAP, HAS_ROUGHNESS_MAP,
+  HAS_METALNESS_MAP, HAS_OCCLUSION_MAP, HAS_NORMAL_MAP, HAS_EMISSION_MAP;
+  without one the matching factor or default stands in
+*/
 
 uniform sampler2D uBasecolorMap;
-uniform sampler2D uMetalnessMap;
-uniform sampler2D uRoughnessMap;
+/* roughness, metalness, occlusion in r, g, b */
+uniform sampler2D uRMOMap;
 uniform sampler2D uNormalMap;
-uniform sampler2D uOcclusionMap;
 uniform sampler2D uEmissionMap;
 
 
@@ -39,50 +40,58 @@ void main() {
   gDepth = gl_FragCoord.z;
 
   vec3 N = normalize(vNormal);
-  if (uEnableBump == 1) {
+#ifdef HAS_NORMAL_MAP
+  {
     vec3 T = normalize(vTangent);
     vec3 B = normalize(vBitangent);
     mat3 TBN = mat3(T, B, N);
-    vec3 mapNormal = normalize(texture(uNormalMap, vTextureCoord).rgb * 2.0 - 1.0);
+    /* two-channel maps store xy only, z is rebuilt from the unit length */
+    vec2 mapXY = texture(uNormalMap, vTextureCoord).rg * 2.0 - 1.0;
+    vec3 mapNormal = vec3(mapXY, sqrt(max(0.0, 1.0 - dot(mapXY, mapXY))));
     N = TBN * mapNormal;
   }
+#endif
   gNormal = N;
 
   vec3 albedo;
-  if (uBasecolor.r < 0) {
-    albedo = pow(texture(uBasecolorMap, vTextureCoord).rgb, vec3(2.2));
-  } else {
-    albedo = pow(uBasecolor.rgb, vec3(2.2));
-  }
+#ifdef HAS_BASECOLOR_MAP
+  albedo = pow(texture(uBasecolorMap, vTextureCoord).rgb, vec3(2.2));
+#else
+  albedo = pow(vBasecolor.rgb, vec3(2.2));
+#endif
   gBasecolor = vec4(albedo, 1.0);
 
-  float roughness;
-  if (uRoughness < 0) {
-    roughness = clamp(texture(uRoughnessMap, vTextureCoord).r, 0.001, 0.999);
-  } else {
-    roughness = clamp(uRoughness, 0.001, 0.999);
-  }
+  /* one fetch serves all three channels */
+#if defined(HAS_ROUGHNESS_MAP) || defined(HAS_METALNESS_MAP) || defined(HAS_OCCLUSION_MAP)
+  vec3 rmo = texture(uRMOMap, vTextureCoord).rgb;
+#endif
+
+#ifdef HAS_ROUGHNESS_MAP
+  float roughness = clamp(rmo.r, 0.001, 0.999);
+#else
+  float roughness = clamp(vMetalnessRoughness.y, 0.001, 0.999);
+#endif
   gRMO.r = roughness;
 
-  float metallic;
-  if (uMetalness < 0) {
-    metallic = texture(uMetalnessMap, vTextureCoord).r;
-  } else {
-    metallic = uMetalness;
-  }
+#ifdef HAS_METALNESS_MAP
+  float metallic = rmo.g;
+#else
+  float metallic = vMetalnessRoughness.x;
+#endif
   gRMO.g = metallic;
 
+#ifdef HAS_OCCLUSION_MAP
+  float occlusion = rmo.b;
+#else
   float occlusion = 1.0f;
-  if (uEnableOcclusion == 1) {
-    occlusion = texture(uOcclusionMap, vTextureCoord).r;
-  }
+#endif
   gRMO.b = occlusion;
 
-  if (uEnableEmission == 1) {
-    gEmission = pow(texture(uEmissionMap, vTextureCoord).rgb, vec3(2.2));
-  }else {
-    gEmission = vec3(0.0);
-  }
+#ifdef HAS_EMISSION_MAP
+  gEmission = pow(texture(uEmissionMap, vTextureCoord).rgb, vec3(2.2));
+#else
+  gEmission = vec3(0.0);
+#endif
 
   vec2 preScreen = ((vPrePos.xy / vPrePos.w) * vec2(0.5) + vec2(0.5));
   vec2 curScreen = ((vCurPos.xy / vCurPos.w) * vec2(0.5) + vec2(0.5));
@@ -3,16 +3,34 @@ layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec2 aTex;
 layout(location = 2) in vec3 aNor;
 layout(location = 3) in vec4 aTan;
-uniform mat4 uModelMatrix;
-uniform mat4 uViewMatrix;
-uniform mat4 uProjectionMatrix;
+/* per instance, instance_data_t in queue.hpp */
+layout(location = 4) in mat4 aModelMatrix;
+layout(location = 8) in vec4 aBasecolor;
+/* position offset and scale in xyz, metalness and roughness in w */
+layout(location = 9) in vec4 aOffsetMetalness;
+layout(location = 10) in vec4 aScaleRoughness;
 
-uniform mat4 uPreViewMatrix;
-uniform mat4 uPreProjectionMatrix;
-
-uniform int uOffsetIdx;
+/* frame_uniforms_t in uniforms.hpp */
+layout(std140) uniform FrameBlock {
+  mat4 uViewMatrix;
+  mat4 uProjectionMatrix;
+  mat4 uPreViewMatrix;
+  mat4 uPreProjectionMatrix;
+  mat4 uWorldToScreen;
+  mat4 uLightView;
+  mat4 uLightProjection;
+  mat4 uLightWorldToScreen;
+  vec3 uCameraPos;
+  int uOffsetIdx;
+  vec3 uLightPos;
+  int uFrameCount;
+  /* vertex format of the geometry arena */
+  bool uQuantized;
+};
 
 out vec2 vTextureCoord;
+flat out vec4 vBasecolor;
+flat out vec2 vMetalnessRoughness;
 out vec3 vNormal;
 out vec3 vFragPos;
 out vec3 vTangent;
@@ -34,16 +52,35 @@ const vec2 Halton_2_3[8] = vec2[8]
     vec2(-7.0f / 8.0f, 7.0f / 9.0f)
 );
 
+vec3 octDecode(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+  return normalize(n);
+}
+
 void main() {
-  vFragPos = (uModelMatrix * vec4(aPos, 1.0)).xyz;
-  vNormal = (uModelMatrix * vec4(aNor, 0.0)).xyz;
+  vec3 position = aOffsetMetalness.xyz + aPos * aScaleRoughness.xyz;
+  vec3 normal = aNor;
+  vec4 tangent = aTan;
+  if (uQuantized) {
+    /* oct-encoded snorm16, tangent handedness in the low bit of y */
+    int tangent_y = int(aTan.y);
+    normal = octDecode(aNor.xy / 32767.0);
+    tangent.xyz = octDecode(vec2(aTan.x, float(tangent_y & ~1)) / 32767.0);
+    tangent.w = (tangent_y & 1) != 0 ? -1.0 : 1.0;
+  }
+  vFragPos = (aModelMatrix * vec4(position, 1.0)).xyz;
+  vNormal = (aModelMatrix * vec4(normal, 0.0)).xyz;
   vTextureCoord = aTex;
-  vTangent = (uModelMatrix * vec4(aTan.xyz, 0.0)).xyz;
-  vBitangent = cross(vNormal, vTangent) * aTan.w;
+  vBasecolor = aBasecolor;
+  vMetalnessRoughness = vec2(aOffsetMetalness.w, aScaleRoughness.w);
+  vTangent = (aModelMatrix * vec4(tangent.xyz, 0.0)).xyz;
+  vBitangent = cross(vNormal, vTangent) * tangent.w;
 
 
-  vPrePos = uPreProjectionMatrix * uPreViewMatrix * uModelMatrix * vec4(aPos, 1.0);
-  vCurPos = uProjectionMatrix * uViewMatrix * uModelMatrix * vec4(aPos, 1.0);
+  vPrePos = uPreProjectionMatrix * uPreViewMatrix * aModelMatrix * vec4(position, 1.0);
+  vCurPos = uProjectionMatrix * uViewMatrix * aModelMatrix * vec4(position, 1.0);
 
   float deltaWidth = 1.0 / 1080, deltaHeight = 1.0 / 1080;
   vec2 jitter = vec2(
@@ -54,7 +91,7 @@ void main() {
   jitterMat[2][0] += jitter.x;
   jitterMat[2][1] += jitter.y;
 
-  gl_Position = jitterMat * uViewMatrix * uModelMatrix * vec4(aPos, 1.0);
+  gl_Position = jitterMat * uViewMatrix * aModelMatrix * vec4(position, 1.0);
   vDepth = gl_Position.w;
 
 }
\ No newline at end of file
@@ -0,0 +1,12 @@
+#version 330 core
+in vec2 vTextureCoord;
+
+/* 1 / w of the nearest occluder, 0 where there is none */
+uniform sampler2D uOcclusion;
+
+out vec4 FragColor;
+
+void main() {
+  float depth = texture(uOcclusion, vTextureCoord).r;
+  FragColor = vec4(vec3(1.0 - exp(-4.0 * depth)), 1.0);
+}
@@ -4,35 +4,50 @@
 
 #version 330 core
 in vec2 vTextureCoord;
+/* factors of the instance's material */
+flat in vec4 vBasecolor;
+flat in vec2 vMetalnessRoughness;
 in vec3 vNormal;
 in vec3 vFragPos;
 in vec4 vShadowPos;
 in vec3 vTangent;
 in vec3 vBitangent;
 
-uniform int uEnableBump;
-uniform int uEnableOcclusion;
-uniform int uEnableEmission;
-
-uniform vec3 uLightPos;
-uniform vec3 uCameraPos;
+/*
+  permutation defines, one per material map the model has, see
+  Material_Feature: HAS_BASECOLOR_MAP, HAS_ROUGHNESS_MAP,
+  HAS_METALNESS_MAP, HAS_OCCLUSION_MAP, HAS_NORMAL_MAP, HAS_EMISSION_MAP;
+  without one the matching factor or default stands in
+*/
 
-uniform vec4 uBasecolor;
-uniform float uMetalness;
-uniform float uRoughness;
+/* frame_uniforms_t in uniforms.hpp */
+layout(std140) uniform FrameBlock {
+  mat4 uViewMatrix;
+  mat4 uProjectionMatrix;
+  mat4 uPreViewMatrix;
+  mat4 uPreProjectionMatrix;
+  mat4 uWorldToScreen;
+  mat4 uLightView;
+  mat4 uLightProjection;
+  mat4 uLightWorldToScreen;
+  vec3 uCameraPos;
+  int uOffsetIdx;
+  vec3 uLightPos;
+  int uFrameCount;
+  /* vertex format of the geometry arena */
+  bool uQuantized;
+};
 
 uniform sampler2D uBasecolorMap;
-uniform sampler2D uMetalnessMap;
-uniform sampler2D uRoughnessMap;
+/* roughness, metalness, occlusion in r, g, b */
+uniform sampler2D uRMOMap;
 uniform sampler2D uNormalMap;
-uniform sampler2D uOcclusionMap;
 uniform sampler2D uEmissionMap;
 
 uniform samplerCube uPrefilterMap;
-uniform sampler2D uBRDFLut_ibl;
-
+/* split-sum scale and bias in rg, directional albedo E in b and its
+   cosine-weighted average in a */
 uniform sampler2D uBRDFLut;
-uniform sampler2D uEavgLut;
 
 uniform sampler2D uShadowMap;
  
@@ -81,16 +96,16 @@ vec3 AverageFresnel(vec3 r, vec3 g) {
 
 vec3 MultiScatterBRDF(float NdotL, float NdotV, float roughness) {
   vec3 albedo;
-  if (uBasecolor.r < 0) {
-    albedo = pow(texture(uBasecolorMap, vTextureCoord).rgb, vec3(2.2));
-  } else {
-    albedo = pow(uBasecolor.rgb, vec3(2.2));
-  }
-
-  vec3 Eo = texture(uBRDFLut, vec2(NdotL, roughness)).xyz;
-  vec3 Ei = texture(uBRDFLut, vec2(NdotV, roughness)).xyz;
+#ifdef HAS_BASECOLOR_MAP
+  albedo = pow(texture(uBasecolorMap, vTextureCoord).rgb, vec3(2.2));
+#else
+  albedo = pow(vBasecolor.rgb, vec3(2.2));
+#endif
 
-  vec3 Eavg = texture2D(uEavgLut, vec2(0, roughness)).xyz;
+  vec4 lut = texture(uBRDFLut, vec2(NdotV, roughness));
+  vec3 Eo = vec3(texture(uBRDFLut, vec2(NdotL, roughness)).b);
+  vec3 Ei = vec3(lut.b);
+  vec3 Eavg = vec3(lut.a);
 
   vec3 edgetint = vec3(0.827, 0.792, 0.678);
   vec3 Favg = AverageFresnel(albedo, edgetint);
@@ -103,30 +118,38 @@ vec3 MultiScatterBRDF(float NdotL, float NdotV, float roughness) {
 
 void main() {
   vec3 albedo;
-  if (uBasecolor.r < 0) {
-    albedo = pow(texture(uBasecolorMap, vTextureCoord).rgb, vec3(2.2));
-  } else {
-    albedo = pow(uBasecolor.rgb, vec3(2.2));
-  }
+#ifdef HAS_BASECOLOR_MAP
+  albedo = pow(texture(uBasecolorMap, vTextureCoord).rgb, vec3(2.2));
+#else
+  albedo = pow(vBasecolor.rgb, vec3(2.2));
+#endif
 
   vec3 N = normalize(vNormal);
   
-  if (uEnableBump == 1) {
+#ifdef HAS_NORMAL_MAP
+  {
     vec3 T = normalize(vTangent);
     vec3 B = normalize(vBitangent);
     mat3 TBN = mat3(T, B, N);
-    vec3 normal_from_map = normalize(texture(uNormalMap, vTextureCoord).rgb * 2.0 - 1.0);
+    /* two-channel maps store xy only, z is rebuilt from the unit length */
+    vec2 xy_from_map = texture(uNormalMap, vTextureCoord).rg * 2.0 - 1.0;
+    vec3 normal_from_map = vec3(xy_from_map, sqrt(max(0.0, 1.0 - dot(xy_from_map, xy_from_map))));
     N = TBN * normal_from_map;
   }
+#endif
   vec3 V = normalize(uCameraPos - vFragPos);
   float NdotV = max(dot(N, V), 0.0);
 
-  float metallic;
-  if (uMetalness < 0) {
-    metallic = texture(uMetalnessMap, vTextureCoord).r;
-  } else {
-    metallic = uMetalness;
-  }
+  /* one fetch serves all three channels */
+#if defined(HAS_ROUGHNESS_MAP) || defined(HAS_METALNESS_MAP) || defined(HAS_OCCLUSION_MAP)
+  vec3 rmo = texture(uRMOMap, vTextureCoord).rgb;
+#endif
+
+#ifdef HAS_METALNESS_MAP
+  float metallic = rmo.g;
+#else
+  float metallic = vMetalnessRoughness.x;
+#endif
 
   vec3 F0 = vec3(0.04);
   F0 = mix(F0, albedo, metallic);
@@ -140,12 +163,11 @@ void main() {
 
   vec3 radiance = vec3(1.0f, 1.0f, 1.0f);
 
-  float roughness;
-  if (uRoughness < 0) {
-    roughness = clamp(texture(uRoughnessMap, vTextureCoord).r, 0.001, 0.999);
-  } else {
-    roughness = clamp(uRoughness, 0.001, 0.999);
-  }
+#ifdef HAS_ROUGHNESS_MAP
+  float roughness = clamp(rmo.r, 0.001, 0.999);
+#else
+  float roughness = clamp(vMetalnessRoughness.y, 0.001, 0.999);
+#endif
 
   float NDF = DistributionGGX(N, H, roughness);
   float G = GeometrySmith(N, V, L, roughness);
@@ -164,21 +186,21 @@ void main() {
   vec3 R = reflect(-V, N);
   const float MAX_LOD = 4.0;
   vec3 prefilterColor = textureLod(uPrefilterMap, R, roughness * MAX_LOD).rgb;
-  vec2 envBRDF =
-      texture(uBRDFLut_ibl, vec2(max(dot(N, V), 0.0)), roughness).rg;
+  vec2 envBRDF = texture(uBRDFLut, vec2(NdotV, roughness)).rg;
+#ifdef HAS_OCCLUSION_MAP
+  float occlusion = rmo.b;
+#else
   float occlusion = 1.0f;
-  if (uEnableOcclusion == 1) {
-    occlusion = texture(uOcclusionMap, vTextureCoord).r;
-  }
+#endif
   vec3 Fibl = FresnelSchlickRoughness(max(dot(N, V), 0.0), F0, roughness);
   vec3 ibl = prefilterColor * (Fibl * envBRDF.x + envBRDF.y) * occlusion;
 
   Lo += radiance * BRDF * NdotL;
   Lo += ibl;
   vec3 color = Lo;
-  if (uEnableEmission == 1) {
-    color += pow(texture(uEmissionMap, vTextureCoord).rgb,vec3(2.2));
-  }
+#ifdef HAS_EMISSION_MAP
+  color += pow(texture(uEmissionMap, vTextureCoord).rgb,vec3(2.2));
+#endif
 
   color = color / (color + vec3(1.0));
   color = pow(color, vec3(1.0 / 2.2));
@@ -7,14 +7,34 @@ layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec2 aTex;
 layout(location = 2) in vec3 aNor;
 layout(location = 3) in vec4 aTan;
+/* per instance, instance_data_t in queue.hpp */
+layout(location = 4) in mat4 aModelMatrix;
+layout(location = 8) in vec4 aBasecolor;
+/* position offset and scale in xyz, metalness and roughness in w */
+layout(location = 9) in vec4 aOffsetMetalness;
+layout(location = 10) in vec4 aScaleRoughness;
 
-uniform mat4 uModelMatrix;
-uniform mat4 uViewMatrix;
-uniform mat4 uProjectionMatrix;
-uniform mat4 uLightViewMatrix;
-uniform mat4 uLightProjectionMatrix;
+/* frame_uniforms_t in uniforms.hpp */
+layout(std140) uniform FrameBlock {
+  mat4 uViewMatrix;
+  mat4 uProjectionMatrix;
+  mat4 uPreViewMatrix;
+  mat4 uPreProjectionMatrix;
+  mat4 uWorldToScreen;
+  mat4 uLightView;
+  mat4 uLightProjection;
+  mat4 uLightWorldToScreen;
+  vec3 uCameraPos;
+  int uOffsetIdx;
+  vec3 uLightPos;
+  int uFrameCount;
+  /* vertex format of the geometry arena */
+  bool uQuantized;
+};
 
 out vec2 vTextureCoord;
+flat out vec4 vBasecolor;
+flat out vec2 vMetalnessRoughness;
 out vec3 vNormal;
 out vec3 vFragPos;
 out vec4 vShadowPos;
@@ -22,15 +42,34 @@ out vec3 vTangent;
 out vec3 vBitangent;
 
 
+vec3 octDecode(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.xy += vec2(n.x >= 0.0 ? -t : t, n.y >= 0.0 ? -t : t);
+  return normalize(n);
+}
+
 void main() {
-  vFragPos = (uModelMatrix * vec4(aPos, 1.0)).xyz;
-  vNormal = (uModelMatrix * vec4(aNor, 0.0)).xyz;
+  vec3 position = aOffsetMetalness.xyz + aPos * aScaleRoughness.xyz;
+  vec3 normal = aNor;
+  vec4 tangent = aTan;
+  if (uQuantized) {
+    /* oct-encoded snorm16, tangent handedness in the low bit of y */
+    int tangent_y = int(aTan.y);
+    normal = octDecode(aNor.xy / 32767.0);
+    tangent.xyz = octDecode(vec2(aTan.x, float(tangent_y & ~1)) / 32767.0);
+    tangent.w = (tangent_y & 1) != 0 ? -1.0 : 1.0;
+  }
+  vFragPos = (aModelMatrix * vec4(position, 1.0)).xyz;
+  vNormal = (aModelMatrix * vec4(normal, 0.0)).xyz;
   vTextureCoord = aTex;
-  vShadowPos = uLightProjectionMatrix * uLightViewMatrix * uModelMatrix * vec4(aPos, 1.0);
-  vTangent = (uModelMatrix * vec4(aTan.xyz, 0.0)).xyz;
-  vBitangent = cross(vNormal, vTangent) * aTan.w;
+  vBasecolor = aBasecolor;
+  vMetalnessRoughness = vec2(aOffsetMetalness.w, aScaleRoughness.w);
+  vShadowPos = uLightProjection * uLightView * aModelMatrix * vec4(position, 1.0);
+  vTangent = (aModelMatrix * vec4(tangent.xyz, 0.0)).xyz;
+  vBitangent = cross(vNormal, vTangent) * tangent.w;
 
   gl_Position =
-      uProjectionMatrix * uViewMatrix * uModelMatrix * vec4(aPos, 1.0);
+      uProjectionMatrix * uViewMatrix * aModelMatrix * vec4(position, 1.0);
 
 }
\ No newline at end of file
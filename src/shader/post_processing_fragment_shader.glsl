@@ -8,15 +8,27 @@ uniform sampler2D uDepth;
 uniform sampler2D uBaseColor;
 uniform sampler2D uRMO;
 uniform sampler2D uNormal;
-uniform sampler2D uBRDFLut_ibl;
+uniform sampler2D uBRDFLut;
 uniform samplerCube uPrefilterMap;
 uniform sampler2D uVelocity;
 
-uniform mat4 uViewMatrix;
-uniform mat4 uWorldToScreen;
-
-uniform vec3 uCameraPos;
-uniform int uFrameCount;
+/* frame_uniforms_t in uniforms.hpp */
+layout(std140) uniform FrameBlock {
+  mat4 uViewMatrix;
+  mat4 uProjectionMatrix;
+  mat4 uPreViewMatrix;
+  mat4 uPreProjectionMatrix;
+  mat4 uWorldToScreen;
+  mat4 uLightView;
+  mat4 uLightProjection;
+  mat4 uLightWorldToScreen;
+  vec3 uCameraPos;
+  int uOffsetIdx;
+  vec3 uLightPos;
+  int uFrameCount;
+  /* vertex format of the geometry arena */
+  bool uQuantized;
+};
 
 out vec4 FragColor;
 
@@ -256,7 +268,7 @@ void main() {
   vec3 F0 = vec3(0.04);
   F0 = mix(F0, albedo, metallic);
 
-  vec2 envBRDF = texture(uBRDFLut_ibl, vec2(max(dot(N, V), 0.0)), roughness).rg;
+  vec2 envBRDF = texture(uBRDFLut, vec2(max(dot(N, V), 0.0), roughness)).rg;
 
 
   vec3 R = normalize(reflect(-V, N));
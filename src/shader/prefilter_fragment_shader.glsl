@@ -3,6 +3,15 @@ in vec3 vWorldPos;
 
 uniform samplerCube uEnvironmentMap;
 uniform float uRoughness;
+/* filtered importance sampling: each sample reads the source mip whose
+   texels cover the solid angle the sample stands for; with V = N the
+   samples only depend on roughness, so the table holds the tangent space
+   direction in xyz (z is NdotL) and the source lod in w */
+#define MAX_FILTERED_SAMPLES 240
+uniform bool uFiltered;
+uniform int uSampleCount;
+uniform vec4 uSamples[MAX_FILTERED_SAMPLES];
+uniform float uTotalWeight;
 
 out vec4 FragColor;
 
@@ -55,6 +64,20 @@ void main() {
   vec3 R = N;
   vec3 V = R;
 
+  if (uFiltered) {
+    vec3 up = abs(N.z) < 0.999 ? vec3(0.0, 0.0, 1.0) : vec3(1.0, 0.0, 0.0);
+    vec3 tangent = normalize(cross(up, N));
+    vec3 bitangent = cross(N, tangent);
+    vec3 filteredColor = vec3(0.0);
+    for (int i = 0; i < uSampleCount; ++i) {
+      vec4 s = uSamples[i];
+      vec3 L = tangent * s.x + bitangent * s.y + N * s.z;
+      filteredColor += textureLod(uEnvironmentMap, L, s.w).rgb * s.z;
+    }
+    FragColor = vec4(filteredColor / uTotalWeight, 1.0);
+    return;
+  }
+
   const uint SAMPLE_COUNT = 1024u;
   float totalWeight = 0.0;
   vec3 prefilteredColor = vec3(0.0);
@@ -0,0 +1,36 @@
+#version 430 core
+layout(local_size_x = 8, local_size_y = 8) in;
+
+/* the depth buffer or the pyramid level above the one written */
+uniform sampler2D uSource;
+uniform int uSourceLevel;
+/* passed in, textureSize rounds mip sizes up on some drivers */
+uniform int uSourceWidth;
+uniform int uSourceHeight;
+/* the depth buffer keeps its clear value of 0 where nothing was drawn */
+uniform bool uFromDepth;
+layout(r32f, binding = 0) uniform writeonly image2D uTarget;
+
+void main() {
+  ivec2 texel = ivec2(gl_GlobalInvocationID.xy);
+  ivec2 size = imageSize(uTarget);
+  if (any(greaterThanEqual(texel, size)))
+    return;
+
+  /* the last row and column also take the odd one out of the source */
+  ivec2 source_size = ivec2(uSourceWidth, uSourceHeight);
+  ivec2 first = texel * 2;
+  ivec2 last = first + 1 + ivec2(equal(texel, size - 1)) * (source_size & 1);
+  last = min(last, source_size - 1);
+
+  float farthest = 0.0;
+  for (int y = first.y; y <= last.y; y++) {
+    for (int x = first.x; x <= last.x; x++) {
+      float depth = texelFetch(uSource, ivec2(x, y), uSourceLevel).r;
+      if (uFromDepth && depth == 0.0)
+        depth = 1.0;
+      farthest = max(farthest, depth);
+    }
+  }
+  imageStore(uTarget, texel, vec4(farthest));
+}
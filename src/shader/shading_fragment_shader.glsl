@@ -1,12 +1,23 @@
 #version 330 core
 in vec2 vTextureCoord;
 
-uniform vec3 uLightPos;
-uniform vec3 uCameraPos;
-
-uniform mat4 uWorldToScreen;
-uniform mat4 uLightView;
-uniform mat4 uLightWorldToScreen;
+/* frame_uniforms_t in uniforms.hpp */
+layout(std140) uniform FrameBlock {
+  mat4 uViewMatrix;
+  mat4 uProjectionMatrix;
+  mat4 uPreViewMatrix;
+  mat4 uPreProjectionMatrix;
+  mat4 uWorldToScreen;
+  mat4 uLightView;
+  mat4 uLightProjection;
+  mat4 uLightWorldToScreen;
+  vec3 uCameraPos;
+  int uOffsetIdx;
+  vec3 uLightPos;
+  int uFrameCount;
+  /* vertex format of the geometry arena */
+  bool uQuantized;
+};
 
 uniform sampler2D uPosition;
 uniform sampler2D uNormal;
@@ -16,10 +27,12 @@ uniform sampler2D uEmission;
 uniform sampler2D uDepth;
 uniform sampler2D uShadowMap;
 
-uniform sampler2D uBRDFLut_ibl;
-
+/* split-sum scale and bias in rg, directional albedo E in b and its
+   cosine-weighted average in a */
 uniform sampler2D uBRDFLut;
-uniform sampler2D uEavgLut;
+
+/* SH9 diffuse irradiance of the environment, over PI */
+uniform vec3 uIrradianceSH[9];
 
 out vec4 FragColor;
 
@@ -58,6 +71,15 @@ vec3 FresnelSchlick(vec3 F0, vec3 V, vec3 H) {
   return F0 + (1.0 - F0) * pow(clamp(1.0 - max(dot(H, V), 0.0), 0.0, 1.0), 5.0);
 }
 
+vec3 IrradianceSH(vec3 n) {
+  return uIrradianceSH[0] + uIrradianceSH[1] * n.y + uIrradianceSH[2] * n.z +
+         uIrradianceSH[3] * n.x + uIrradianceSH[4] * (n.x * n.y) +
+         uIrradianceSH[5] * (n.y * n.z) +
+         uIrradianceSH[6] * (3.0 * n.z * n.z - 1.0) +
+         uIrradianceSH[7] * (n.x * n.z) +
+         uIrradianceSH[8] * (n.x * n.x - n.y * n.y);
+}
+
 vec3 FresnelSchlickRoughness(float cosTheta, vec3 F0, float roughness)
 {
     return F0 + (max(vec3(1.0 - roughness), F0) - F0) * pow(clamp(1.0 - cosTheta, 0.0, 1.0), 5.0);
@@ -73,10 +95,10 @@ vec3 AverageFresnel(vec3 r, vec3 g) {
 vec3 MultiScatterBRDF(float NdotL, float NdotV, float roughness) {
   vec3 albedo = texture(uBasecolor, vTextureCoord).rgb;
 
-  vec3 Eo = texture(uBRDFLut, vec2(NdotL, roughness)).xyz;
-  vec3 Ei = texture(uBRDFLut, vec2(NdotV, roughness)).xyz;
-
-  vec3 Eavg = texture2D(uEavgLut, vec2(0, roughness)).xyz;
+  vec4 lut = texture(uBRDFLut, vec2(NdotV, roughness));
+  vec3 Eo = vec3(texture(uBRDFLut, vec2(NdotL, roughness)).b);
+  vec3 Ei = vec3(lut.b);
+  vec3 Eavg = vec3(lut.a);
 
   vec3 edgetint = vec3(0.827, 0.792, 0.678);
   vec3 Favg = AverageFresnel(albedo, edgetint);
@@ -235,6 +257,13 @@ void main() {
   Lo += radiance * BRDF * NdotL;
   vec3 color = ToneMap(Lo) * shadow;
 
+  /* diffuse ambient, not shadowed by the light */
+  vec3 kD_ibl = (vec3(1.0) - FresnelSchlickRoughness(NdotV, F0, roughness)) *
+                (1.0 - metallic);
+  float occlusion = texture(uRMO, vTextureCoord).b;
+  vec3 ambient = kD_ibl * albedo * IrradianceSH(N) * occlusion;
+  color = ToneMap(UnToneMap(color) + ambient);
+
   color += texture(uEmission, vTextureCoord).rgb;
   FragColor = vec4(UnToneMap(color), 1.0);
 }
\ No newline at end of file
@@ -3,14 +3,35 @@ layout(location = 0) in vec3 aPos;
 layout(location = 1) in vec2 aTex;
 layout(location = 2) in vec3 aNor;
 layout(location = 3) in vec4 aTan;
+/* per instance, instance_data_t in queue.hpp */
+layout(location = 4) in mat4 aModelMatrix;
+layout(location = 8) in vec4 aBasecolor;
+/* position offset and scale in xyz, metalness and roughness in w */
+layout(location = 9) in vec4 aOffsetMetalness;
+layout(location = 10) in vec4 aScaleRoughness;
 
-uniform mat4 uModelMatrix;
-uniform mat4 uViewMatrix;
-uniform mat4 uProjectionMatrix;
+/* frame_uniforms_t in uniforms.hpp */
+layout(std140) uniform FrameBlock {
+  mat4 uViewMatrix;
+  mat4 uProjectionMatrix;
+  mat4 uPreViewMatrix;
+  mat4 uPreProjectionMatrix;
+  mat4 uWorldToScreen;
+  mat4 uLightView;
+  mat4 uLightProjection;
+  mat4 uLightWorldToScreen;
+  vec3 uCameraPos;
+  int uOffsetIdx;
+  vec3 uLightPos;
+  int uFrameCount;
+  /* vertex format of the geometry arena */
+  bool uQuantized;
+};
 
 out vec4 vViewSpacePosition;
 
 void main() {
-  gl_Position = uProjectionMatrix * uViewMatrix * uModelMatrix * vec4(aPos, 1.0);
-  vViewSpacePosition = uViewMatrix * uModelMatrix * vec4(aPos, 1.0);
+  vec3 position = aOffsetMetalness.xyz + aPos * aScaleRoughness.xyz;
+  gl_Position = uLightProjection * uLightView * aModelMatrix * vec4(position, 1.0);
+  vViewSpacePosition = uLightView * aModelMatrix * vec4(position, 1.0);
 }
\ No newline at end of file
@@ -0,0 +1,193 @@
+#include "state.hpp"
+
+/* no GL object has this name, so whatever comes first is issued */
+#define STATE_UNKNOWN 0xffffffffu
+
+static int targetSlot(GLenum target) {
+  if (target == GL_TEXTURE_2D)
+    return 0;
+  if (target == GL_TEXTURE_CUBE_MAP)
+    return 1;
+  return -1;
+}
+
+gl_state_t &glState() {
+  static gl_state_t state;
+  return state;
+}
+
+gl_state_t::gl_state_t() { invalidate(); }
+
+void gl_state_t::invalidate() {
+  this->program = STATE_UNKNOWN;
+  this->vao = STATE_UNKNOWN;
+  this->read_fbo = STATE_UNKNOWN;
+  this->draw_fbo = STATE_UNKNOWN;
+  this->active_unit = STATE_UNKNOWN;
+  for (int i = 0; i < STATE_TEXTURE_UNITS; i++) {
+    this->textures[i][0] = STATE_UNKNOWN;
+    this->textures[i][1] = STATE_UNKNOWN;
+  }
+  for (int i = 0; i < 4; i++)
+    this->viewport_rect[i] = -1;
+  this->capabilities.clear();
+  this->depth_func = STATE_UNKNOWN;
+  this->depth_mask = STATE_UNKNOWN;
+  for (int i = 0; i < 3; i++) {
+    this->stencil_func[i] = STATE_UNKNOWN;
+    this->stencil_op[i] = STATE_UNKNOWN;
+  }
+  this->stencil_mask = STATE_UNKNOWN;
+  this->blend_func[0] = this->blend_func[1] = STATE_UNKNOWN;
+}
+
+bool gl_state_t::change(unsigned int *current, unsigned int value) {
+  if (*current == value) {
+    this->stats.filtered++;
+    return false;
+  }
+  *current = value;
+  this->stats.issued++;
+  return true;
+}
+
+void gl_state_t::useProgram(unsigned int program) {
+  if (change(&this->program, program))
+    glUseProgram(program);
+}
+
+void gl_state_t::bindVertexArray(unsigned int vao) {
+  if (change(&this->vao, vao))
+    glBindVertexArray(vao);
+}
+
+void gl_state_t::bindFramebuffer(GLenum target, unsigned int fbo) {
+  if (target == GL_READ_FRAMEBUFFER) {
+    if (change(&this->read_fbo, fbo))
+      glBindFramebuffer(target, fbo);
+  } else if (target == GL_DRAW_FRAMEBUFFER) {
+    if (change(&this->draw_fbo, fbo))
+      glBindFramebuffer(target, fbo);
+  } else if (this->read_fbo == fbo && this->draw_fbo == fbo) {
+    this->stats.filtered++;
+  } else {
+    this->read_fbo = this->draw_fbo = fbo;
+    this->stats.issued++;
+    glBindFramebuffer(target, fbo);
+  }
+}
+
+void gl_state_t::bindTexture(unsigned int unit, GLenum target,
+                             unsigned int texture) {
+  if (change(&this->active_unit, unit))
+    glActiveTexture(GL_TEXTURE0 + unit);
+  int slot = targetSlot(target);
+  if (unit >= STATE_TEXTURE_UNITS || slot < 0) {
+    this->stats.issued++;
+    glBindTexture(target, texture);
+  } else if (change(&this->textures[unit][slot], texture)) {
+    glBindTexture(target, texture);
+  }
+}
+
+void gl_state_t::viewport(int x, int y, int width, int height) {
+  int rect[4] = {x, y, width, height};
+  bool same = true;
+  for (int i = 0; i < 4; i++)
+    same = same && this->viewport_rect[i] == rect[i];
+  if (same) {
+    this->stats.filtered++;
+    return;
+  }
+  for (int i = 0; i < 4; i++)
+    this->viewport_rect[i] = rect[i];
+  this->stats.issued++;
+  glViewport(x, y, width, height);
+}
+
+void gl_state_t::setCapability(GLenum capability, bool enabled) {
+  auto found = this->capabilities.find(capability);
+  if (found != this->capabilities.end() && found->second == enabled) {
+    this->stats.filtered++;
+    return;
+  }
+  this->capabilities[capability] = enabled;
+  this->stats.issued++;
+  if (enabled)
+    glEnable(capability);
+  else
+    glDisable(capability);
+}
+
+void gl_state_t::enable(GLenum capability) { setCapability(capability, true); }
+
+void gl_state_t::disable(GLenum capability) {
+  setCapability(capability, false);
+}
+
+void gl_state_t::depthFunc(GLenum func) {
+  if (change(&this->depth_func, func))
+    glDepthFunc(func);
+}
+
+void gl_state_t::depthMask(bool write) {
+  if (change(&this->depth_mask, write ? GL_TRUE : GL_FALSE))
+    glDepthMask(write ? GL_TRUE : GL_FALSE);
+}
+
+void gl_state_t::stencilFunc(GLenum func, int ref, unsigned int mask) {
+  unsigned int values[3] = {func, (unsigned int)ref, mask};
+  if (values[0] == this->stencil_func[0] && values[1] == this->stencil_func[1] &&
+      values[2] == this->stencil_func[2]) {
+    this->stats.filtered++;
+    return;
+  }
+  for (int i = 0; i < 3; i++)
+    this->stencil_func[i] = values[i];
+  this->stats.issued++;
+  glStencilFunc(func, ref, mask);
+}
+
+void gl_state_t::stencilOp(GLenum stencil_fail, GLenum depth_fail,
+                           GLenum pass) {
+  unsigned int values[3] = {stencil_fail, depth_fail, pass};
+  if (values[0] == this->stencil_op[0] && values[1] == this->stencil_op[1] &&
+      values[2] == this->stencil_op[2]) {
+    this->stats.filtered++;
+    return;
+  }
+  for (int i = 0; i < 3; i++)
+    this->stencil_op[i] = values[i];
+  this->stats.issued++;
+  glStencilOp(stencil_fail, depth_fail, pass);
+}
+
+void gl_state_t::stencilMask(unsigned int mask) {
+  if (change(&this->stencil_mask, mask))
+    glStencilMask(mask);
+}
+
+void gl_state_t::blendFunc(GLenum source, GLenum destination) {
+  if (source == this->blend_func[0] && destination == this->blend_func[1]) {
+    this->stats.filtered++;
+    return;
+  }
+  this->blend_func[0] = source;
+  this->blend_func[1] = destination;
+  this->stats.issued++;
+  glBlendFunc(source, destination);
+}
+
+void gl_state_t::forgetTexture(unsigned int texture) {
+  for (int i = 0; i < STATE_TEXTURE_UNITS; i++) {
+    for (int slot = 0; slot < 2; slot++) {
+      if (this->textures[i][slot] == texture)
+        this->textures[i][slot] = 0;
+    }
+  }
+}
+
+void gl_state_t::forgetVertexArray(unsigned int vao) {
+  if (this->vao == vao)
+    this->vao = 0;
+}
@@ -0,0 +1,769 @@
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <glm.hpp>
+#include <iostream>
+
+#include "file.hpp"
+#include "profile.hpp"
+#include "texture.hpp"
+
+/* false uploads maps exactly as decoded, one uncompressed level each */
+const bool BAKE_TEXTURES = true;
+
+#define TEXTURE_CACHE_MAGIC 0x58455441 /* "ATEX" */
+#define TEXTURE_CACHE_VERSION 2
+
+/*
+  baked texture written next to the source map, a level table of
+  num_levels entries follows the header and the level data follows that,
+  each level at its recorded offset from the end of the table
+*/
+struct texture_cache_header_t {
+  unsigned int magic;
+  unsigned int version;
+  long long source_mtime;
+  unsigned long long source_size;
+  unsigned int internal_format;
+  unsigned int num_levels;
+  unsigned long long raw_bytes;
+  unsigned long long data_bytes;
+};
+
+struct texture_cache_level_t {
+  int width;
+  int height;
+  unsigned long long offset;
+  unsigned long long size;
+};
+
+/* written once on the GL thread before any map is submitted */
+static bool has_s3tc = false;
+
+void initTextureFormats() {
+  static bool checked = false;
+  if (checked)
+    return;
+  checked = true;
+  int num_extensions = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &num_extensions);
+  for (int i = 0; i < num_extensions; i++) {
+    const char *name = (const char *)glGetStringi(GL_EXTENSIONS, i);
+    if (strcmp(name, "GL_EXT_texture_compression_s3tc") == 0)
+      has_s3tc = true;
+  }
+  if (!has_s3tc)
+    std::cout << "No S3TC support, color maps stay uncompressed" << std::endl;
+}
+
+static bool isCompressed(GLenum internal_format) {
+  return internal_format == GL_COMPRESSED_RGB_S3TC_DXT1_EXT ||
+         internal_format == GL_COMPRESSED_RED_RGTC1 ||
+         internal_format == GL_COMPRESSED_RG_RGTC2;
+}
+
+static size_t blockBytes(GLenum internal_format) {
+  return internal_format == GL_COMPRESSED_RG_RGTC2 ? 16 : 8;
+}
+
+static GLenum transferFormat(GLenum internal_format) {
+  switch (internal_format) {
+  case GL_R8:
+  case GL_RED:
+    return GL_RED;
+  case GL_RG8:
+  case GL_RG:
+    return GL_RG;
+  case GL_RGBA8:
+  case GL_RGBA:
+    return GL_RGBA;
+  default:
+    return GL_RGB;
+  }
+}
+
+size_t texture_data_t::rowBytes(int level) const {
+  size_t width = this->levels[level].width;
+  if (this->compressed)
+    return (width + 3) / 4 * blockBytes(this->internal_format);
+  size_t components = this->format == GL_RED  ? 1
+                      : this->format == GL_RG ? 2
+                      : this->format == GL_RGB ? 3
+                                               : 4;
+  size_t texel = this->type == GL_FLOAT        ? sizeof(float)
+                 : this->type == GL_HALF_FLOAT ? sizeof(unsigned short)
+                                               : 1;
+  /* shared-exponent texels pack every component into one word */
+  size_t pixel = this->type == GL_UNSIGNED_INT_5_9_9_9_REV
+                     ? sizeof(unsigned int)
+                     : components * texel;
+  /* the default unpack alignment of 4 */
+  return (width * pixel + 3) & ~(size_t)3;
+}
+
+int texture_data_t::rowHeight() const { return this->compressed ? 4 : 1; }
+
+texture_data_t *textureFromImage(const image_t *image, GLenum internal_format,
+                                 GLenum format, GLenum type) {
+  texture_data_t *data = new texture_data_t();
+  data->internal_format = internal_format;
+  data->format = format;
+  data->type = type;
+  data->compressed = false;
+  /* an image that failed to load becomes one black texel */
+  int width = image->data != nullptr ? image->width : 1;
+  int height = image->data != nullptr ? image->height : 1;
+  data->levels.push_back({width, height, 0, 0});
+  data->levels[0].size = data->rowBytes(0) * height;
+  /* a map whose channel count does not match reads as it always did */
+  data->bytes.assign(data->levels[0].size, 0);
+  if (image->data != nullptr)
+    memcpy(data->bytes.data(), image->data,
+           std::min(image->bytes(), data->levels[0].size));
+  data->raw_bytes = data->levels[0].size;
+  return data;
+}
+
+/* channels a kind is stored with */
+static int kindChannels(Texture_Kind kind) {
+  return kind == DATA_MAP ? 1 : kind == NORMAL_MAP ? 2 : 3;
+}
+
+/* ---- mip chain ---- */
+
+/* one level as floats, linear for color, [-1,1] vectors for normals */
+class float_image_t {
+public:
+  int width;
+  int height;
+  int channels;
+  std::vector<float> texels;
+
+  float *at(int x, int y) {
+    return &this->texels[((size_t)y * this->width + x) * this->channels];
+  }
+};
+
+static float_image_t decodeSource(const image_t *image, Texture_Kind kind) {
+  float_image_t level;
+  level.width = image->width;
+  level.height = image->height;
+  level.channels = kind == DATA_MAP ? 1 : 3;
+  level.texels.resize((size_t)level.width * level.height * level.channels);
+  const unsigned char *src = (const unsigned char *)image->data;
+  int c = image->channels;
+  for (size_t i = 0; i < (size_t)level.width * level.height; i++) {
+    const unsigned char *texel = src + i * c;
+    float *dst = &level.texels[i * level.channels];
+    if (kind == DATA_MAP) {
+      dst[0] = texel[0] / 255.0f;
+      continue;
+    }
+    /* grey maps replicate, alpha is dropped */
+    float rgb[3];
+    for (int k = 0; k < 3; k++)
+      rgb[k] = texel[c >= 3 ? k : 0] / 255.0f;
+    if (kind == COLOR_MAP) {
+      /* filtered in linear space, the shaders decode with a 2.2 gamma */
+      for (int k = 0; k < 3; k++)
+        dst[k] = powf(rgb[k], 2.2f);
+    } else {
+      glm::vec3 normal(rgb[0] * 2.0f - 1.0f, rgb[1] * 2.0f - 1.0f,
+                       rgb[2] * 2.0f - 1.0f);
+      float length = sqrtf(normal.x * normal.x + normal.y * normal.y +
+                           normal.z * normal.z);
+      if (length > 1e-6f)
+        normal /= length;
+      else
+        normal = glm::vec3(0.0f, 0.0f, 1.0f);
+      dst[0] = normal.x;
+      dst[1] = normal.y;
+      dst[2] = normal.z;
+    }
+  }
+  return level;
+}
+
+/* 2x2 box filter, the last row or column repeats on odd sizes */
+static float_image_t downsample(float_image_t &src, Texture_Kind kind) {
+  float_image_t dst;
+  dst.width = std::max(1, src.width / 2);
+  dst.height = std::max(1, src.height / 2);
+  dst.channels = src.channels;
+  dst.texels.resize((size_t)dst.width * dst.height * dst.channels);
+  for (int y = 0; y < dst.height; y++) {
+    int y0 = std::min(y * 2, src.height - 1);
+    int y1 = std::min(y * 2 + 1, src.height - 1);
+    for (int x = 0; x < dst.width; x++) {
+      int x0 = std::min(x * 2, src.width - 1);
+      int x1 = std::min(x * 2 + 1, src.width - 1);
+      float *out = dst.at(x, y);
+      for (int k = 0; k < dst.channels; k++)
+        out[k] = 0.25f * (src.at(x0, y0)[k] + src.at(x1, y0)[k] +
+                          src.at(x0, y1)[k] + src.at(x1, y1)[k]);
+      if (kind == NORMAL_MAP) {
+        float length =
+            sqrtf(out[0] * out[0] + out[1] * out[1] + out[2] * out[2]);
+        if (length > 1e-6f) {
+          for (int k = 0; k < 3; k++)
+            out[k] /= length;
+        } else {
+          out[0] = 0.0f;
+          out[1] = 0.0f;
+          out[2] = 1.0f;
+        }
+      }
+    }
+  }
+  return dst;
+}
+
+static unsigned char toByte(float value) {
+  return (unsigned char)std::min(255.0f, std::max(0.0f, value * 255.0f + 0.5f));
+}
+
+/* back to the bytes the shaders sample: gamma color, unorm data, xy normals */
+static std::vector<unsigned char> encodeLevel(float_image_t &level,
+                                              Texture_Kind kind) {
+  int channels = kindChannels(kind);
+  size_t count = (size_t)level.width * level.height;
+  std::vector<unsigned char> bytes(count * channels);
+  for (size_t i = 0; i < count; i++) {
+    const float *texel = &level.texels[i * level.channels];
+    for (int k = 0; k < channels; k++) {
+      float value = texel[k];
+      if (kind == COLOR_MAP)
+        value = powf(value, 1.0f / 2.2f);
+      else if (kind == NORMAL_MAP)
+        value = value * 0.5f + 0.5f;
+      bytes[i * channels + k] = toByte(value);
+    }
+  }
+  return bytes;
+}
+
+/* ---- block encoders ---- */
+
+/* the 4x4 block at bx, by with edge texels repeated */
+static void fetchBlock(const unsigned char *pixels, int width, int height,
+                       int channels, int bx, int by, unsigned char *block) {
+  for (int y = 0; y < 4; y++) {
+    int sy = std::min(by * 4 + y, height - 1);
+    for (int x = 0; x < 4; x++) {
+      int sx = std::min(bx * 4 + x, width - 1);
+      memcpy(block + (y * 4 + x) * channels,
+             pixels + ((size_t)sy * width + sx) * channels, channels);
+    }
+  }
+}
+
+static unsigned short pack565(const float *color) {
+  int r = (int)std::min(31.0f, std::max(0.0f, color[0] * 31.0f / 255.0f + 0.5f));
+  int g = (int)std::min(63.0f, std::max(0.0f, color[1] * 63.0f / 255.0f + 0.5f));
+  int b = (int)std::min(31.0f, std::max(0.0f, color[2] * 31.0f / 255.0f + 0.5f));
+  return (unsigned short)((r << 11) | (g << 5) | b);
+}
+
+static void unpack565(unsigned short packed, float *color) {
+  int r = (packed >> 11) & 31, g = (packed >> 5) & 63, b = packed & 31;
+  color[0] = (float)((r << 3) | (r >> 2));
+  color[1] = (float)((g << 2) | (g >> 4));
+  color[2] = (float)((b << 3) | (b >> 2));
+}
+
+/* quantizes two endpoints for 4-color mode and picks the nearest palette
+   entry per texel, returns the squared error */
+static float fitBC1(const unsigned char *rgb, const float *end0,
+                    const float *end1, unsigned short *c0, unsigned short *c1,
+                    unsigned int *indices) {
+  *c0 = pack565(end0);
+  *c1 = pack565(end1);
+  if (*c0 < *c1)
+    std::swap(*c0, *c1);
+
+  float palette[4][3];
+  unpack565(*c0, palette[0]);
+  unpack565(*c1, palette[1]);
+  for (int k = 0; k < 3; k++) {
+    palette[2][k] = (2.0f * palette[0][k] + palette[1][k]) / 3.0f;
+    palette[3][k] = (palette[0][k] + 2.0f * palette[1][k]) / 3.0f;
+  }
+  /* equal endpoints select 3-color mode where only index 0 is safe */
+  int num_colors = *c0 == *c1 ? 1 : 4;
+  float total = 0.0f;
+  *indices = 0;
+  for (int i = 0; i < 16; i++) {
+    int best = 0;
+    float best_error = 1e30f;
+    for (int p = 0; p < num_colors; p++) {
+      float error = 0.0f;
+      for (int k = 0; k < 3; k++) {
+        float d = rgb[i * 3 + k] - palette[p][k];
+        error += d * d;
+      }
+      if (error < best_error) {
+        best_error = error;
+        best = p;
+      }
+    }
+    *indices |= (unsigned int)best << (2 * i);
+    total += best_error;
+  }
+  return total;
+}
+
+/* endpoints from the principal axis of the block's colors, 4-color mode */
+static void encodeBC1(const unsigned char *rgb, unsigned char *out) {
+  float mean[3] = {0.0f, 0.0f, 0.0f};
+  for (int i = 0; i < 16; i++)
+    for (int k = 0; k < 3; k++)
+      mean[k] += rgb[i * 3 + k] / 16.0f;
+  float cov[6] = {0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f};
+  for (int i = 0; i < 16; i++) {
+    float d[3];
+    for (int k = 0; k < 3; k++)
+      d[k] = rgb[i * 3 + k] - mean[k];
+    cov[0] += d[0] * d[0];
+    cov[1] += d[0] * d[1];
+    cov[2] += d[0] * d[2];
+    cov[3] += d[1] * d[1];
+    cov[4] += d[1] * d[2];
+    cov[5] += d[2] * d[2];
+  }
+  float axis[3] = {1.0f, 1.0f, 1.0f};
+  for (int iteration = 0; iteration < 8; iteration++) {
+    float next[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                     cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                     cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+    float length = std::max(std::max(fabsf(next[0]), fabsf(next[1])), fabsf(next[2]));
+    if (length < 1e-6f)
+      break;
+    for (int k = 0; k < 3; k++)
+      axis[k] = next[k] / length;
+  }
+
+  float lo = 1e30f, hi = -1e30f;
+  for (int i = 0; i < 16; i++) {
+    float t = 0.0f;
+    for (int k = 0; k < 3; k++)
+      t += (rgb[i * 3 + k] - mean[k]) * axis[k];
+    lo = std::min(lo, t);
+    hi = std::max(hi, t);
+  }
+  float length2 = axis[0] * axis[0] + axis[1] * axis[1] + axis[2] * axis[2];
+  float end0[3], end1[3];
+  for (int k = 0; k < 3; k++) {
+    end0[k] = mean[k] + axis[k] * hi / length2;
+    end1[k] = mean[k] + axis[k] * lo / length2;
+  }
+  unsigned short c0, c1;
+  unsigned int indices;
+  float error = fitBC1(rgb, end0, end1, &c0, &c1, &indices);
+
+  /* least-squares endpoints for the chosen indices, kept while they help */
+  for (int iteration = 0; iteration < 2 && c0 != c1; iteration++) {
+    const float weights[4] = {1.0f, 0.0f, 2.0f / 3.0f, 1.0f / 3.0f};
+    float aa = 0.0f, bb = 0.0f, ab = 0.0f;
+    float ax[3] = {0.0f, 0.0f, 0.0f}, bx[3] = {0.0f, 0.0f, 0.0f};
+    for (int i = 0; i < 16; i++) {
+      float w = weights[(indices >> (2 * i)) & 3];
+      aa += w * w;
+      bb += (1.0f - w) * (1.0f - w);
+      ab += w * (1.0f - w);
+      for (int k = 0; k < 3; k++) {
+        ax[k] += w * rgb[i * 3 + k];
+        bx[k] += (1.0f - w) * rgb[i * 3 + k];
+      }
+    }
+    float det = aa * bb - ab * ab;
+    if (fabsf(det) < 1e-6f)
+      break;
+    float fit0[3], fit1[3];
+    for (int k = 0; k < 3; k++) {
+      fit0[k] = (ax[k] * bb - bx[k] * ab) / det;
+      fit1[k] = (bx[k] * aa - ax[k] * ab) / det;
+    }
+    unsigned short n0, n1;
+    unsigned int n_indices;
+    float n_error = fitBC1(rgb, fit0, fit1, &n0, &n1, &n_indices);
+    if (n_error >= error)
+      break;
+    error = n_error;
+    c0 = n0;
+    c1 = n1;
+    indices = n_indices;
+  }
+
+  out[0] = c0 & 0xff;
+  out[1] = c0 >> 8;
+  out[2] = c1 & 0xff;
+  out[3] = c1 >> 8;
+  for (int k = 0; k < 4; k++)
+    out[4 + k] = (indices >> (8 * k)) & 0xff;
+}
+
+static void decodeBC1(const unsigned char *in, unsigned char *rgb) {
+  unsigned short c0 = in[0] | (in[1] << 8), c1 = in[2] | (in[3] << 8);
+  float palette[4][3];
+  unpack565(c0, palette[0]);
+  unpack565(c1, palette[1]);
+  for (int k = 0; k < 3; k++) {
+    if (c0 > c1) {
+      palette[2][k] = (2.0f * palette[0][k] + palette[1][k]) / 3.0f;
+      palette[3][k] = (palette[0][k] + 2.0f * palette[1][k]) / 3.0f;
+    } else {
+      palette[2][k] = (palette[0][k] + palette[1][k]) / 2.0f;
+      palette[3][k] = 0.0f;
+    }
+  }
+  unsigned int indices = in[4] | (in[5] << 8) | (in[6] << 16) | ((unsigned int)in[7] << 24);
+  for (int i = 0; i < 16; i++)
+    for (int k = 0; k < 3; k++)
+      rgb[i * 3 + k] = (unsigned char)(palette[(indices >> (2 * i)) & 3][k] + 0.5f);
+}
+
+/* 8-value mode spanning the block's range, stride picks the channel */
+static void encodeBC4(const unsigned char *values, int stride, unsigned char *out) {
+  unsigned char lo = 255, hi = 0;
+  for (int i = 0; i < 16; i++) {
+    lo = std::min(lo, values[i * stride]);
+    hi = std::max(hi, values[i * stride]);
+  }
+  out[0] = hi;
+  out[1] = lo;
+  unsigned long long indices = 0;
+  if (hi > lo) {
+    float palette[8];
+    palette[0] = hi;
+    palette[1] = lo;
+    for (int p = 2; p < 8; p++)
+      palette[p] = ((8 - p) * hi + (p - 1) * lo) / 7.0f;
+    for (int i = 0; i < 16; i++) {
+      int best = 0;
+      float best_error = 1e30f;
+      for (int p = 0; p < 8; p++) {
+        float error = fabsf(values[i * stride] - palette[p]);
+        if (error < best_error) {
+          best_error = error;
+          best = p;
+        }
+      }
+      indices |= (unsigned long long)best << (3 * i);
+    }
+  }
+  for (int k = 0; k < 6; k++)
+    out[2 + k] = (indices >> (8 * k)) & 0xff;
+}
+
+static void decodeBC4(const unsigned char *in, unsigned char *values, int stride) {
+  float palette[8];
+  palette[0] = in[0];
+  palette[1] = in[1];
+  for (int p = 2; p < 8; p++) {
+    if (in[0] > in[1])
+      palette[p] = ((8 - p) * in[0] + (p - 1) * in[1]) / 7.0f;
+    else
+      palette[p] = p < 6 ? ((6 - p) * in[0] + (p - 1) * in[1]) / 5.0f
+                         : (p == 6 ? 0.0f : 255.0f);
+  }
+  unsigned long long indices = 0;
+  for (int k = 0; k < 6; k++)
+    indices |= (unsigned long long)in[2 + k] << (8 * k);
+  for (int i = 0; i < 16; i++)
+    values[i * stride] = (unsigned char)(palette[(indices >> (3 * i)) & 7] + 0.5f);
+}
+
+/* compresses one level and returns the squared error summed over channels */
+static double compressLevel(const std::vector<unsigned char> &pixels, int width,
+                            int height, Texture_Kind kind,
+                            unsigned char *blocks) {
+  int channels = kindChannels(kind);
+  size_t block_size = kind == NORMAL_MAP ? 16 : 8;
+  int blocks_x = (width + 3) / 4, blocks_y = (height + 3) / 4;
+  double error = 0.0;
+  unsigned char block[16 * 3], decoded[16 * 3];
+  for (int by = 0; by < blocks_y; by++) {
+    for (int bx = 0; bx < blocks_x; bx++) {
+      unsigned char *out = blocks + ((size_t)by * blocks_x + bx) * block_size;
+      fetchBlock(pixels.data(), width, height, channels, bx, by, block);
+      if (channels == 3) {
+        encodeBC1(block, out);
+        decodeBC1(out, decoded);
+      } else if (kind == DATA_MAP) {
+        encodeBC4(block, 1, out);
+        decodeBC4(out, decoded, 1);
+      } else {
+        encodeBC4(block, 2, out);
+        encodeBC4(block + 1, 2, out + 8);
+        decodeBC4(out, decoded, 2);
+        decodeBC4(out + 8, decoded + 1, 2);
+      }
+      /* padding texels of edge blocks are not counted */
+      for (int y = 0; y < 4 && by * 4 + y < height; y++)
+        for (int x = 0; x < 4 && bx * 4 + x < width; x++)
+          for (int k = 0; k < channels; k++) {
+            double d = (double)block[(y * 4 + x) * channels + k] -
+                       decoded[(y * 4 + x) * channels + k];
+            error += d * d;
+          }
+    }
+  }
+  return error;
+}
+
+/* ---- container ---- */
+
+static const char *kindName(Texture_Kind kind) {
+  switch (kind) {
+  case COLOR_MAP:
+    return "color";
+  case DATA_MAP:
+    return "data";
+  case NORMAL_MAP:
+    return "normal";
+  default:
+    return "rmo";
+  }
+}
+
+static GLenum bakedFormat(Texture_Kind kind) {
+  if (kind == COLOR_MAP || kind == PACKED_MAP)
+    return has_s3tc ? GL_COMPRESSED_RGB_S3TC_DXT1_EXT : GL_RGB8;
+  return kind == DATA_MAP ? GL_COMPRESSED_RED_RGTC1 : GL_COMPRESSED_RG_RGTC2;
+}
+
+static texture_data_t *emptyTexture(GLenum internal_format) {
+  texture_data_t *data = new texture_data_t();
+  data->internal_format = internal_format;
+  data->format = transferFormat(internal_format);
+  data->type = GL_UNSIGNED_BYTE;
+  data->compressed = isCompressed(internal_format);
+  data->raw_bytes = 0;
+  return data;
+}
+
+/* stamp of every source a texture is built from, one file or several */
+static bool sourceStamp(const std::vector<std::string> &sources,
+                        long long *mtime, unsigned long long *size) {
+  if (sources.size() == 1)
+    return fileStamp(sources[0], mtime, size);
+  unsigned long long hash = hashBytes(nullptr, 0);
+  *size = 0;
+  for (const std::string &source : sources) {
+    long long source_mtime = 0;
+    unsigned long long source_size = 0;
+    if (source != "null" && !fileStamp(source, &source_mtime, &source_size))
+      return false;
+    hash = hashBytes(source.data(), source.size(), hash);
+    hash = hashBytes(&source_mtime, sizeof(source_mtime), hash);
+    *size += source_size;
+  }
+  *mtime = (long long)hash;
+  return true;
+}
+
+static texture_data_t *loadTextureCache(const std::vector<std::string> &sources,
+                                        const std::string &cache_name,
+                                        GLenum internal_format) {
+  long long mtime;
+  unsigned long long size;
+  if (!sourceStamp(sources, &mtime, &size))
+    return nullptr;
+
+  mapped_file_t file;
+  if (!file.open(cache_name))
+    return nullptr;
+  if (file.size < sizeof(texture_cache_header_t))
+    return nullptr;
+
+  texture_cache_header_t header;
+  memcpy(&header, file.data, sizeof(header));
+  if (header.magic != TEXTURE_CACHE_MAGIC ||
+      header.version != TEXTURE_CACHE_VERSION ||
+      header.internal_format != internal_format ||
+      header.source_mtime != mtime || header.source_size != size)
+    return nullptr;
+  size_t table_size = header.num_levels * sizeof(texture_cache_level_t);
+  if (file.size != sizeof(header) + table_size + header.data_bytes)
+    return nullptr;
+
+  texture_data_t *data = emptyTexture(internal_format);
+  data->raw_bytes = header.raw_bytes;
+  const char *table = file.data + sizeof(header);
+  for (unsigned int i = 0; i < header.num_levels; i++) {
+    texture_cache_level_t level;
+    memcpy(&level, table + i * sizeof(level), sizeof(level));
+    if (level.offset + level.size > header.data_bytes) {
+      delete data;
+      return nullptr;
+    }
+    data->levels.push_back({level.width, level.height, (size_t)level.offset,
+                            (size_t)level.size});
+  }
+  const unsigned char *bytes =
+      (const unsigned char *)file.data + sizeof(header) + table_size;
+  data->bytes.assign(bytes, bytes + header.data_bytes);
+  return data;
+}
+
+static void saveTextureCache(const std::vector<std::string> &sources,
+                             const std::string &cache_name,
+                             texture_data_t *data) {
+  texture_cache_header_t header;
+  memset(&header, 0, sizeof(header));
+  header.magic = TEXTURE_CACHE_MAGIC;
+  header.version = TEXTURE_CACHE_VERSION;
+  if (!sourceStamp(sources, &header.source_mtime, &header.source_size))
+    return;
+  header.internal_format = data->internal_format;
+  header.num_levels = (unsigned int)data->levels.size();
+  header.raw_bytes = data->raw_bytes;
+  header.data_bytes = data->bytes.size();
+
+  std::vector<texture_cache_level_t> table;
+  for (texture_level_t &level : data->levels)
+    table.push_back({level.width, level.height, level.offset, level.size});
+
+  const void *chunks[] = {&header, table.data(), data->bytes.data()};
+  size_t sizes[] = {sizeof(header), table.size() * sizeof(texture_cache_level_t),
+                    data->bytes.size()};
+  if (!writeFileAtomic(cache_name, chunks, sizes, 3))
+    std::cout << "Failed to write texture cache: " << cache_name << std::endl;
+}
+
+/* mip chain down to 1x1, or level 0 alone, block compressed where the
+   format allows */
+static texture_data_t *bakeTexture(float_image_t level, Texture_Kind kind,
+                                   GLenum internal_format, bool mips,
+                                   size_t raw_bytes) {
+  texture_data_t *data = emptyTexture(internal_format);
+  data->raw_bytes = raw_bytes;
+  int width = level.width, height = level.height;
+
+  double level0_error = 0.0;
+  while (true) {
+    std::vector<unsigned char> pixels = encodeLevel(level, kind);
+    texture_level_t entry = {level.width, level.height, data->bytes.size(), 0};
+    data->levels.push_back(entry);
+    int index = (int)data->levels.size() - 1;
+    entry.size = data->rowBytes(index) *
+                 ((level.height + data->rowHeight() - 1) / data->rowHeight());
+    data->levels[index].size = entry.size;
+    data->bytes.resize(entry.offset + entry.size, 0);
+
+    unsigned char *dst = data->bytes.data() + entry.offset;
+    if (data->compressed) {
+      double error = compressLevel(pixels, level.width, level.height, kind, dst);
+      if (index == 0)
+        level0_error = error;
+    } else {
+      size_t row = pixels.size() / level.height;
+      for (int y = 0; y < level.height; y++)
+        memcpy(dst + y * data->rowBytes(index), pixels.data() + y * row, row);
+    }
+
+    if (!mips || (level.width == 1 && level.height == 1))
+      break;
+    level = downsample(level, kind);
+  }
+
+  if (VERBOSE_ASSETS && data->compressed) {
+    double rmse =
+        sqrt(level0_error / ((double)width * height * kindChannels(kind)));
+    printf("baked %dx%d %s map, %zu levels, %.1f KB -> %.1f KB, rmse %.2f\n",
+           width, height, kindName(kind), data->levels.size(),
+           data->raw_bytes / 1024.0, data->bytes.size() / 1024.0, rmse);
+  }
+  return data;
+}
+
+texture_data_t *loadTexture(const std::string &path, Texture_Kind kind) {
+  if (!BAKE_TEXTURES) {
+    image_t image;
+    image.load(path, true);
+    GLenum format = kind == DATA_MAP ? GL_RED : GL_RGB;
+    return textureFromImage(&image, format, format, GL_UNSIGNED_BYTE);
+  }
+
+  GLenum internal_format = bakedFormat(kind);
+  std::vector<std::string> sources = {path};
+  std::string cache_name = path + "." + kindName(kind) + ".cache";
+  texture_data_t *data = loadTextureCache(sources, cache_name, internal_format);
+  if (data != nullptr)
+    return data;
+
+  image_t image;
+  if (!image.load(path, true)) {
+    std::cout << "Failed to load texture: " << path << std::endl;
+    return textureFromImage(&image, GL_RGB, GL_RGB, GL_UNSIGNED_BYTE);
+  }
+  size_t raw_bytes = (size_t)image.width * image.height * (kind == DATA_MAP ? 1 : 3);
+  data = bakeTexture(decodeSource(&image, kind), kind, internal_format, true,
+                     raw_bytes);
+  saveTextureCache(sources, cache_name, data);
+  return data;
+}
+
+texture_data_t *loadPackedTexture(const std::string &roughness,
+                                  const std::string &metalness,
+                                  const std::string &occlusion) {
+  std::vector<std::string> sources = {roughness, metalness, occlusion};
+  GLenum internal_format = BAKE_TEXTURES ? bakedFormat(PACKED_MAP) : GL_RGB8;
+  std::string first = roughness != "null" ? roughness
+                      : metalness != "null" ? metalness
+                                            : occlusion;
+  std::string cache_name = first + "." + kindName(PACKED_MAP) + ".cache";
+  if (BAKE_TEXTURES) {
+    texture_data_t *data = loadTextureCache(sources, cache_name, internal_format);
+    if (data != nullptr)
+      return data;
+  }
+
+  image_t images[3];
+  float_image_t packed;
+  packed.width = 1;
+  packed.height = 1;
+  packed.channels = 3;
+  size_t raw_bytes = 0;
+  for (int k = 0; k < 3; k++) {
+    if (sources[k] == "null")
+      continue;
+    if (!images[k].load(sources[k], true)) {
+      std::cout << "Failed to load texture: " << sources[k] << std::endl;
+      continue;
+    }
+    packed.width = std::max(packed.width, images[k].width);
+    packed.height = std::max(packed.height, images[k].height);
+    raw_bytes += (size_t)images[k].width * images[k].height;
+  }
+
+  /* smaller sources are stretched nearest-neighbour to the largest one,
+     missing channels hold what the shaders would assume anyway */
+  const float missing[3] = {0.0f, 0.0f, 1.0f};
+  packed.texels.resize((size_t)packed.width * packed.height * 3);
+  for (int y = 0; y < packed.height; y++) {
+    for (int x = 0; x < packed.width; x++) {
+      float *out = packed.at(x, y);
+      for (int k = 0; k < 3; k++) {
+        const image_t &image = images[k];
+        if (image.data == nullptr) {
+          out[k] = missing[k];
+          continue;
+        }
+        int sx = x * image.width / packed.width;
+        int sy = y * image.height / packed.height;
+        const unsigned char *texel =
+            (const unsigned char *)image.data +
+            ((size_t)sy * image.width + sx) * image.channels;
+        out[k] = texel[0] / 255.0f;
+      }
+    }
+  }
+
+  texture_data_t *data = bakeTexture(packed, PACKED_MAP, internal_format,
+                                     BAKE_TEXTURES, raw_bytes);
+  if (BAKE_TEXTURES)
+    saveTextureCache(sources, cache_name, data);
+  return data;
+}
@@ -0,0 +1,99 @@
+#include <cstring>
+
+#include "uniforms.hpp"
+
+/* segment room for this many blocks before the first grow */
+#define UNIFORM_RING_MIN_BLOCKS 64
+
+/* the std140 offsets the blocks in the shaders rely on */
+static_assert(sizeof(frame_uniforms_t) == 560, "FrameBlock layout");
+static_assert(offsetof(frame_uniforms_t, camera_pos) == 512, "FrameBlock layout");
+static_assert(offsetof(frame_uniforms_t, quantized) == 544, "FrameBlock layout");
+
+uniform_ring_t::uniform_ring_t(size_t block_size, GLenum target) {
+  this->target = target;
+  this->block_size = block_size;
+  this->stride = block_size;
+  this->buffer = 0;
+  this->segment_bytes = 0;
+  this->segment = 0;
+  this->mapped = nullptr;
+  this->created = false;
+  for (int i = 0; i < UNIFORM_RING_SEGMENTS; i++)
+    this->fences[i] = nullptr;
+}
+
+uniform_ring_t::~uniform_ring_t() {
+  for (int i = 0; i < UNIFORM_RING_SEGMENTS; i++) {
+    if (this->fences[i] != nullptr)
+      glDeleteSync(this->fences[i]);
+  }
+  if (this->created)
+    glDeleteBuffers(1, &this->buffer);
+}
+
+void uniform_ring_t::map(int count) {
+  if (!this->created) {
+    if (this->target == GL_UNIFORM_BUFFER) {
+      GLint alignment = 256;
+      glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &alignment);
+      this->stride = (this->block_size + alignment - 1) / alignment * alignment;
+    }
+    glGenBuffers(1, &this->buffer);
+    this->created = true;
+  }
+  glBindBuffer(this->target, this->buffer);
+
+  size_t bytes = (size_t)count * this->stride;
+  if (this->segment_bytes == 0 || bytes > this->segment_bytes) {
+    /* fresh storage, so nothing in flight can still read it */
+    size_t blocks = UNIFORM_RING_MIN_BLOCKS;
+    while (blocks < (size_t)count)
+      blocks *= 2;
+    this->segment_bytes = blocks * this->stride;
+    glBufferData(this->target, this->segment_bytes * UNIFORM_RING_SEGMENTS,
+                 nullptr, GL_STREAM_DRAW);
+    for (int i = 0; i < UNIFORM_RING_SEGMENTS; i++) {
+      if (this->fences[i] != nullptr)
+        glDeleteSync(this->fences[i]);
+      this->fences[i] = nullptr;
+    }
+  } else {
+    /* everything issued so far is all that reads the segment we leave */
+    this->fences[this->segment] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  }
+  this->segment = (this->segment + 1) % UNIFORM_RING_SEGMENTS;
+
+  GLsync fence = this->fences[this->segment];
+  if (fence != nullptr) {
+    while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) ==
+           GL_TIMEOUT_EXPIRED) {
+    }
+    glDeleteSync(fence);
+    this->fences[this->segment] = nullptr;
+  }
+  this->mapped = (unsigned char *)glMapBufferRange(
+      this->target, this->segment * this->segment_bytes,
+      bytes > 0 ? bytes : this->stride,
+      GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT |
+          GL_MAP_UNSYNCHRONIZED_BIT);
+}
+
+void uniform_ring_t::write(int index, const void *block) {
+  memcpy(this->mapped + (size_t)index * this->stride, block, this->block_size);
+}
+
+void uniform_ring_t::unmap() {
+  glBindBuffer(this->target, this->buffer);
+  glUnmapBuffer(this->target);
+  this->mapped = nullptr;
+}
+
+void uniform_ring_t::bind(unsigned int binding, int index) const {
+  glBindBufferRange(GL_UNIFORM_BUFFER, binding, this->buffer, offset(index),
+                    this->block_size);
+}
+
+size_t uniform_ring_t::offset(int index) const {
+  return this->segment * this->segment_bytes + (size_t)index * this->stride;
+}
@@ -0,0 +1,90 @@
+#include <algorithm>
+#include <cstring>
+
+#include "state.hpp"
+#include "upload.hpp"
+
+static GLenum bindingTarget(GLenum target) {
+  if (target >= GL_TEXTURE_CUBE_MAP_POSITIVE_X &&
+      target <= GL_TEXTURE_CUBE_MAP_NEGATIVE_Z)
+    return GL_TEXTURE_CUBE_MAP;
+  return target;
+}
+
+texture_upload_t::texture_upload_t(texture_data_t *data, unsigned int texture,
+                                   GLenum target, unsigned int *slot) {
+  this->data = data;
+  this->texture = texture;
+  this->target = target;
+  this->level = 0;
+  this->next_row = 0;
+  this->slot = slot;
+
+  glState().bindTexture(0, bindingTarget(target), texture);
+  for (int i = 0; i < (int)data->levels.size(); i++) {
+    const texture_level_t &level = data->levels[i];
+    if (data->compressed)
+      glCompressedTexImage2D(target, i, data->internal_format, level.width,
+                             level.height, 0, (int)level.size, nullptr);
+    else
+      glTexImage2D(target, i, data->internal_format, level.width, level.height,
+                   0, data->format, data->type, nullptr);
+  }
+}
+
+size_t texture_upload_t::stream(unsigned int pbo, size_t budget) {
+  size_t sent = 0;
+  /* an empty level has no rows to send */
+  while (this->level < (int)this->data->levels.size() &&
+         (this->data->levels[this->level].height == 0 ||
+          this->data->rowBytes(this->level) == 0))
+    this->level++;
+  if (this->level < (int)this->data->levels.size()) {
+    const texture_level_t &level = this->data->levels[this->level];
+    int row_height = this->data->rowHeight();
+    int num_rows = (level.height + row_height - 1) / row_height;
+    size_t pitch = this->data->rowBytes(this->level);
+    size_t rows = std::min<size_t>(std::max<size_t>(1, budget / pitch),
+                                   num_rows - this->next_row);
+    size_t offset = this->next_row * pitch;
+    sent = std::min(rows * pitch, level.size - offset);
+    int y = this->next_row * row_height;
+    int height = std::min((int)rows * row_height, level.height - y);
+
+    if (sent > 0) {
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, pbo);
+      /* orphan last frame's storage so the copy never waits on the GPU */
+      glBufferData(GL_PIXEL_UNPACK_BUFFER, sent, nullptr, GL_STREAM_DRAW);
+      void *staging = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, sent,
+                                       GL_MAP_WRITE_BIT |
+                                           GL_MAP_INVALIDATE_BUFFER_BIT);
+      memcpy(staging, this->data->bytes.data() + level.offset + offset, sent);
+      glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+      glState().bindTexture(0, bindingTarget(this->target), this->texture);
+      if (this->data->compressed)
+        glCompressedTexSubImage2D(this->target, this->level, 0, y, level.width,
+                                  height, this->data->internal_format,
+                                  (int)sent, (void *)0);
+      else
+        glTexSubImage2D(this->target, this->level, 0, y, level.width, height,
+                        this->data->format, this->data->type, (void *)0);
+      glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    }
+    this->next_row += (int)rows;
+    if (this->next_row >= num_rows) {
+      this->level++;
+      this->next_row = 0;
+    }
+  }
+
+  if (this->level >= (int)this->data->levels.size()) {
+    delete this->data;
+    this->data = nullptr;
+    if (this->slot != nullptr)
+      *this->slot = this->texture;
+  }
+  return sent;
+}
+
+bool texture_upload_t::done() const { return this->data == nullptr; }